@@ -27,8 +27,12 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <functional>
@@ -36,8 +40,12 @@
 #include <iomanip>
 #include <iostream>
 #include <libintl.h>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <vector>
 
 #include "libzwerg.hh"
@@ -484,6 +492,15 @@ dumper::dump_value (std::ostream &os, zw_value const &val, format fmt)
     os << ">";
 }
 
+namespace
+{
+  struct file_status
+  {
+    bool match = false;
+    bool error = false;
+  };
+}
+
 int
 main(int argc, char *argv[])
 try
@@ -499,6 +516,11 @@ try
     bool show_count = false;
     bool with_filename = false;
     bool no_filename = false;
+    unsigned jobs = 1;
+    uint64_t max_count = std::numeric_limits <uint64_t>::max ();
+    std::string index_directory;
+    zw_backend backend = ZW_BACKEND_OP;
+    bool show_profile = false;
 
     std::unique_ptr <zw_vocabulary, zw_deleter> voc
 	{zw_vocabulary_init (zw_throw_on_error {})};
@@ -545,6 +567,36 @@ try
 	    no_messages = true;
 	    break;
 
+	  case 'j':
+	    {
+	      char *end;
+	      unsigned long n = strtoul (optarg, &end, 10);
+	      if (*optarg == '\0' || *end != '\0' || n == 0 || n > 1024)
+		{
+		  std::cerr << "Error: invalid number of jobs `"
+			    << optarg << "'.\n";
+		  return 2;
+		}
+	      jobs = n;
+	      break;
+	    }
+
+	  case 'm':
+	    {
+	      char *end;
+	      errno = 0;
+	      unsigned long long n = strtoull (optarg, &end, 10);
+	      if (*optarg == '\0' || *optarg == '-' || *end != '\0'
+		  || errno != 0)
+		{
+		  std::cerr << "Error: invalid max count `"
+			    << optarg << "'.\n";
+		  return 2;
+		}
+	      max_count = n;
+	      break;
+	    }
+
 	  case 'f':
 	    {
 	      auto buf_to_string = [] (std::istream &is)
@@ -571,7 +623,22 @@ try
 	    }
 
 	  default:
-	    if (c == help)
+	    if (c == index_dir)
+	      {
+		index_directory = optarg;
+		break;
+	      }
+	    else if (c == vm)
+	      {
+		backend = ZW_BACKEND_VM;
+		break;
+	      }
+	    else if (c == profile)
+	      {
+		show_profile = true;
+		break;
+	      }
+	    else if (c == help)
 	      {
 		show_help (ext_options);
 		return 0;
@@ -594,18 +661,18 @@ try
     std::unique_ptr <zw_query, zw_deleter> query {
 	[&] ()
 	  {
-	    if (query_specified)
-	      return zw_query_parse_len (voc.get (), query_str.c_str (),
-					 query_str.length (),
-					 zw_throw_on_error {});
-	    else
+	    if (! query_specified)
 	      {
 		if (argc == 0)
 		  throw std::runtime_error ("No query specified.");
 
 		argc--;
-		return zw_query_parse (&*voc, *argv++, zw_throw_on_error {});
+		query_str = *argv++;
 	      }
+
+	    return zw_query_parse_backend (voc.get (), query_str.c_str (),
+					   query_str.length (), backend,
+					   zw_throw_on_error {});
 	  } ()};
 
     std::vector <char const *> to_process;
@@ -621,80 +688,218 @@ try
     if (no_filename)
 	with_filename = false;
 
-    bool errors = false;
-    bool match = false;
-    for (auto const &fn: to_process)
-      try
-	{
-	  std::unique_ptr <zw_stack, zw_deleter> stack
+    // Run the query over file FN and write the results to OS.  Units
+    // of the file are processed by up to NTHREADS threads.  When QUIT
+    // is raised (by -q having seen a match elsewhere), stop pulling
+    // further results.
+    auto process_file = [&] (char const *fn, std::ostream &os,
+			     unsigned nthreads,
+			     std::atomic <bool> &quit) -> file_status
+      {
+	file_status status;
+	try
+	  {
+	    std::unique_ptr <zw_stack, zw_deleter> stack
 		{zw_stack_init (zw_throw_on_error {})};
 
-	  if (fn[0] != '\0')
-	    {
-	      std::unique_ptr <zw_value, zw_deleter> dwv
+	    if (fn[0] != '\0')
+	      {
+		std::unique_ptr <zw_value, zw_deleter> dwv
 			{zw_value_init_dwarf (fn, 0, zw_throw_on_error {})};
 
-	      zw_stack_push_take (stack.get (), dwv.get (),
-				  zw_throw_on_error {});
-	      dwv.release ();
-	    }
-	  dumper dump {*voc};
+		if (! index_directory.empty ())
+		  zw_value_dwarf_set_index_dir (dwv.get (),
+						index_directory.c_str (),
+						zw_throw_on_error {});
+
+		zw_stack_push_take (stack.get (), dwv.get (),
+				    zw_throw_on_error {});
+		dwv.release ();
+	      }
+	    dumper dump {*voc};
+
+	    std::unique_ptr <zw_result, zw_deleter> result
+		{show_profile
+		 ? zw_query_execute_profile (query.get (), stack.get (),
+					     zw_throw_on_error {})
+		 : nthreads > 1
+		 ? zw_query_execute_parallel (query.get (), stack.get (),
+					      nthreads, zw_throw_on_error {})
+		 : zw_query_execute (query.get (), stack.get (),
+				     zw_throw_on_error {})};
+
+	    // Unless this is -q or -m, all results need to be seen.
+	    // When only their number matters, they need not be
+	    // exported.  Otherwise results are pulled one at a time,
+	    // and once we stop asking, the query stops producing.
+	    uint64_t count = 0;
+	    if (show_count && verbosity >= 0
+		&& max_count == std::numeric_limits <uint64_t>::max ())
+	      {
+		count = zw_result_count (*result);
+		status.match = count > 0;
+	      }
+	    else
+	      while (! quit && count < max_count)
+		{
+		  auto out = zw_result_next (*result);
+		  if (out == nullptr)
+		    break;
 
-	  std::unique_ptr <zw_result, zw_deleter> result
-		{zw_query_execute (query.get (), stack.get (),
-				   zw_throw_on_error {})};
+		  status.match = true;
 
-	  uint64_t count = 0;
-	  while (auto out = zw_result_next (*result))
-	    {
-	      // grep: Exit immediately with zero status if any match
-	      // is found, even if an error was detected.
-	      if (verbosity < 0)
-		return 0;
+		  // grep: Exit immediately with zero status if any match
+		  // is found, even if an error was detected.
+		  if (verbosity < 0)
+		    {
+		      quit = true;
+		      break;
+		    }
 
-	      match = true;
-	      if (! show_count)
-		{
-		  if (with_filename)
-		    std::cout << fn << ":\n";
-		  if (zw_stack_depth (out.get ()) > 1)
-		    std::cout << "---\n";
-		  for (size_t i = 0, n = zw_stack_depth (out.get ());
-		       i < n; ++i)
+		  if (! show_count)
 		    {
-		      auto const *val = zw_stack_at (out.get (), i);
-		      assert (val != nullptr);
-		      dump.dump_value (std::cout, *val, dumper::format::full);
-		      std::cout << std::endl;
+		      if (with_filename)
+			os << fn << ":\n";
+		      if (zw_stack_depth (out.get ()) > 1)
+			os << "---\n";
+		      for (size_t i = 0, n = zw_stack_depth (out.get ());
+			   i < n; ++i)
+			{
+			  auto const *val = zw_stack_at (out.get (), i);
+			  assert (val != nullptr);
+			  dump.dump_value (os, *val, dumper::format::full);
+			  os << std::endl;
+			}
 		    }
+		  ++count;
 		}
-	      else
-		++count;
-	    }
 
-	  if (show_count)
-	    {
-	      if (with_filename)
-		std::cout << fn << ":";
-	      std::cout << std::dec << count << std::endl;
-	    }
-	}
-      catch (std::runtime_error const &e)
-	{
-	  if (! no_messages)
-	    std::cout << "dwgrep: " << (fn[0] != '\0' ? fn : "<no-file>")
-		      << ": " << e.what () << std::endl;
+	    if (show_count && ! quit)
+	      {
+		if (with_filename)
+		  os << fn << ":";
+		os << std::dec << count << std::endl;
+	      }
+
+	    if (show_profile)
+	      {
+		std::unique_ptr <zw_value, zw_deleter> prof
+			{zw_result_profile (result.get (),
+					    zw_throw_on_error {})};
+		size_t len;
+		char const *buf = zw_value_str_str (prof.get (), &len);
+
+		// Write it in one go, files may be processed in parallel.
+		std::stringstream ss;
+		if (fn[0] != '\0')
+		  ss << "dwgrep: " << fn << ": profile:\n";
+		ss.write (buf, len);
+		std::cerr << ss.str () << std::flush;
+	      }
+	  }
+	catch (std::runtime_error const &e)
+	  {
+	    if (! no_messages)
+	      os << "dwgrep: " << (fn[0] != '\0' ? fn : "<no-file>")
+		 << ": " << e.what () << std::endl;
+
+	    if (verbosity >= 0)
+	      status.error = true;
+	  }
+	catch (...)
+	  {
+	    os << "blah\n";
+	  }
 
-	  if (verbosity >= 0)
-	    errors = true;
+	return status;
+      };
 
-	  continue;
-	}
-      catch (...)
+    std::atomic <bool> quit {false};
+    bool errors = false;
+    bool match = false;
+
+    // With a single input file, use the threads to process its units
+    // in parallel instead.
+    unsigned unit_jobs = to_process.size () == 1 ? jobs : 1;
+    if (jobs > to_process.size ())
+      jobs = to_process.size ();
+
+    if (jobs <= 1)
+      for (auto const &fn: to_process)
 	{
-	  std::cout << "blah\n";
-	  continue;
+	  file_status status = process_file (fn, std::cout, unit_jobs, quit);
+	  if (quit)
+	    return 0;
+	  errors = errors || status.error;
+	  match = match || status.match;
 	}
+    else
+      {
+	// Each worker picks the next unprocessed file and runs the
+	// query over it with its own input stack, result and Dwfl.
+	// Output is buffered per file and flushed by the main thread
+	// in command-line order, so that it doesn't depend on
+	// scheduling.
+	struct file_output
+	{
+	  std::ostringstream os;
+	  file_status status;
+	  bool done = false;
+	};
+
+	std::vector <file_output> outputs (to_process.size ());
+	std::atomic <size_t> next_file {0};
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	auto worker = [&] ()
+	  {
+	    while (! quit)
+	      {
+		size_t i = next_file++;
+		if (i >= to_process.size ())
+		  break;
+
+		file_status status
+		  = process_file (to_process[i], outputs[i].os, 1, quit);
+
+		std::lock_guard <std::mutex> lock {mutex};
+		outputs[i].status = status;
+		outputs[i].done = true;
+		cv.notify_one ();
+	      }
+
+	    // Wake up the main thread in case it's waiting for a file
+	    // that will now never be processed.
+	    std::lock_guard <std::mutex> lock {mutex};
+	    cv.notify_one ();
+	  };
+
+	std::vector <std::thread> workers;
+	for (unsigned i = 0; i < jobs; ++i)
+	  workers.emplace_back (worker);
+
+	for (auto &out: outputs)
+	  {
+	    {
+	      std::unique_lock <std::mutex> lock {mutex};
+	      cv.wait (lock, [&] () { return out.done || quit; });
+	    }
+
+	    if (quit)
+	      break;
+
+	    std::cout << out.os.str ();
+	    errors = errors || out.status.error;
+	    match = match || out.status.match;
+	  }
+
+	for (auto &thr: workers)
+	  thr.join ();
+
+	if (quit)
+	  return 0;
+      }
 
     if (errors)
 	return 2;
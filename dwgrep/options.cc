@@ -53,7 +53,7 @@ merge_options (std::vector <ext_option> const &ext_opts)
   return opts;
 }
 
-ext_shopt help, version;
+ext_shopt help, version, index_dir, vm, profile;
 
 std::vector <ext_option> ext_options = {
   {'q', "silent", ext_argument::no, ""},
@@ -88,6 +88,15 @@ std::vector <ext_option> ext_options = {
 	Print only a count of query results, not the results
 	themselves.
 
+)docstring"},
+
+  {'m', "max-count", ext_argument::required ("NUM"), R"docstring(
+
+	Stop reading a file after *NUM* query results.  The rest of
+	the file is not looked at, so e.g. units past the one where
+	the last result was found are not decoded.  With ``-c``, the
+	count printed is at most *NUM*.
+
 )docstring"},
 
   {'H', "with-filename", ext_argument::no,  R"docstring(
@@ -110,6 +119,48 @@ std::vector <ext_option> ext_options = {
 	file is read and run over the input file(s).  At most one
 	``-e`` or ``-f`` option shall be present.
 
+)docstring"},
+
+  {'j', "jobs", ext_argument::required ("N"), R"docstring(
+
+	Process up to *N* input files in parallel.  Output is printed
+	in the order in which the files were given on the command
+	line.  When there is a single input file and the query starts
+	with ``unit`` or ``entry``, its units are processed in
+	parallel instead, and output is the same as with a serial
+	run.  The default is 1.
+
+)docstring"},
+
+  {index_dir, "index-dir", ext_argument::required ("DIR"), R"docstring(
+
+	Keep indices of DIE's of the input files in directory *DIR*.
+	An index is built the first time a file with a given build ID
+	is queried, and reused by later runs over the same file.
+	Files without a build ID are not indexed.
+
+)docstring"},
+
+  {vm, "vm", ext_argument::no, R"docstring(
+
+	Run the query on a bytecode virtual machine instead of
+	evaluating it as a graph of operators.  Only the core control
+	flow is compiled, words and other constructs still run as
+	operators.  Results are the same and come in the same order.
+	This is mostly useful for comparing performance of the two.
+	It has no effect on parallel runs (see ``--jobs``).
+
+)docstring"},
+
+  {profile, "profile", ext_argument::no, R"docstring(
+
+	After the query is done with each file, write to standard error
+	the query tree annotated with how many times each operator was
+	called, how many stacks it produced and rejected, how long it
+	took and how many allocations it made, both including and
+	excluding operators nested in it.  Units of a file are then not
+	processed in parallel, and ``--vm`` has no effect.
+
 )docstring"},
 
   {help, "help", ext_argument::no, R"docstring(
@@ -31,14 +31,58 @@
 #include <memory>
 
 #include "op.hh"
+#include "profile.hh"
 #include "scope.hh"
 #include "tree.hh"
 #include "value-cst.hh"
 #include "value-seq.hh"
 #include "value-str.hh"
 
+namespace
+{
+  // Profiling nodes are created while the op graph is being built,
+  // so that they nest the way the tree does.
+  struct profile_scope
+  {
+    profiler &m_prof;
+    profile_node &m_node;
+
+    profile_scope (profiler &prof, tree const &t)
+      : m_prof (prof)
+      , m_node (prof.enter (t))
+    {}
+
+    ~profile_scope ()
+    {
+      m_prof.leave ();
+    }
+  };
+}
+
 std::unique_ptr <pred>
 tree::build_pred () const
+{
+  profiler *prof = profiler::current ();
+  if (prof == nullptr)
+    return do_build_pred ();
+
+  // Builtins that are not predicates yield nullptr here, don't leave
+  // a node for them behind.
+  if (m_tt == tree_type::F_BUILTIN)
+    {
+      auto pred = do_build_pred ();
+      if (pred == nullptr)
+	return nullptr;
+      profile_scope scope {*prof, *this};
+      return profile_pred (std::move (pred), scope.m_node);
+    }
+
+  profile_scope scope {*prof, *this};
+  return profile_pred (do_build_pred (), scope.m_node);
+}
+
+std::unique_ptr <pred>
+tree::do_build_pred () const
 {
   switch (m_tt)
     {
@@ -60,7 +104,8 @@ tree::build_pred () const
 	assert (m_children.size () == 1);
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_unique <pred_subx_any> (op, origin);
+	return std::make_unique <pred_subx_any> (op, origin,
+						 child (0).invariant ());
       }
 
     case tree_type::PRED_SUBX_CMP:
@@ -83,6 +128,7 @@ tree::build_pred () const
     case tree_type::ALT:
     case tree_type::OR:
     case tree_type::CAPTURE:
+    case tree_type::COUNT:
     case tree_type::SUBX_EVAL:
     case tree_type::EMPTY_LIST:
     case tree_type::CLOSE_STAR:
@@ -104,6 +150,24 @@ tree::build_pred () const
 
 std::shared_ptr <op>
 tree::build_exec (std::shared_ptr <op> upstream) const
+{
+  profiler *prof = profiler::current ();
+
+  // CAT only chains its children, and ASSERT and predicate builtins
+  // are accounted for by the pred node that they wrap.
+  if (prof == nullptr
+      || m_tt == tree_type::CAT
+      || m_tt == tree_type::ASSERT
+      || (m_tt == tree_type::F_BUILTIN
+	  && m_builtin->build_pred () != nullptr))
+    return do_build_exec (upstream);
+
+  profile_scope scope {*prof, *this};
+  return profile_op (do_build_exec (upstream), scope.m_node);
+}
+
+std::shared_ptr <op>
+tree::do_build_exec (std::shared_ptr <op> upstream) const
 {
   if (upstream == nullptr)
     upstream = std::make_shared <op_origin> (std::make_unique <stack> ());
@@ -129,7 +193,16 @@ tree::build_exec (std::shared_ptr <op> upstream) const
 
 	auto build_branch = [] (tree const &ch, std::shared_ptr <op> o)
 	  {
-	    return ch.build_exec (o);
+	    // The tines only run dry between inputs, they don't reset
+	    // the branches.  A `limit' has to start counting anew for
+	    // each input though.
+	    if (! mentions_builtin (ch, "limit"))
+	      return ch.build_exec (o);
+
+	    auto origin = std::make_shared <op_origin> (nullptr);
+	    return std::static_pointer_cast <op>
+	      (std::make_shared <op_per_input> (o, origin,
+						ch.build_exec (origin)));
 	  };
 
 	std::transform (m_children.begin (), m_children.end (),
@@ -209,31 +282,48 @@ tree::build_exec (std::shared_ptr <op> upstream) const
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_capture> (upstream, origin, op);
+	return std::make_shared <op_capture> (upstream, origin, op,
+					      child (0).invariant ());
       }
 
-    case tree_type::SUBX_EVAL:
+    case tree_type::COUNT:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_subx> (upstream, origin, op,
-					   cst ().value ().uval ());
+	return std::make_shared <op_count> (upstream, origin, op);
       }
 
-    case tree_type::CLOSE_STAR:
+    case tree_type::SUBX_EVAL:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_tr_closure> (upstream, origin, op,
-						 op_tr_closure_kind::star);
+	return std::make_shared <op_subx> (upstream, origin, op,
+					   cst ().value ().uval (),
+					   child (0).invariant ());
       }
 
+    case tree_type::CLOSE_STAR:
     case tree_type::CLOSE_PLUS:
       {
 	auto origin = std::make_shared <op_origin> (nullptr);
 	auto op = child (0).build_exec (origin);
-	return std::make_shared <op_tr_closure> (upstream, origin, op,
-						 op_tr_closure_kind::plus);
+	auto k = m_tt == tree_type::CLOSE_STAR
+	  ? op_tr_closure_kind::star : op_tr_closure_kind::plus;
+
+	// Closures over chains such as @AT_type tend to be walked
+	// from the same DIE's over and over.  If the closure only
+	// depends on TOS, remember where it leads, unless that's too
+	// far to be worth it (see memo_entry_size).
+	if (! tos_function ())
+	  return std::make_shared <op_tr_closure> (upstream, origin, op, k);
+
+	auto memo_origin = std::make_shared <op_origin> (nullptr);
+	auto closure = std::make_shared <op_tr_closure> (memo_origin, origin,
+							 op, k);
+	profiler *prof = profiler::current ();
+	return std::make_shared <op_memo>
+	  (upstream, memo_origin, closure, memo_cache_size, memo_entry_size,
+	   prof != nullptr ? &prof->building () : nullptr);
       }
 
     case tree_type::SCOPE:
@@ -184,26 +184,23 @@ yield at all if the set is empty.
 }
 
 
-namespace
+mpz_class
+addressify (constant c)
 {
-  mpz_class
-  addressify (constant c)
-  {
-    if (! c.dom ()->safe_arith ())
-      std::cerr << "Warning: the constant " << c
-		<< " doesn't seem to be suitable for use in address sets.\n";
+  if (! c.dom ()->safe_arith ())
+    std::cerr << "Warning: the constant " << c
+	      << " doesn't seem to be suitable for use in address sets.\n";
 
-    auto v = c.value ();
+  auto v = c.value ();
 
-    if (v < 0)
-      {
-	std::cerr
-	  << "Warning: Negative values are not allowed in address sets.\n";
-	v = 0;
-      }
+  if (v < 0)
+    {
+      std::cerr
+	<< "Warning: Negative values are not allowed in address sets.\n";
+      v = 0;
+    }
 
-    return v;
-  }
+  return v;
 }
 
 value_aset
@@ -416,7 +413,7 @@ address set, presented as individual address sets::
 
 
 pred_result
-pred_containsp_aset_cst::result (value_aset &a, value_cst &b)
+pred_containsp_aset_cst::result (value_aset const &a, value_cst const &b)
 {
   auto av = addressify (b.get_constant ());
   return pred_result (a.get_coverage ().is_covered (av.uval (), 1));
@@ -443,7 +440,7 @@ address set::
 
 
 pred_result
-pred_containsp_aset_aset::result (value_aset &a, value_aset &b)
+pred_containsp_aset_aset::result (value_aset const &a, value_aset const &b)
 {
   // ?contains holds if A contains all of B.
   for (size_t i = 0; i < b.get_coverage ().size (); ++i)
@@ -469,7 +466,7 @@ where all of *B*'s addresses are covered by *A*.
 
 
 pred_result
-pred_overlapsp_aset_aset::result (value_aset &a, value_aset &b)
+pred_overlapsp_aset_aset::result (value_aset const &a, value_aset const &b)
 {
   for (size_t i = 0; i < b.get_coverage ().size (); ++i)
     {
@@ -522,7 +519,7 @@ set that covers those addresses that both of the address sets cover.
 
 
 pred_result
-pred_emptyp_aset::result (value_aset &a)
+pred_emptyp_aset::result (value_aset const &a)
 {
   return pred_result (a.get_coverage ().empty ());
 }
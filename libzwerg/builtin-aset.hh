@@ -33,6 +33,10 @@
 #include "value-aset.hh"
 #include "value-cst.hh"
 
+// Value of constant C used as an address.  Warns if C doesn't look
+// like one, negative values are taken as zero.
+mpz_class addressify (constant c);
+
 struct op_elem_aset
   : public op_yielding_overload <value_cst, value_aset>
 {
@@ -155,7 +159,7 @@ struct pred_containsp_aset_cst
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_aset &a, value_cst &b) override;
+  pred_result result (value_aset const &a, value_cst const &b) override;
   static std::string docstring ();
 };
 
@@ -164,7 +168,7 @@ struct pred_containsp_aset_aset
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_aset &a, value_aset &b) override;
+  pred_result result (value_aset const &a, value_aset const &b) override;
   static std::string docstring ();
 };
 
@@ -173,7 +177,7 @@ struct pred_overlapsp_aset_aset
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_aset &a, value_aset &b) override;
+  pred_result result (value_aset const &a, value_aset const &b) override;
   static std::string docstring ();
 };
 
@@ -193,7 +197,7 @@ struct pred_emptyp_aset
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_aset &a) override;
+  pred_result result (value_aset const &a) override;
   static std::string docstring ();
 };
 
@@ -26,11 +26,14 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <memory>
+#include <stdexcept>
 
 #include "builtin-cst.hh"
+#include "infer.hh"
 #include "op.hh"
 #include "value-cst.hh"
 
@@ -95,6 +98,12 @@ builtin_constant::name () const
   return "constant";
 }
 
+void
+builtin_constant::stack_effect (stack_shape &shape) const
+{
+  shape.push (m_value->get_type ());
+}
+
 std::string
 builtin_constant::docstring () const
 {
@@ -228,6 +237,13 @@ op_type::next ()
   return nullptr;
 }
 
+void
+op_type::stack_effect (stack_shape &shape)
+{
+  shape.pop (1);
+  shape.push (value_cst::vtype);
+}
+
 std::string
 op_type::docstring ()
 {
@@ -255,6 +271,13 @@ op_pos::next ()
   return nullptr;
 }
 
+void
+op_pos::stack_effect (stack_shape &shape)
+{
+  shape.pop (1);
+  shape.push (value_cst::vtype);
+}
+
 std::string
 op_pos::docstring ()
 {
@@ -302,3 +325,114 @@ Note that *every* function counts its elements anew::
 
 )docstring";
 }
+
+
+bool
+op_limit::admit (stack &stk)
+{
+  auto vp = stk.pop ();
+  auto v = value::as <value_cst> (&*vp);
+  if (v == nullptr)
+    throw std::runtime_error ("`limit' expects a T_CST on TOS");
+
+  auto const &val = v->get_constant ().value ();
+  m_limit = val < 0 ? 0 : val.uval ();
+
+  if (m_count >= m_limit)
+    {
+      m_done = true;
+      return false;
+    }
+
+  if (++m_count == m_limit)
+    m_done = true;
+  return true;
+}
+
+stack::uptr
+op_limit::next ()
+{
+  while (! m_done)
+    if (auto stk = m_upstream->next ())
+      {
+	if (admit (*stk))
+	  return stk;
+      }
+    else
+      break;
+
+  return nullptr;
+}
+
+size_t
+op_limit::next_batch (std::vector <stack::uptr> &out, size_t n)
+{
+  size_t start = out.size ();
+  while (out.size () == start && ! m_done)
+    {
+      // Until the first stack says what the limit is, ask for just
+      // that one.  Afterwards never ask for more than is missing.
+      size_t want = m_count == 0
+	? 1 : std::min <uint64_t> (n, m_limit - m_count);
+      size_t base = out.size ();
+      if (m_upstream->next_batch (out, want) == 0)
+	break;
+
+      size_t j = base;
+      for (size_t i = base; i < out.size (); ++i)
+	if (! m_done && admit (*out[i]))
+	  {
+	    if (i != j)
+	      out[j] = std::move (out[i]);
+	    ++j;
+	  }
+      out.resize (j);
+    }
+
+  return out.size () - start;
+}
+
+void
+op_limit::reset ()
+{
+  m_count = 0;
+  m_limit = 0;
+  m_done = false;
+  inner_op::reset ();
+}
+
+void
+op_limit::stack_effect (stack_shape &shape)
+{
+  shape.pop (1);
+}
+
+std::string
+op_limit::docstring ()
+{
+  return R"docstring(
+
+Pops a constant *N* and lets through at most *N* of the stacks that
+come from the expression before it.  As soon as *N* stacks were let
+through, the expression is not evaluated any further::
+
+	$ dwgrep ./tests/dwz-partial -e 'unit 2 limit root'
+	[34] compile_unit
+	[a4] compile_unit
+
+Because nothing is asked of the producers upstream once the limit is
+reached, this is much cheaper than collecting all the results and
+picking a few.  In particular, units of a Dwarf past the one where
+the last result was found are not decoded at all.
+
+The count starts anew for each input of an enclosing sub-expression,
+closure, capture or alternation, so the following yields, for each
+unit, at most three DIE's under its root::
+
+	unit [root child 3 limit]
+
+*N* is popped from each stack that comes to ``limit``.  It is
+normally a constant, as above, and the same for all of them.
+
+)docstring";
+}
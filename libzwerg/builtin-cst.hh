@@ -51,6 +51,7 @@ public:
   char const *name () const override;
 
   std::string docstring () const override;
+  void stack_effect (stack_shape &shape) const override;
 };
 
 struct builtin_hex
@@ -98,6 +99,7 @@ struct op_type
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -107,6 +109,35 @@ struct op_pos
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
+
+  static std::string docstring ();
+};
+
+// Let through at most N stacks, where N is popped from each stack.
+// Once the limit is reached, upstream is not asked for anything more
+// until the op is reset.
+class op_limit
+  : public inner_op
+{
+  uint64_t m_count;
+  uint64_t m_limit;
+  bool m_done;
+
+  bool admit (stack &stk);
+
+public:
+  op_limit (std::shared_ptr <op> upstream)
+    : inner_op {upstream}
+    , m_count {0}
+    , m_limit {0}
+    , m_done {false}
+  {}
+
+  stack::uptr next () override;
+  size_t next_batch (std::vector <stack::uptr> &out, size_t n) override;
+  void reset () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -337,7 +337,7 @@ Takes an abbreviation attribute on TOS and yields its form.
 // ?haschildren :: T_ABBREV
 
 pred_result
-pred_haschildrenp_abbrev::result (value_abbrev &a)
+pred_haschildrenp_abbrev::result (value_abbrev const &a)
 {
   return pred_result (dwarf_abbrevhaschildren (&a.get_abbrev ()));
 }
@@ -452,11 +452,12 @@ op_abbrev_die::operate (std::unique_ptr <value_die> a)
 {
   // If the DIE doesn't have an abbreviation yet, force its
   // look-up.
-  if (a->get_die ().abbrev == nullptr)
-    dwarf_haschildren (&a->get_die ());
-  assert (a->get_die ().abbrev != nullptr);
+  Dwarf_Die die = a->get_die ();
+  if (die.abbrev == nullptr)
+    dwarf_haschildren (&die);
+  assert (die.abbrev != nullptr);
 
-  return value_abbrev {a->get_dwctx (), *a->get_die ().abbrev, 0};
+  return value_abbrev {a->get_dwctx (), *die.abbrev, 0};
 }
 
 std::string
@@ -496,7 +497,7 @@ Takes abbreviation on TOS and yields its code.
 // ?DW_AT_* :: T_ABBREV
 
 pred_result
-pred_atname_abbrev::result (value_abbrev &a)
+pred_atname_abbrev::result (value_abbrev const &a)
 {
   size_t cnt = dwpp_abbrev_attrcnt (a.get_abbrev ());
   for (size_t i = 0; i < cnt; ++i)
@@ -531,7 +532,7 @@ place with abbreviations::
 // ?DW_AT_A* :: T_ABBREV_ATTR
 
 pred_result
-pred_atname_abbrev_attr::result (value_abbrev_attr &a)
+pred_atname_abbrev_attr::result (value_abbrev_attr const &a)
 {
   return pred_result (a.name == m_atname);
 }
@@ -555,7 +556,7 @@ same as indicated by this word::
 // ?DW_TAG_* :: T_ABBREV
 
 pred_result
-pred_tag_abbrev::result (value_abbrev &a)
+pred_tag_abbrev::result (value_abbrev const &a)
 {
   return pred_result (dwarf_getabbrevtag (&a.get_abbrev ()) == m_tag);
 }
@@ -576,7 +577,7 @@ indicated by this word.
 // ?DW_FORM_* :: T_ABBREV_ATTR
 
 pred_result
-pred_form_abbrev_attr::result (value_abbrev_attr &a)
+pred_form_abbrev_attr::result (value_abbrev_attr const &a)
 {
   return pred_result (a.form == m_form);
 }
@@ -115,7 +115,7 @@ struct pred_haschildrenp_abbrev
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_abbrev &a) override;
+  pred_result result (value_abbrev const &a) override;
   static std::string docstring ();
 };
 
@@ -166,7 +166,7 @@ struct pred_atname_abbrev
     : m_atname {atname}
   {}
 
-  pred_result result (value_abbrev &a) override;
+  pred_result result (value_abbrev const &a) override;
   static std::string docstring ();
 };
 
@@ -179,7 +179,7 @@ struct pred_atname_abbrev_attr
     : m_atname {atname}
   {}
 
-  pred_result result (value_abbrev_attr &a) override;
+  pred_result result (value_abbrev_attr const &a) override;
   static std::string docstring ();
 };
 
@@ -192,7 +192,7 @@ struct pred_tag_abbrev
     : m_tag {tag}
   {}
 
-  pred_result result (value_abbrev &a) override;
+  pred_result result (value_abbrev const &a) override;
   static std::string docstring ();
 };
 
@@ -205,7 +205,7 @@ struct pred_form_abbrev_attr
     : m_form {form}
   {}
 
-  pred_result result (value_abbrev_attr &a) override;
+  pred_result result (value_abbrev_attr const &a) override;
   static std::string docstring ();
 };
 
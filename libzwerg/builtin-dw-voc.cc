@@ -170,6 +170,14 @@ dwgrep_vocabulary_dw ()
     voc.add (std::make_shared <overloaded_op_builtin> ("address", t));
   }
 
+  {
+    auto t = std::make_shared <overload_tab> ();
+
+    t->add_op_overload <op_scopes_dwarf_cst> ();
+
+    voc.add (std::make_shared <overloaded_op_builtin> ("scopes", t));
+  }
+
   {
     auto t = std::make_shared <overload_tab> ();
 
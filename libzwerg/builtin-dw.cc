@@ -26,17 +26,22 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
 
 #include "atval.hh"
+#include "builtin-aset.hh"
 #include "builtin-dw.hh"
+#include "die_index.hh"
 #include "dwcst.hh"
 #include "dwit.hh"
 #include "dwmods.hh"
 #include "dwpp.hh"
 #include "op.hh"
 #include "overload.hh"
+#include "scope.hh"
+#include "tree.hh"
 #include "value-cst.hh"
 #include "value-str.hh"
 #include "value-dw.hh"
@@ -115,6 +120,54 @@ namespace
       return std::make_unique <value_cu> (m_dwctx, cu, off, m_i++, m_doneness);
     }
   };
+
+  // Yield units from a slice of a unit list.  M_I starts at the
+  // ordinal of the first unit of the slice, so that positions agree
+  // with what dwarf_unit_producer would assign.
+  struct unit_list_producer
+    : public value_producer <value_cu>
+  {
+    std::shared_ptr <dwfl_context> m_dwctx;
+    std::shared_ptr <unit_list const> m_units;
+    size_t m_i;
+    size_t m_end;
+    doneness m_doneness;
+
+    unit_list_producer (std::shared_ptr <dwfl_context> dwctx,
+			std::shared_ptr <unit_list const> units,
+			size_t begin, size_t end, doneness d)
+      : m_dwctx {dwctx}
+      , m_units {units}
+      , m_i {begin}
+      , m_end {end}
+      , m_doneness {d}
+    {
+      assert (m_end <= m_units->size ());
+    }
+
+    std::unique_ptr <value_cu>
+    next () override
+    {
+      if (m_i >= m_end)
+	return nullptr;
+
+      auto const &u = (*m_units)[m_i];
+      auto ret = std::make_unique <value_cu> (m_dwctx, *u.first, u.second,
+					      m_i, m_doneness);
+      m_i++;
+      return ret;
+    }
+  };
+}
+
+unit_list
+dwarf_units (std::shared_ptr <dwfl_context> dwctx, doneness d)
+{
+  unit_list ret;
+  dwarf_unit_producer prod {dwctx, d};
+  while (auto cu = prod.next ())
+    ret.push_back (std::make_pair (&cu->get_cu (), cu->get_offset ()));
+  return ret;
 }
 
 std::unique_ptr <value_producer <value_cu>>
@@ -124,6 +177,14 @@ op_unit_dwarf::operate (std::unique_ptr <value_dwarf> a)
 						 a->get_doneness ());
 }
 
+std::unique_ptr <value_producer <value_cu>>
+op_unit_dwarf_slice::operate (std::unique_ptr <value_dwarf> a)
+{
+  return std::make_unique <unit_list_producer> (m_dwctx, m_units,
+						m_begin, m_end,
+						a->get_doneness ());
+}
+
 std::string
 op_unit_dwarf::docstring ()
 {
@@ -255,8 +316,7 @@ namespace
   template <class It>
   bool
   import_partial_units (std::vector <std::pair <It, It>> &stack,
-			std::shared_ptr <dwfl_context> dwctx,
-			std::shared_ptr <value_die> &import)
+			dwfl_context &dwctx, import_id &import)
   {
     Dwarf_Die *die = *stack.back ().first;
     Dwarf_Attribute at_import;
@@ -268,8 +328,7 @@ namespace
       {
 	// Do this first, before we bump the iterator and DIE gets
 	// invalidated.
-	import = std::make_shared <value_die> (dwctx, import, *die, 0,
-					       doneness::cooked);
+	import = dwctx.intern_import (import, *die);
 
 	// Skip DW_TAG_imported_unit.
 	stack.back ().first++;
@@ -285,7 +344,7 @@ namespace
   template <class It>
   bool
   drop_finished_imports (std::vector <std::pair <It, It>> &stack,
-			 std::shared_ptr <value_die> &import)
+			 dwfl_context &dwctx, import_id &import)
   {
     assert (! stack.empty ());
     if (stack.back ().first != stack.back ().second)
@@ -295,15 +354,109 @@ namespace
 
     // We have one more item in STACK than values in IMPORT chain, so
     // this can actually be empty at this point.
-    if (import != nullptr)
-      import = import->get_import ();
+    if (import != no_import)
+      import = dwctx.import_parent (import);
 
     return true;
   }
 
+  // Tags of DIE's that a DIE of tag TAG may appear under, for those
+  // tags where that is constrained: units only ever appear as roots,
+  // and namespaces and modules only at file scope or nested in other
+  // namespaces and modules.  Returns false if TAG may appear
+  // anywhere.
+  bool
+  tag_containers (int tag, std::vector <int> &ret)
+  {
+    switch (tag)
+      {
+      case DW_TAG_compile_unit:
+      case DW_TAG_partial_unit:
+      case DW_TAG_type_unit:
+	return true;
+
+      case DW_TAG_namespace:
+      case DW_TAG_module:
+	for (int t: {DW_TAG_compile_unit, DW_TAG_partial_unit,
+		     DW_TAG_type_unit, DW_TAG_namespace, DW_TAG_module})
+	  ret.push_back (t);
+	return true;
+      }
+
+    return false;
+  }
+
+  // A set of tags that DIE iteration is restricted to (or, if
+  // M_POSITIVE is false, that it excludes).  This is how ?TAG_x,
+  // !TAG_x or (?TAG_x || ?TAG_y) that follow an iteration word are
+  // pushed down into the iteration itself, so that DIE's that would
+  // be rejected anyway are never turned into values.
+  //
+  // When all the tags are such that they can only appear under DIE's
+  // of certain tags (see tag_containers), subtrees of other DIE's are
+  // not explored at all.
+  struct tag_filter
+  {
+    std::vector <int> m_tags;
+    bool m_positive;
+
+    // Whether M_CONTAINERS is meaningful.
+    bool m_prune;
+    std::vector <int> m_containers;
+
+    tag_filter (std::vector <int> tags, bool positive)
+      : m_tags {tags}
+      , m_positive {positive}
+      , m_prune {positive}
+    {
+      for (int tag: m_tags)
+	if (! tag_containers (tag, m_containers))
+	  m_prune = false;
+    }
+
+    bool
+    matches (int tag) const
+    {
+      return (std::find (m_tags.begin (), m_tags.end (), tag)
+	      != m_tags.end ()) == m_positive;
+    }
+
+    // Whether there's no point descending to children of a DIE with
+    // tag TAG.
+    bool
+    prunes (int tag) const
+    {
+      return m_prune
+	&& std::find (m_containers.begin (), m_containers.end (), tag)
+		== m_containers.end ();
+    }
+  };
+
+  // Move IT to the next DIE, optionally skipping the subtree of the
+  // current one.
+  void
+  advance (all_dies_iterator &it, bool descend)
+  {
+    if (descend)
+      ++it;
+    else
+      it.skip_children ();
+  }
+
+  void
+  advance (child_iterator &it, bool descend)
+  {
+    ++it;
+  }
+
   // This producer encapsulates the logic for iteration through a
   // range of DIE's, with optional inlining of partial units along the
-  // way.  Cooked producers do inline, raw ones don't.
+  // way.  Cooked producers do inline, raw ones don't.  If M_FILTER is
+  // given, DIE's that it rejects are skipped, but still count towards
+  // positions of those that are yielded.  That doesn't hold for DIE's
+  // in subtrees that the filter prunes, those are never visited.  The
+  // filter is only ever installed by strength reduction, which
+  // doesn't touch queries that use positions.
   template <class It>
   struct die_it_producer
     : public value_producer <value_die>
@@ -314,16 +467,20 @@ namespace
     std::vector <std::pair <It, It>> m_stack;
 
     // Chain of DIE's where partial units were imported.
-    std::shared_ptr <value_die> m_import;
+    import_id m_import;
 
     size_t m_i;
     doneness m_doneness;
+    std::shared_ptr <tag_filter const> m_filter;
 
     die_it_producer (std::shared_ptr <dwfl_context> dwctx, Dwarf_Die die,
-		     doneness d)
+		     doneness d,
+		     std::shared_ptr <tag_filter const> filter = nullptr)
       : m_dwctx {dwctx}
+      , m_import {no_import}
       , m_i {0}
       , m_doneness {d}
+      , m_filter {filter}
     {
       m_stack.push_back (get_it_range <It> (die, false));
     }
@@ -331,15 +488,38 @@ namespace
     std::unique_ptr <value_die>
     next () override
     {
-      do
-	if (m_stack.empty ())
-	  return nullptr;
-      while (drop_finished_imports (m_stack, m_import)
-	     || (m_doneness == doneness::cooked
-		 && import_partial_units (m_stack, m_dwctx, m_import)));
+      while (true)
+	{
+	  do
+	    if (m_stack.empty ())
+	      return nullptr;
+	  while (drop_finished_imports (m_stack, *m_dwctx, m_import)
+		 || (m_doneness == doneness::cooked
+		     && import_partial_units (m_stack, *m_dwctx, m_import)));
+
+	  It &it = m_stack.back ().first;
+	  if (m_filter == nullptr)
+	    return std::make_unique <value_die>
+	      (m_dwctx, m_import, **it++, m_i++, m_doneness);
+
+	  int tag = dwarf_tag (*it);
+	  std::unique_ptr <value_die> ret;
+	  if (m_filter->matches (tag))
+	    ret = std::make_unique <value_die> (m_dwctx, m_import, **it,
+						m_i, m_doneness);
+	  advance (it, ! m_filter->prunes (tag));
+	  ++m_i;
+
+	  if (ret != nullptr)
+	    return ret;
+	}
+    }
 
-      return std::make_unique <value_die>
-	(m_dwctx, m_import, **m_stack.back ().first++, m_i++, m_doneness);
+    size_t
+    next_batch (std::vector <std::unique_ptr <value_die>> &out,
+		size_t n) override
+    {
+      return fill_batch (*this, out, n);
     }
   };
 
@@ -400,15 +580,24 @@ several times, each time in a different context::
 
 namespace
 {
+  // Yield DIE's of all units that UnitProducer yields, optionally
+  // filtered by FILTER.
+  template <class UnitProducer>
   struct dwarf_entry_producer
     : public value_producer <value_die>
   {
-    dwarf_unit_producer m_unitprod;
+    UnitProducer m_unitprod;
     std::unique_ptr <die_it_producer <all_dies_iterator>> m_dieprod;
+    std::shared_ptr <tag_filter const> m_filter;
+
+    // Number of DIE's in units that were already exhausted.
     size_t m_i;
 
-    dwarf_entry_producer (std::shared_ptr <dwfl_context> dwctx, doneness d)
-      : m_unitprod {dwctx, d}
+    template <class... Args>
+    explicit dwarf_entry_producer (std::shared_ptr <tag_filter const> filter,
+				   Args &&... args)
+      : m_unitprod {std::forward <Args> (args)...}
+      , m_filter {filter}
       , m_i {0}
     {}
 
@@ -421,16 +610,17 @@ namespace
 	    if (auto cu = m_unitprod.next ())
 	      m_dieprod = std::make_unique <die_it_producer <all_dies_iterator>>
 				(m_unitprod.m_dwctx, dwpp_cudie (cu->get_cu ()),
-				 m_unitprod.m_doneness);
+				 m_unitprod.m_doneness, m_filter);
 	    else
 	      return nullptr;
 
 	  if (auto ret = m_dieprod->next ())
 	    {
-	      ret->set_pos (m_i++);
+	      ret->set_pos (m_i + ret->get_pos ());
 	      return ret;
 	    }
 
+	  m_i += m_dieprod->m_i;
 	  m_dieprod = nullptr;
 	}
     }
@@ -440,8 +630,15 @@ namespace
 std::unique_ptr <value_producer <value_die>>
 op_entry_dwarf::operate (std::unique_ptr <value_dwarf> a)
 {
-  return std::make_unique <dwarf_entry_producer> (a->get_dwctx (),
-						  a->get_doneness ());
+  return std::make_unique <dwarf_entry_producer <dwarf_unit_producer>>
+    (nullptr, a->get_dwctx (), a->get_doneness ());
+}
+
+std::unique_ptr <value_producer <value_die>>
+op_entry_dwarf_slice::operate (std::unique_ptr <value_dwarf> a)
+{
+  return std::make_unique <dwarf_entry_producer <unit_list_producer>>
+    (nullptr, m_dwctx, m_units, m_begin, m_end, a->get_doneness ());
 }
 
 std::string
@@ -459,6 +656,891 @@ behaves equivalently to the following::
 }
 
 
+namespace
+{
+  // Name of DIE as `name' sees it, or nullptr if it has none.
+  char const *
+  die_name (Dwarf_Die die, doneness d)
+  {
+    // On cooked DIE's, `name` integrates.
+    if (d == doneness::cooked)
+      return dwarf_diename (&die);
+
+    // Unfortunately there's no non-integrating dwarf_diename
+    // counterpart.
+    if (dwarf_hasattr (&die, DW_AT_name))
+      {
+	Dwarf_Attribute attr = dwpp_attr (die, DW_AT_name);
+	if (char const *name = dwarf_formstring (&attr))
+	  return name;
+	throw_libdw ();
+      }
+
+    return nullptr;
+  }
+}
+
+// Strength reduction of (unit (offset == N)) and (entry (offset == N)).
+// Instead of iterating all units or DIE's and comparing offsets, the
+// object in question is looked up directly.
+//
+// Further, a tag assertion that follows entry or child is pushed down
+// into the DIE iteration.  A (name == "literal") assertion that follows
+// entry on a Dwarf, possibly after a tag assertion, is answered from
+// DIE indices where available.  Assertions that a DIE's address set
+// contains or overlaps constant addresses are answered from the
+// address index of the Dwarf.
+namespace
+{
+  template <class Op, class Arg>
+  struct reduced_overload_builtin
+    : public builtin
+  {
+    Arg m_arg;
+
+    explicit reduced_overload_builtin (Arg arg)
+      : m_arg {arg}
+    {}
+
+    std::shared_ptr <op>
+    build_exec (std::shared_ptr <op> upstream) const override
+    {
+      return std::make_shared <Op> (upstream, m_arg);
+    }
+
+    char const *
+    name () const override
+    {
+      return "overload";
+    }
+
+    builtin_protomap
+    protomap () const override
+    {
+      return Op::protomap ();
+    }
+  };
+
+  // Find the offset that CST, a constant that `offset' is compared
+  // against, stands for.  Returns false if no offset would compare
+  // equal to CST.
+  bool
+  constant_to_offset (constant const &cst, Dwarf_Off &ret)
+  {
+    if (cst.value () < 0)
+      return false;
+    ret = cst.value ().uval ();
+    return constant {ret, &dw_offset_dom ()} == cst;
+  }
+
+  // Find the last unit of DW whose CU DIE doesn't start past OFF.
+  // That's the only unit that could hold a DIE at OFF.
+  bool
+  find_unit_die (Dwarf *dw, Dwarf_Off off, Dwarf_Die *ret)
+  {
+    bool found = false;
+    for (cu_iterator it {dw}; it != cu_iterator::end (); ++it)
+      if (dwarf_dieoffset (*it) <= off)
+	{
+	  *ret = **it;
+	  found = true;
+	}
+      else
+	break;
+    return found;
+  }
+
+  // Find DIE at OFF in a tree rooted at DIE.  At each level, this
+  // only descends to the last child that doesn't start past OFF.
+  // Returns false if there's no DIE that starts exactly at OFF.
+  bool
+  find_die_at (Dwarf_Die die, Dwarf_Off off, Dwarf_Die *ret)
+  {
+    while (dwarf_dieoffset (&die) != off)
+      {
+	Dwarf_Die child;
+	switch (dwarf_child (&die, &child))
+	  {
+	  case 0:
+	    break;
+	  case 1:
+	    return false;
+	  default:
+	    throw_libdw ();
+	  }
+
+	if (dwarf_dieoffset (&child) > off)
+	  return false;
+
+	while (true)
+	  {
+	    Dwarf_Die sibling;
+	    int r = dwarf_siblingof (&child, &sibling);
+	    if (r < 0)
+	      throw_libdw ();
+	    if (r > 0 || dwarf_dieoffset (&sibling) > off)
+	      break;
+	    child = sibling;
+	  }
+
+	die = child;
+      }
+
+    *ret = die;
+    return true;
+  }
+
+  // In cooked mode, DIE's of partial units are yielded once for each
+  // import (or not at all), and DW_TAG_imported_unit's are not
+  // yielded.  Those cases are left for the full iteration.
+  bool
+  cooked_irregular (Dwarf_Die cudie, Dwarf_Die die)
+  {
+    return dwarf_tag (&cudie) == DW_TAG_partial_unit
+      || dwarf_tag (&die) == DW_TAG_imported_unit;
+  }
+
+  // Whether cooked iteration of units of DW could reach DIE at OFF
+  // by way of DW_TAG_imported_unit.  The imported partial units may
+  // come from the .gnu_debugaltlink file as well.
+  bool
+  may_be_imported (Dwarf *dw, Dwarf_Off off)
+  {
+    for (Dwarf *d: {dw, dwarf_getalt (dw)})
+      {
+	Dwarf_Die cudie;
+	if (d != nullptr && find_unit_die (d, off, &cudie)
+	    && dwarf_tag (&cudie) == DW_TAG_partial_unit)
+	  return true;
+      }
+    return false;
+  }
+
+  template <class T>
+  struct vector_producer
+    : public value_producer <T>
+  {
+    std::vector <std::unique_ptr <T>> m_values;
+    size_t m_i;
+
+    explicit vector_producer (std::vector <std::unique_ptr <T>> values)
+      : m_values {std::move (values)}
+      , m_i {0}
+    {}
+
+    std::unique_ptr <T>
+    next () override
+    {
+      if (m_i < m_values.size ())
+	return std::move (m_values[m_i++]);
+      return nullptr;
+    }
+  };
+
+  // Yield those DIE's from M_PROD that are at M_OFF.
+  struct die_offset_filter_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_producer <value_die>> m_prod;
+    Dwarf_Off m_off;
+
+    die_offset_filter_producer (std::unique_ptr <value_producer
+							<value_die>> prod,
+				Dwarf_Off off)
+      : m_prod {std::move (prod)}
+      , m_off {off}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (auto die = m_prod->next ())
+	{
+	  Dwarf_Die die_mem = die->get_die ();
+	  if (dwarf_dieoffset (&die_mem) == m_off)
+	    return die;
+	}
+      return nullptr;
+    }
+  };
+
+  struct op_unit_dwarf_offset
+    : public op_yielding_overload <value_cu, value_dwarf>
+  {
+    constant m_cst;
+
+    op_unit_dwarf_offset (std::shared_ptr <op> upstream, constant cst)
+      : op_yielding_overload {upstream}
+      , m_cst {cst}
+    {}
+
+    std::unique_ptr <value_producer <value_cu>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      std::vector <std::unique_ptr <value_cu>> ret;
+      Dwarf_Off off;
+      if (constant_to_offset (m_cst, off))
+	for (Dwarf *dw: all_dwarfs (*a->get_dwctx ()))
+	  for (cu_iterator it {dw}; it != cu_iterator::end (); ++it)
+	    {
+	      if (it.offset () > off)
+		break;
+
+	      // In cooked mode, we reject partial units.
+	      if (it.offset () == off
+		  && (a->get_doneness () == doneness::raw
+		      || dwarf_tag (*it) != DW_TAG_partial_unit))
+		ret.push_back (std::make_unique <value_cu>
+			       (a->get_dwctx (), *(*it)->cu, off, 0,
+				a->get_doneness ()));
+	    }
+
+      return std::make_unique <vector_producer <value_cu>> (std::move (ret));
+    }
+  };
+
+  struct op_entry_dwarf_offset
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    constant m_cst;
+
+    op_entry_dwarf_offset (std::shared_ptr <op> upstream, constant cst)
+      : op_yielding_overload {upstream}
+      , m_cst {cst}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      std::vector <std::unique_ptr <value_die>> ret;
+      Dwarf_Off off;
+      if (! constant_to_offset (m_cst, off))
+	return std::make_unique <vector_producer <value_die>>
+	  (std::move (ret));
+
+      doneness d = a->get_doneness ();
+      for (Dwarf *dw: all_dwarfs (*a->get_dwctx ()))
+	{
+	  Dwarf_Die cudie, die;
+	  if (! find_unit_die (dw, off, &cudie)
+	      || ! find_die_at (cudie, off, &die))
+	    continue;
+
+	  if (d == doneness::cooked && cooked_irregular (cudie, die))
+	    return std::make_unique <die_offset_filter_producer>
+	      (std::make_unique <dwarf_entry_producer <dwarf_unit_producer>>
+	       (nullptr, a->get_dwctx (), d), off);
+
+	  ret.push_back (std::make_unique <value_die>
+			 (a->get_dwctx (), die, 0, d));
+	}
+
+      return std::make_unique <vector_producer <value_die>> (std::move (ret));
+    }
+  };
+
+  struct op_entry_cu_offset
+    : public op_yielding_overload <value_die, value_cu>
+  {
+    constant m_cst;
+
+    op_entry_cu_offset (std::shared_ptr <op> upstream, constant cst)
+      : op_yielding_overload {upstream}
+      , m_cst {cst}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_cu> a) override
+    {
+      std::vector <std::unique_ptr <value_die>> ret;
+      Dwarf_Off off;
+      if (! constant_to_offset (m_cst, off))
+	return std::make_unique <vector_producer <value_die>>
+	  (std::move (ret));
+
+      doneness d = a->get_doneness ();
+      Dwarf_Die cudie = dwpp_cudie (a->get_cu ());
+      Dwarf_Die die;
+      bool found = find_die_at (cudie, off, &die);
+      if (d == doneness::cooked
+	  && ((found && cooked_irregular (cudie, die))
+	      || may_be_imported (dwarf_cu_getdwarf (&a->get_cu ()), off)))
+	return std::make_unique <die_offset_filter_producer>
+	  (make_cu_entry_producer (a->get_dwctx (), a->get_cu (), d), off);
+
+      if (found)
+	ret.push_back (std::make_unique <value_die>
+		       (a->get_dwctx (), die, 0, d));
+
+      return std::make_unique <vector_producer <value_die>> (std::move (ret));
+    }
+  };
+
+  // If T is a tag assertion such as ?TAG_subprogram or !DW_TAG_member,
+  // return its tag and set POSITIVE accordingly.  Otherwise return -1.
+  int
+  match_tag_assertion (tree const &t, bool &positive)
+  {
+    if (t.tt () == tree_type::SCOPE && t.scp ()->num_names () == 0)
+      return match_tag_assertion (t.child (0), positive);
+
+    if (t.tt () != tree_type::F_BUILTIN)
+      return -1;
+
+    auto obi = std::dynamic_pointer_cast <overloaded_pred_builtin const>
+      (t.m_builtin);
+    if (obi == nullptr)
+      return -1;
+
+    for (auto const &ovl: obi->get_overload_tab ()->get_overloads ())
+      if (std::get <0> (ovl) == pred_tag_die::get_selector ())
+	{
+	  auto pred = std::get <1> (ovl)->build_pred ();
+	  if (auto ptd = dynamic_cast <pred_tag_die const *> (pred.get ()))
+	    {
+	      positive = obi->m_positive;
+	      return ptd->get_tag ();
+	    }
+	}
+
+    return -1;
+  }
+
+  // Recognize a tag assertion, or a first-match alternation of
+  // positive tag assertions, such as (?TAG_structure_type ||
+  // ?TAG_union_type).
+  std::shared_ptr <tag_filter const>
+  match_tag_filter (tree const &t)
+  {
+    if (t.tt () == tree_type::OR)
+      {
+	std::vector <int> tags;
+	for (auto const &child: t.m_children)
+	  {
+	    bool positive;
+	    int tag = match_tag_assertion (child, positive);
+	    if (tag < 0 || ! positive)
+	      return nullptr;
+	    tags.push_back (tag);
+	  }
+	return std::make_shared <tag_filter> (tags, true);
+      }
+
+    bool positive;
+    int tag = match_tag_assertion (t, positive);
+    if (tag < 0)
+      return nullptr;
+    return std::make_shared <tag_filter> (std::vector <int> {tag}, positive);
+  }
+
+  // Yield DIE's that a tag filter lets through by walking DIE
+  // indices, so that DIE's that are rejected are not even decoded.
+  // Each index record stands for one DIE that raw entry would yield,
+  // and the records are in the same order.  If M_NAMES is not empty,
+  // only records whose name field is M_NAMES[I] are considered in the
+  // I-th index (see die_index::find_name).  M_FILTER may be nullptr
+  // in that case.
+  struct index_entry_producer
+    : public value_producer <value_die>
+  {
+    std::shared_ptr <dwfl_context> m_dwctx;
+    std::vector <std::pair <Dwarf *, die_index const *>> m_indices;
+    std::shared_ptr <tag_filter const> m_filter;
+    std::vector <uint32_t> m_names;
+    doneness m_doneness;
+    size_t m_idx;
+    die_index::record const *m_rec;
+    size_t m_i;
+
+    index_entry_producer (std::shared_ptr <dwfl_context> dwctx,
+			  std::vector <std::pair <Dwarf *,
+						  die_index const *>> indices,
+			  std::shared_ptr <tag_filter const> filter,
+			  doneness d,
+			  std::vector <uint32_t> names = {})
+      : m_dwctx {dwctx}
+      , m_indices {std::move (indices)}
+      , m_filter {filter}
+      , m_names {std::move (names)}
+      , m_doneness {d}
+      , m_idx {0}
+      , m_rec {m_indices.empty () ? nullptr : m_indices[0].second->begin ()}
+      , m_i {0}
+    {}
+
+    bool
+    accepts (die_index::record const &rec) const
+    {
+      return (m_names.empty () || rec.name == m_names[m_idx])
+	&& (m_filter == nullptr || m_filter->matches (rec.tag));
+    }
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (m_idx < m_indices.size ())
+	{
+	  auto const &idx = m_indices[m_idx];
+	  for (; m_rec != idx.second->end (); ++m_rec, ++m_i)
+	    if (accepts (*m_rec))
+	      {
+		Dwarf_Die die;
+		if (dwarf_offdie (idx.first, m_rec->offset, &die) == nullptr)
+		  throw_libdw ();
+		++m_rec;
+		return std::make_unique <value_die> (m_dwctx, die, m_i++,
+						     m_doneness);
+	      }
+
+	  if (++m_idx < m_indices.size ())
+	    m_rec = m_indices[m_idx].second->begin ();
+	}
+
+      return nullptr;
+    }
+  };
+
+  // Gather DIE indices of all Dwarfs of DWCTX, if every one of them
+  // has one.  In cooked mode, indices are only usable if there's
+  // nothing to import, because then cooked entry yields the same as
+  // raw entry.
+  bool
+  all_dwarf_indices (dwfl_context &dwctx, doneness d,
+		     std::vector <std::pair <Dwarf *,
+					     die_index const *>> &ret)
+  {
+    for (Dwarf *dw: all_dwarfs (dwctx))
+      {
+	die_index const *idx = dwctx.get_index (dw);
+	if (idx == nullptr)
+	  return false;
+
+	if (d == doneness::cooked
+	    && std::any_of (idx->begin (), idx->end (),
+			    [] (die_index::record const &rec)
+			    {
+			      return rec.tag == DW_TAG_partial_unit
+				|| rec.tag == DW_TAG_imported_unit;
+			    }))
+	  return false;
+
+	ret.push_back (std::make_pair (dw, idx));
+      }
+
+    return true;
+  }
+
+  struct op_entry_dwarf_tags
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    std::shared_ptr <tag_filter const> m_filter;
+
+    op_entry_dwarf_tags (std::shared_ptr <op> upstream,
+			 std::shared_ptr <tag_filter const> filter)
+      : op_yielding_overload {upstream}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      std::vector <std::pair <Dwarf *, die_index const *>> indices;
+      if (all_dwarf_indices (*a->get_dwctx (), a->get_doneness (), indices))
+	return std::make_unique <index_entry_producer>
+	  (a->get_dwctx (), std::move (indices), m_filter,
+	   a->get_doneness ());
+
+      return std::make_unique <dwarf_entry_producer <dwarf_unit_producer>>
+	(m_filter, a->get_dwctx (), a->get_doneness ());
+    }
+  };
+
+  struct op_entry_cu_tags
+    : public op_yielding_overload <value_die, value_cu>
+  {
+    std::shared_ptr <tag_filter const> m_filter;
+
+    op_entry_cu_tags (std::shared_ptr <op> upstream,
+		      std::shared_ptr <tag_filter const> filter)
+      : op_yielding_overload {upstream}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_cu> a) override
+    {
+      return std::make_unique <die_it_producer <all_dies_iterator>>
+	(a->get_dwctx (), dwpp_cudie (a->get_cu ()), a->get_doneness (),
+	 m_filter);
+    }
+  };
+
+  struct op_child_die_tags
+    : public op_yielding_overload <value_die, value_die>
+  {
+    std::shared_ptr <tag_filter const> m_filter;
+
+    op_child_die_tags (std::shared_ptr <op> upstream,
+		       std::shared_ptr <tag_filter const> filter)
+      : op_yielding_overload {upstream}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_die> a) override
+    {
+      return std::make_unique <die_it_producer <child_iterator>>
+	(a->get_dwctx (), a->get_die (), a->get_doneness (), m_filter);
+    }
+  };
+
+  // (name == "literal"), optionally preceded by a tag assertion.
+  struct name_filter
+  {
+    std::string m_name;
+    std::shared_ptr <tag_filter const> m_tags;
+
+    name_filter (std::string name, std::shared_ptr <tag_filter const> tags)
+      : m_name {name}
+      , m_tags {tags}
+    {}
+  };
+
+  // Yield those DIE's from M_PROD that `name' calls M_NAME.
+  struct die_name_filter_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_producer <value_die>> m_prod;
+    std::string m_name;
+
+    die_name_filter_producer (std::unique_ptr <value_producer
+							<value_die>> prod,
+			      std::string name)
+      : m_prod {std::move (prod)}
+      , m_name {name}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (auto die = m_prod->next ())
+	{
+	  char const *name = die_name (die->get_die (),
+				       die->get_doneness ());
+	  if (name != nullptr && m_name == name)
+	    return die;
+	}
+      return nullptr;
+    }
+  };
+
+  // DIE indices record names of all DIE's, so where they are
+  // available, only DIE's of the requested name are decoded at all.
+  // Otherwise the DIE's are iterated as usual, but the name is
+  // checked before they become values.
+  //
+  // The names in the indices are integrated, as cooked `name' has
+  // them.  A raw DIE might have no name of its own, so the name is
+  // checked again in either case.
+  struct op_entry_dwarf_name
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    std::shared_ptr <name_filter const> m_filter;
+
+    op_entry_dwarf_name (std::shared_ptr <op> upstream,
+			 std::shared_ptr <name_filter const> filter)
+      : op_yielding_overload {upstream}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      std::unique_ptr <value_producer <value_die>> prod;
+      std::vector <std::pair <Dwarf *, die_index const *>> all;
+      if (all_dwarf_indices (*a->get_dwctx (), a->get_doneness (), all))
+	{
+	  std::vector <std::pair <Dwarf *, die_index const *>> indices;
+	  std::vector <uint32_t> names;
+	  for (auto const &idx: all)
+	    {
+	      uint32_t name
+		= idx.second->find_name (m_filter->m_name.c_str ());
+	      if (name != die_index::no_name)
+		{
+		  indices.push_back (idx);
+		  names.push_back (name);
+		}
+	    }
+
+	  prod = std::make_unique <index_entry_producer>
+	    (a->get_dwctx (), std::move (indices), m_filter->m_tags,
+	     a->get_doneness (), std::move (names));
+	}
+      else
+	prod = std::make_unique <dwarf_entry_producer <dwarf_unit_producer>>
+	  (m_filter->m_tags, a->get_dwctx (), a->get_doneness ());
+
+      return std::make_unique <die_name_filter_producer>
+	(std::move (prod), m_filter->m_name);
+    }
+  };
+
+  std::shared_ptr <builtin>
+  reduce_name (tree const &assertion,
+	       std::shared_ptr <tag_filter const> tags)
+  {
+    std::string name;
+    if (assertion.match_eq_string ("name", name))
+      return std::make_shared <reduced_overload_builtin
+				<op_entry_dwarf_name,
+				 std::shared_ptr <name_filter const>>>
+	(std::make_shared <name_filter> (name, tags));
+    return nullptr;
+  }
+
+  // ?(address C ?contains), ?(address C1 C2 aset ?contains) or
+  // ?(address C1 C2 aset ?overlaps), optionally preceded by a tag
+  // assertion.  The assertion is about the address range [M_LOW,
+  // M_HIGH), a single address being taken as a range of length one,
+  // as ?contains takes it.
+  struct address_filter
+  {
+    uint64_t m_low;
+    uint64_t m_high;
+    bool m_overlap;
+    std::shared_ptr <tag_filter const> m_tags;
+
+    address_filter (uint64_t low, uint64_t high, bool overlap,
+		    std::shared_ptr <tag_filter const> tags)
+      : m_low {low}
+      , m_high {high}
+      , m_overlap {overlap}
+      , m_tags {tags}
+    {}
+
+    bool
+    matches (Dwarf_Die die) const
+    {
+      if (m_tags != nullptr && ! m_tags->matches (dwarf_tag (&die)))
+	return false;
+
+      value_aset ranges = die_ranges (die);
+      coverage const &cov = ranges.get_coverage ();
+      return m_overlap ? cov.is_overlap (m_low, m_high - m_low)
+	: cov.is_covered (m_low, m_high - m_low);
+    }
+  };
+
+  // Yield those DIE's from M_PROD that M_FILTER lets through.
+  struct die_address_filter_producer
+    : public value_producer <value_die>
+  {
+    std::unique_ptr <value_producer <value_die>> m_prod;
+    std::shared_ptr <address_filter const> m_filter;
+
+    die_address_filter_producer (std::unique_ptr <value_producer
+							<value_die>> prod,
+				 std::shared_ptr <address_filter const> filter)
+      : m_prod {std::move (prod)}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_die>
+    next () override
+    {
+      while (auto die = m_prod->next ())
+	if (m_filter->matches (die->get_die ()))
+	  return die;
+      return nullptr;
+    }
+  };
+
+  // The address index yields candidates whose ranges overlap the
+  // range in question, and those are checked exactly.
+  //
+  // In cooked mode, DIE's of imported partial units are yielded
+  // once for each import, which the index knows nothing about.  If
+  // there may be such units, DIE's are iterated as usual.
+  struct op_entry_dwarf_address
+    : public op_yielding_overload <value_die, value_dwarf>
+  {
+    std::shared_ptr <address_filter const> m_filter;
+
+    op_entry_dwarf_address (std::shared_ptr <op> upstream,
+			    std::shared_ptr <address_filter const> filter)
+      : op_yielding_overload {upstream}
+      , m_filter {filter}
+    {}
+
+    std::unique_ptr <value_producer <value_die>>
+    operate (std::unique_ptr <value_dwarf> a) override
+    {
+      doneness d = a->get_doneness ();
+      dwfl_context &dwctx = *a->get_dwctx ();
+      std::vector <Dwarf *> dwarfs = all_dwarfs (dwctx);
+
+      if (d == doneness::cooked)
+	for (Dwarf *dw: dwarfs)
+	  if (dwarf_getalt (dw) != nullptr
+	      || dwctx.get_address_index (dw).has_partial_units ())
+	    return std::make_unique <die_address_filter_producer>
+	      (std::make_unique <dwarf_entry_producer <dwarf_unit_producer>>
+	       (m_filter->m_tags, a->get_dwctx (), d), m_filter);
+
+      std::vector <std::unique_ptr <value_die>> ret;
+      for (Dwarf *dw: dwarfs)
+	{
+	  // Entry yields DIE's in the order of their offsets.
+	  std::vector <Dwarf_Off> offs = dwctx.get_address_index (dw)
+	    .find (m_filter->m_low, m_filter->m_high, true);
+	  std::sort (offs.begin (), offs.end ());
+
+	  for (Dwarf_Off off: offs)
+	    {
+	      Dwarf_Die die;
+	      if (dwarf_offdie (dw, off, &die) == nullptr)
+		throw_libdw ();
+	      if (m_filter->matches (die))
+		ret.push_back (std::make_unique <value_die>
+			       (a->get_dwctx (), die, 0, d));
+	    }
+	}
+
+      return std::make_unique <vector_producer <value_die>> (std::move (ret));
+    }
+  };
+
+  // Whether T is a constant that `aset' and ?contains would take as
+  // is, without any warnings.
+  bool
+  is_address_constant (tree const &t, uint64_t &ret)
+  {
+    if (t.tt () != tree_type::CONST
+	|| ! t.cst ().dom ()->safe_arith ()
+	|| t.cst ().value () < 0)
+      return false;
+    ret = t.cst ().value ().uval ();
+    return true;
+  }
+
+  std::shared_ptr <builtin>
+  reduce_address (tree const &assertion,
+		  std::shared_ptr <tag_filter const> tags)
+  {
+    if (assertion.tt () != tree_type::ASSERT
+	|| assertion.child (0).tt () != tree_type::PRED_SUBX_ANY)
+      return nullptr;
+
+    tree const *body = &assertion.child (0).child (0);
+    if (body->tt () == tree_type::SCOPE && body->scp ()->num_names () == 0)
+      body = &body->child (0);
+    if (body->tt () != tree_type::CAT
+	|| ! is_builtin (body->child (0), "address"))
+      return nullptr;
+
+    auto const &ch = body->m_children;
+    uint64_t low, high;
+    std::shared_ptr <address_filter const> filter;
+    if (ch.size () == 3 && is_builtin (ch[2], "?contains")
+	&& is_address_constant (ch[1], low) && low + 1 != 0)
+      filter = std::make_shared <address_filter> (low, low + 1, false,
+						   tags);
+
+    else if (ch.size () == 5 && is_builtin (ch[3], "aset")
+	     && is_address_constant (ch[1], low)
+	     && is_address_constant (ch[2], high) && low != high)
+      {
+	if (low > high)
+	  std::swap (low, high);
+	if (is_builtin (ch[4], "?contains") || is_builtin (ch[4], "?overlaps"))
+	  filter = std::make_shared <address_filter>
+	    (low, high, is_builtin (ch[4], "?overlaps"), tags);
+      }
+
+    if (filter == nullptr)
+      return nullptr;
+
+    return std::make_shared <reduced_overload_builtin
+			      <op_entry_dwarf_address,
+			       std::shared_ptr <address_filter const>>>
+      (filter);
+  }
+
+  // (entry ?TAG_x) on a Dwarf can be reduced further by a name or
+  // address assertion that follows.
+  struct reduced_entry_dwarf_tags_builtin
+    : public reduced_overload_builtin <op_entry_dwarf_tags,
+				       std::shared_ptr <tag_filter const>>
+  {
+    using reduced_overload_builtin::reduced_overload_builtin;
+
+    std::shared_ptr <builtin>
+    reduce (tree const &assertion) const override
+    {
+      if (auto ret = reduce_name (assertion, m_arg))
+	return ret;
+      return reduce_address (assertion, m_arg);
+    }
+  };
+
+  template <class Op>
+  std::shared_ptr <builtin>
+  reduce_offset (tree const &assertion)
+  {
+    if (auto cst = assertion.match_eq_constant ("offset"))
+      return std::make_shared <reduced_overload_builtin <Op, constant>>
+	(*cst);
+    return nullptr;
+  }
+
+  template <class Op>
+  std::shared_ptr <builtin>
+  reduce_tags (tree const &assertion)
+  {
+    if (auto filter = match_tag_filter (assertion))
+      return std::make_shared <reduced_overload_builtin
+				<Op, std::shared_ptr <tag_filter const>>>
+	(filter);
+    return nullptr;
+  }
+}
+
+std::shared_ptr <builtin>
+op_unit_dwarf::reduce (tree const &assertion)
+{
+  return reduce_offset <op_unit_dwarf_offset> (assertion);
+}
+
+std::shared_ptr <builtin>
+op_entry_dwarf::reduce (tree const &assertion)
+{
+  if (auto ret = reduce_offset <op_entry_dwarf_offset> (assertion))
+    return ret;
+  if (auto ret = reduce_name (assertion, nullptr))
+    return ret;
+  if (auto ret = reduce_address (assertion, nullptr))
+    return ret;
+  if (auto filter = match_tag_filter (assertion))
+    return std::make_shared <reduced_entry_dwarf_tags_builtin> (filter);
+  return nullptr;
+}
+
+std::shared_ptr <builtin>
+op_entry_cu::reduce (tree const &assertion)
+{
+  if (auto ret = reduce_offset <op_entry_cu_offset> (assertion))
+    return ret;
+  return reduce_tags <op_entry_cu_tags> (assertion);
+}
+
+std::shared_ptr <builtin>
+op_child_die::reduce (tree const &assertion)
+{
+  return reduce_tags <op_child_die_tags> (assertion);
+}
+
+
 // child
 namespace
 {
@@ -628,6 +1710,9 @@ namespace
   {
     std::shared_ptr <dwfl_context> m_dwctx;
     std::unique_ptr <value_die> m_die;
+
+    // The DIE that M_IT walks.
+    Dwarf_Die m_die_mem;
     attr_iterator m_it;
     size_t m_i;
     doneness m_doneness;
@@ -660,7 +1745,8 @@ namespace
 
       m_die = std::move (m_next.back ());
       m_next.pop_back ();
-      m_it = attr_iterator {&m_die->get_die ()};
+      m_die_mem = m_die->get_die ();
+      m_it = attr_iterator {&m_die_mem};
       return true;
     }
 
@@ -710,6 +1796,13 @@ namespace
       m_seen.push_back (at.code);
       return std::make_unique <value_attr> (*m_die, at, m_i++, m_doneness);
     }
+
+    size_t
+    next_batch (std::vector <std::unique_ptr <value_attr>> &out,
+		size_t n) override
+    {
+      return fill_batch (*this, out, n);
+    }
   };
 }
 
@@ -817,7 +1910,8 @@ Example::
 value_cst
 op_offset_die::operate (std::unique_ptr <value_die> val)
 {
-  constant c {dwarf_dieoffset (&val->get_die ()), &dw_offset_dom ()};
+  Dwarf_Die die = val->get_die ();
+  constant c {dwarf_dieoffset (&die), &dw_offset_dom ()};
   return value_cst {c, 0};
 }
 
@@ -922,7 +2016,7 @@ covered by this DIE.  (This calls dwarf_ranges under the covers.)::
 namespace
 {
   std::unique_ptr <value_cst>
-  get_die_addr (Dwarf_Die &die, int (cb) (Dwarf_Die *, Dwarf_Addr *))
+  get_die_addr (Dwarf_Die die, int (cb) (Dwarf_Die *, Dwarf_Addr *))
   {
     Dwarf_Addr addr;
     if (cb (&die, &addr) < 0)
@@ -932,7 +2026,7 @@ namespace
   }
 
   std::unique_ptr <value_cst>
-  maybe_get_die_addr (Dwarf_Die &die, int atname,
+  maybe_get_die_addr (Dwarf_Die die, int atname,
 		      int (cb) (Dwarf_Die *, Dwarf_Addr *))
   {
     // Attributes that hold addresses shouldn't generally be found
@@ -983,7 +2077,7 @@ attributes with a constant form, this converts the relative constant
 value to absolute address::
 
 	$ dwgrep ./tests/bitcount.o -e 'unit root'
-	[b]	compile_unit
+	[b] compile_unit
 		[... snip ...]
 		low_pc (addr)	0x10000;
 		high_pc (data8)	32;
@@ -1033,12 +2127,74 @@ describing where it is valid::
 }
 
 
+// scopes
+
+std::unique_ptr <value_producer <value_die>>
+op_scopes_dwarf_cst::operate (std::unique_ptr <value_dwarf> a,
+			      std::unique_ptr <value_cst> b)
+{
+  std::vector <std::unique_ptr <value_die>> ret;
+  uint64_t addr = addressify (b->get_constant ()).uval ();
+  if (addr + 1 == 0)
+    return std::make_unique <vector_producer <value_die>> (std::move (ret));
+
+  // In cooked mode, partial units are only reachable through imports.
+  doneness d = a->get_doneness ();
+  dwfl_context &dwctx = *a->get_dwctx ();
+  for (Dwarf *dw: all_dwarfs (dwctx))
+    for (Dwarf_Off off: dwctx.get_address_index (dw)
+			  .find (addr, addr + 1, d == doneness::raw))
+      {
+	Dwarf_Die die;
+	if (dwarf_offdie (dw, off, &die) == nullptr)
+	  throw_libdw ();
+	ret.push_back (std::make_unique <value_die>
+		       (a->get_dwctx (), die, ret.size (), d));
+      }
+
+  return std::make_unique <vector_producer <value_die>> (std::move (ret));
+}
+
+std::string
+op_scopes_dwarf_cst::docstring ()
+{
+  return
+R"docstring(
+
+Takes a Dwarf and an address on TOS and yields DIE's whose address
+ranges contain that address, innermost first.  For each unit that
+covers the address, this is the chain of lexical blocks, inlined
+subroutines and subprograms that the address falls into, followed by
+the unit DIE::
+
+	$ dwgrep ./tests/aranges.o -e '0x10005 scopes "%s"'
+	[5b] lexical_block
+	[2d] subprogram
+	[b] compile_unit
+
+Addresses are looked up in an index that is built the first time it's
+needed.  Units are selected by ``.debug_aranges`` where available, and
+only DIE's of selected units are ever indexed.  The following is thus
+equivalent, but may be much slower, as it looks at every DIE::
+
+	entry ?(address 0x10005 ?contains)
+
+Strength reduction makes it fast as well, but that yields DIE's in the
+order that ``entry`` does.
+
+In cooked mode, DIE's of partial units are not yielded.
+
+)docstring";
+}
+
+
 // label
 
 value_cst
 op_label_die::operate (std::unique_ptr <value_die> val)
 {
-  int tag = dwarf_tag (&val->get_die ());
+  Dwarf_Die die = val->get_die ();
+  int tag = dwarf_tag (&die);
   return value_cst {constant {tag, &dw_tag_dom ()}, 0};
 }
 
@@ -1173,7 +2329,7 @@ particular DIE was explored::
 // ?root
 
 pred_result
-pred_rootp_die::result (value_die &a)
+pred_rootp_die::result (value_die const &a)
 {
   // N.B. the following works the same for raw as well as cooked
   // DIE's.  The difference in behavior is in 'parent', which for
@@ -1226,15 +2382,19 @@ Takes a CU on TOS and yields its root DIE.
 namespace
 {
   value_die
-  op_root_die_operate (std::shared_ptr <value_die> a)
+  op_root_die_operate (std::unique_ptr <value_die> a)
   {
+    // For cooked DIE's, the root is that of the unit at the far end
+    // of the import chain.
+    auto dwctx = a->get_dwctx ();
+    Dwarf_Die die = a->get_die ();
     auto d = a->get_doneness ();
     if (d == doneness::cooked)
-      while (a->get_import () != nullptr)
-	a = a->get_import ();
+      for (import_id import = a->get_import (); import != no_import;
+	   import = dwctx->import_parent (import))
+	die = dwctx->import_die (import);
 
-    return value_die {a->get_dwctx (),
-		      dwpp_cudie (a->get_die ()), 0, d};
+    return value_die {dwctx, no_import, dwpp_cudie (die), 0, d};
   }
 }
 
@@ -1382,9 +2542,10 @@ expression::
 // ?haschildren
 
 pred_result
-pred_haschildrenp_die::result (value_die &a)
+pred_haschildrenp_die::result (value_die const &a)
 {
-  return pred_result (dwarf_haschildren (&a.get_die ()));
+  Dwarf_Die die = a.get_die ();
+  return pred_result (dwarf_haschildren (&die));
 }
 
 std::string
@@ -1466,22 +2627,8 @@ or replaced since the Dwarf was opened.
 std::unique_ptr <value_str>
 op_name_die::operate (std::unique_ptr <value_die> a)
 {
-  if (a->is_cooked ())
-    {
-      // On cooked DIE's, `name` integrates.
-      const char *name = dwarf_diename (&a->get_die ());
-      if (name != nullptr)
-	return std::make_unique <value_str> (name, 0);
-      else
-	return nullptr;
-    }
-  // Unfortunately there's no non-integrating dwarf_diename
-  // counterpart.
-  else if (dwarf_hasattr (&a->get_die (), DW_AT_name))
-    {
-      Dwarf_Attribute attr = dwpp_attr (a->get_die (), DW_AT_name);
-      return std::make_unique <value_str> (dwpp_formstring (attr), 0);
-    }
+  if (char const *name = die_name (a->get_die (), a->get_doneness ()))
+    return std::make_unique <value_str> (name, 0);
   else
     return nullptr;
 }
@@ -1699,16 +2846,21 @@ namespace
   // If found or found_integrated, and if RET is non-nullptr, prime
   // the pointed-to value with found attribute
   //
-  // If found_integrated, and if DWCTX is non-nullptr, a new value_die
-  // with the DIE where the attribute was found is created and passed
-  // in second slot of the returned pair.
+  // If found_integrated, and if WANT_DIE, a new value_die with the
+  // DIE where the attribute was found is created and passed in
+  // second slot of the returned pair.
+  //
+  // Whether DIE has an attribute is decided from a summary of its
+  // abbreviation, which DWCTX keeps, so that libdw doesn't need to
+  // decode the abbreviation over and over.
 
   std::pair <find_attribute_result, std::unique_ptr <value_die>>
-  find_attribute (Dwarf_Die die, int atname, doneness d,
-		  Dwarf_Attribute *ret_at,
-		  std::shared_ptr <dwfl_context> dwctx)
+  find_attribute (std::shared_ptr <dwfl_context> const &dwctx,
+		  Dwarf_Die die, int atname, doneness d,
+		  Dwarf_Attribute *ret_at, bool want_die)
   {
-    if (dwarf_hasattr (&die, atname))
+    auto const &abbrev = dwctx->get_abbrev (die);
+    if (abbrev.has_attr (atname))
       {
 	if (ret_at != nullptr)
 	  *ret_at = dwpp_attr (die, atname);
@@ -1721,12 +2873,12 @@ namespace
 		-> std::pair <find_attribute_result,
 			      std::unique_ptr <value_die>>
 	  {
-	    if (dwarf_hasattr (&die, atname2))
+	    if (abbrev.has_attr (atname2))
 	      {
 		Dwarf_Attribute at = dwpp_attr (die, atname2);
 		Dwarf_Die integrated_die = dwpp_formref_die (at);
-		auto ret = find_attribute (integrated_die, atname, d,
-					   ret_at, nullptr);
+		auto ret = find_attribute (dwctx, integrated_die, atname, d,
+					   ret_at, false);
 
 		// If this call found anything, translate from found
 		// to found_integrated and create the accompanying
@@ -1734,9 +2886,10 @@ namespace
 		if (ret.first == find_attribute_result::found)
 		  {
 		    std::unique_ptr <value_die> vd
-		      = dwctx == nullptr ? nullptr
+		      = ! want_die ? nullptr
 		        : std::make_unique <value_die>
-					(dwctx, integrated_die, 0, d);
+					(dwctx, no_import, integrated_die,
+					 0, d);
 		    return std::make_pair
 				(find_attribute_result::found_integrated,
 				 std::move (vd));
@@ -1762,8 +2915,8 @@ std::unique_ptr <value_producer <value>>
 op_atval_die::operate (std::unique_ptr <value_die> a)
 {
   Dwarf_Attribute attr;
-  auto r = find_attribute (a->get_die (), m_atname, a->get_doneness (),
-			   &attr, a->get_dwctx ());
+  auto r = find_attribute (a->get_dwctx (), a->get_die (), m_atname,
+			   a->get_doneness (), &attr, true);
   if (r.first == find_attribute_result::not_found)
     return nullptr;
   auto dv = r.second != nullptr ? std::move (r.second) : std::move (a);
@@ -1796,10 +2949,10 @@ pred_atname_die::pred_atname_die (unsigned atname)
 {}
 
 pred_result
-pred_atname_die::result (value_die &a)
+pred_atname_die::result (value_die const &a)
 {
-  return find_attribute (a.get_die (), m_atname,
-			 a.get_doneness (), nullptr, nullptr).first
+  return find_attribute (a.get_dwctx (), a.get_die (), m_atname,
+			 a.get_doneness (), nullptr, false).first
 		!= find_attribute_result::not_found
     ? pred_result::yes : pred_result::no;
 }
@@ -1844,9 +2997,10 @@ pred_atname_attr::pred_atname_attr (unsigned atname)
 {}
 
 pred_result
-pred_atname_attr::result (value_attr &a)
+pred_atname_attr::result (value_attr const &a)
 {
-  return pred_result (dwarf_whatattr (&a.get_attr ()) == m_atname);
+  Dwarf_Attribute at = a.get_attr ();
+  return pred_result (dwarf_whatattr (&at) == m_atname);
 }
 
 std::string
@@ -1870,7 +3024,7 @@ pred_atname_cst::pred_atname_cst (unsigned atname)
 {}
 
 pred_result
-pred_atname_cst::result (value_cst &a)
+pred_atname_cst::result (value_cst const &a)
 {
   return pred_result (m_const == a.get_constant ());
 }
@@ -1904,9 +3058,10 @@ pred_tag_die::pred_tag_die (int tag)
 {}
 
 pred_result
-pred_tag_die::result (value_die &a)
+pred_tag_die::result (value_die const &a)
 {
-  return pred_result (dwarf_tag (&a.get_die ()) == m_tag);
+  Dwarf_Die die = a.get_die ();
+  return pred_result (dwarf_tag (&die) == m_tag);
 }
 
 std::string
@@ -1931,7 +3086,7 @@ pred_tag_cst::pred_tag_cst (int tag)
 {}
 
 pred_result
-pred_tag_cst::result (value_cst &a)
+pred_tag_cst::result (value_cst const &a)
 {
   return pred_result (m_const == a.get_constant ());
 }
@@ -1962,9 +3117,10 @@ pred_form_attr::pred_form_attr (unsigned form)
 {}
 
 pred_result
-pred_form_attr::result (value_attr &a)
+pred_form_attr::result (value_attr const &a)
 {
-  return pred_result (dwarf_whatform (&a.get_attr ()) == m_form);
+  Dwarf_Attribute at = a.get_attr ();
+  return pred_result (dwarf_whatform (&at) == m_form);
 }
 
 std::string
@@ -1990,7 +3146,7 @@ pred_form_cst::pred_form_cst (unsigned form)
 {}
 
 pred_result
-pred_form_cst::result (value_cst &a)
+pred_form_cst::result (value_cst const &a)
 {
   return pred_result (m_const == a.get_constant ());
 }
@@ -2015,7 +3171,7 @@ pred_op_loclist_elem::pred_op_loclist_elem (unsigned op)
 {}
 
 pred_result
-pred_op_loclist_elem::result (value_loclist_elem &a)
+pred_op_loclist_elem::result (value_loclist_elem const &a)
 {
   for (size_t i = 0; i < a.get_exprlen (); ++i)
     if (a.get_expr ()[i].atom == m_op)
@@ -2044,7 +3200,7 @@ pred_op_loclist_op::pred_op_loclist_op (unsigned op)
 {}
 
 pred_result
-pred_op_loclist_op::result (value_loclist_op &a)
+pred_op_loclist_op::result (value_loclist_op const &a)
 {
   return pred_result (a.get_dwop ()->atom == m_op);
 }
@@ -2070,7 +3226,7 @@ pred_op_cst::pred_op_cst (unsigned form)
 {}
 
 pred_result
-pred_op_cst::result (value_cst &a)
+pred_op_cst::result (value_cst const &a)
 {
   return pred_result (m_const == a.get_constant ());
 }
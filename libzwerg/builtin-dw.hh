@@ -30,6 +30,7 @@
 #define _BUILTIN_DW_H_
 
 #include <memory>
+#include <vector>
 
 #include "overload.hh"
 #include "value-dw.hh"
@@ -58,6 +59,41 @@ struct op_unit_dwarf
   operate (std::unique_ptr <value_dwarf> a) override;
 
   static std::string docstring ();
+  static std::shared_ptr <builtin> reduce (tree const &assertion);
+};
+
+// Units of a Dwarf in the order in which op_unit_dwarf yields them.
+// Each unit is described by its Dwarf_CU and the offset of its unit
+// header.
+typedef std::vector <std::pair <Dwarf_CU *, Dwarf_Off>> unit_list;
+unit_list dwarf_units (std::shared_ptr <dwfl_context> dwctx, doneness d);
+
+// Like op_unit_dwarf, but only yields units [BEGIN, END) from a list
+// UNITS that was previously obtained through dwarf_units on DWCTX.
+// The units are taken from DWCTX, not from the Dwarf on TOS, which
+// only decides doneness.  This is used for parallel evaluation, where
+// each slice has a context of its own, see parallel.hh.
+struct op_unit_dwarf_slice
+  : public op_yielding_overload <value_cu, value_dwarf>
+{
+  std::shared_ptr <dwfl_context> m_dwctx;
+  std::shared_ptr <unit_list const> m_units;
+  size_t m_begin;
+  size_t m_end;
+
+  op_unit_dwarf_slice (std::shared_ptr <op> upstream,
+		       std::shared_ptr <dwfl_context> dwctx,
+		       std::shared_ptr <unit_list const> units,
+		       size_t begin, size_t end)
+    : op_yielding_overload {upstream}
+    , m_dwctx {dwctx}
+    , m_units {units}
+    , m_begin {begin}
+    , m_end {end}
+  {}
+
+  std::unique_ptr <value_producer <value_cu>>
+  operate (std::unique_ptr <value_dwarf> a) override;
 };
 
 struct op_unit_die
@@ -89,6 +125,7 @@ struct op_entry_cu
   operate (std::unique_ptr <value_cu> a) override;
 
   static std::string docstring ();
+  static std::shared_ptr <builtin> reduce (tree const &assertion);
 };
 
 struct op_entry_dwarf
@@ -100,6 +137,34 @@ struct op_entry_dwarf
   operate (std::unique_ptr <value_dwarf> a) override;
 
   static std::string docstring ();
+  static std::shared_ptr <builtin> reduce (tree const &assertion);
+};
+
+// Like op_entry_dwarf, but only yields DIE's of units [BEGIN, END)
+// from UNITS, which come from DWCTX as with op_unit_dwarf_slice.
+// Note that positions of the DIE's are counted from the beginning of
+// the slice, not from the beginning of the Dwarf.
+struct op_entry_dwarf_slice
+  : public op_yielding_overload <value_die, value_dwarf>
+{
+  std::shared_ptr <dwfl_context> m_dwctx;
+  std::shared_ptr <unit_list const> m_units;
+  size_t m_begin;
+  size_t m_end;
+
+  op_entry_dwarf_slice (std::shared_ptr <op> upstream,
+			std::shared_ptr <dwfl_context> dwctx,
+			std::shared_ptr <unit_list const> units,
+			size_t begin, size_t end)
+    : op_yielding_overload {upstream}
+    , m_dwctx {dwctx}
+    , m_units {units}
+    , m_begin {begin}
+    , m_end {end}
+  {}
+
+  std::unique_ptr <value_producer <value_die>>
+  operate (std::unique_ptr <value_dwarf> a) override;
 };
 
 struct op_child_die
@@ -111,6 +176,7 @@ struct op_child_die
   operate (std::unique_ptr <value_die> a) override;
 
   static std::string docstring ();
+  static std::shared_ptr <builtin> reduce (tree const &assertion);
 };
 
 struct op_elem_loclist_elem
@@ -182,6 +248,18 @@ struct op_address_die
   static std::string docstring ();
 };
 
+struct op_scopes_dwarf_cst
+  : public op_yielding_overload <value_die, value_dwarf, value_cst>
+{
+  using op_yielding_overload::op_yielding_overload;
+
+  std::unique_ptr <value_producer <value_die>>
+  operate (std::unique_ptr <value_dwarf> a,
+	   std::unique_ptr <value_cst> b) override;
+
+  static std::string docstring ();
+};
+
 struct op_address_attr
   : public op_overload <value_cst, value_attr>
 {
@@ -250,7 +328,7 @@ struct pred_rootp_die
 {
   using pred_overload <value_die>::pred_overload;
 
-  pred_result result (value_die &a) override;
+  pred_result result (value_die const &a) override;
   static std::string docstring ();
 };
 
@@ -326,7 +404,7 @@ struct pred_haschildrenp_die
 {
   using pred_overload::pred_overload;
 
-  pred_result result (value_die &a) override;
+  pred_result result (value_die const &a) override;
   static std::string docstring ();
 };
 
@@ -453,7 +531,7 @@ class pred_atname_die
 
 public:
   pred_atname_die (unsigned atname);
-  pred_result result (value_die &a) override;
+  pred_result result (value_die const &a) override;
   static std::string docstring ();
 };
 
@@ -464,7 +542,7 @@ class pred_atname_attr
 
 public:
   pred_atname_attr (unsigned atname);
-  pred_result result (value_attr &a) override;
+  pred_result result (value_attr const &a) override;
   static std::string docstring ();
 };
 
@@ -475,7 +553,7 @@ class pred_atname_cst
 
 public:
   pred_atname_cst (unsigned atname);
-  pred_result result (value_cst &a) override;
+  pred_result result (value_cst const &a) override;
   static std::string docstring ();
 };
 
@@ -486,7 +564,8 @@ class pred_tag_die
 
 public:
   pred_tag_die (int tag);
-  pred_result result (value_die &a) override;
+  pred_result result (value_die const &a) override;
+  int get_tag () const { return m_tag; }
   static std::string docstring ();
 };
 
@@ -497,7 +576,7 @@ class pred_tag_cst
 
 public:
   pred_tag_cst (int tag);
-  pred_result result (value_cst &a) override;
+  pred_result result (value_cst const &a) override;
   static std::string docstring ();
 };
 
@@ -508,7 +587,7 @@ class pred_form_attr
 
 public:
   pred_form_attr (unsigned form);
-  pred_result result (value_attr &a) override;
+  pred_result result (value_attr const &a) override;
   static std::string docstring ();
 };
 
@@ -519,7 +598,7 @@ class pred_form_cst
 
 public:
   pred_form_cst (unsigned form);
-  pred_result result (value_cst &a) override;
+  pred_result result (value_cst const &a) override;
   static std::string docstring ();
 };
 
@@ -530,7 +609,7 @@ class pred_op_loclist_elem
 
 public:
   pred_op_loclist_elem (unsigned op);
-  pred_result result (value_loclist_elem &a) override;
+  pred_result result (value_loclist_elem const &a) override;
   static std::string docstring ();
 };
 
@@ -541,7 +620,7 @@ class pred_op_loclist_op
 
 public:
   pred_op_loclist_op (unsigned op);
-  pred_result result (value_loclist_op &a) override;
+  pred_result result (value_loclist_op const &a) override;
   static std::string docstring ();
 };
 
@@ -552,7 +631,7 @@ class pred_op_cst
 
 public:
   pred_op_cst (unsigned form);
-  pred_result result (value_cst &a) override;
+  pred_result result (value_cst const &a) override;
   static std::string docstring ();
 };
 
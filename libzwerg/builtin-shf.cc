@@ -27,6 +27,7 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include "builtin-shf.hh"
+#include "infer.hh"
 #include "op.hh"
 
 namespace
@@ -69,6 +70,12 @@ op_drop::next ()
   return nullptr;
 }
 
+void
+op_drop::stack_effect (stack_shape &shape)
+{
+  shape.pop (1);
+}
+
 std::string
 op_drop::docstring ()
 {
@@ -90,6 +97,16 @@ op_swap::next ()
   return nullptr;
 }
 
+void
+op_swap::stack_effect (stack_shape &shape)
+{
+  auto a = shape.get (0);
+  auto b = shape.get (1);
+  shape.pop (2);
+  shape.push (a);
+  shape.push (b);
+}
+
 std::string
 op_swap::docstring ()
 {
@@ -108,6 +125,13 @@ op_dup::next ()
   return nullptr;
 }
 
+void
+op_dup::stack_effect (stack_shape &shape)
+{
+  shape.need (1);
+  shape.push (shape.get (0));
+}
+
 std::string
 op_dup::docstring ()
 {
@@ -126,6 +150,13 @@ op_over::next ()
   return nullptr;
 }
 
+void
+op_over::stack_effect (stack_shape &shape)
+{
+  shape.need (2);
+  shape.push (shape.get (1));
+}
+
 std::string
 op_over::docstring ()
 {
@@ -149,6 +180,18 @@ op_rot::next ()
   return nullptr;
 }
 
+void
+op_rot::stack_effect (stack_shape &shape)
+{
+  auto a = shape.get (0);
+  auto b = shape.get (1);
+  auto c = shape.get (2);
+  shape.pop (3);
+  shape.push (b);
+  shape.push (a);
+  shape.push (c);
+}
+
 std::string
 op_rot::docstring ()
 {
@@ -36,6 +36,7 @@ struct op_drop
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -45,6 +46,7 @@ struct op_swap
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -54,6 +56,7 @@ struct op_dup
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -63,6 +66,7 @@ struct op_over
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -72,6 +76,7 @@ struct op_rot
 {
   using inner_op::inner_op;
   stack::uptr next () override;
+  static void stack_effect (stack_shape &shape);
 
   static std::string docstring ();
 };
@@ -93,6 +93,13 @@ namespace
       return std::make_unique <value_symbol> (m_dwctx, sym, name,
 					      symidx, m_i++, m_doneness);
     }
+
+    size_t
+    next_batch (std::vector <std::unique_ptr <value_symbol>> &out,
+		size_t n) override
+    {
+      return fill_batch (*this, out, n);
+    }
   };
 }
 
@@ -32,6 +32,7 @@
 
 #include "builtin.hh"
 #include "builtin-cst.hh"
+#include "infer.hh"
 #include "op.hh"
 #include "overload.hh"
 #include "value-cst.hh"
@@ -60,6 +61,24 @@ builtin::protomap () const
   return {};
 }
 
+std::shared_ptr <builtin>
+builtin::reduce (tree const &assertion) const
+{
+  return nullptr;
+}
+
+void
+builtin::stack_effect (stack_shape &shape) const
+{
+  shape.apply (protomap ());
+}
+
+std::shared_ptr <builtin>
+builtin::peg (stack_shape const &shape) const
+{
+  return nullptr;
+}
+
 std::unique_ptr <pred>
 maybe_invert (std::unique_ptr <pred> pred, bool positive)
 {
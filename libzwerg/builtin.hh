@@ -39,6 +39,8 @@
 
 struct pred;
 struct op;
+struct tree;
+class stack_shape;
 
 enum class yield
   {
@@ -80,6 +82,26 @@ public:
 
   virtual std::string docstring () const;
   virtual builtin_protomap protomap () const;
+
+  // Strength reduction.  ASSERTION is a tree that directly follows
+  // this word in a CAT, such as (offset == 0x123) or ?TAG_member.  If
+  // the word knows how to compute the two together more cheaply than
+  // by yielding everything and filtering afterwards, it returns a
+  // builtin that does so.  Otherwise it returns nullptr.  See
+  // tree::reduce_strength.
+  virtual std::shared_ptr <builtin> reduce (tree const &assertion) const;
+
+  // Static stack effect.  Update SHAPE to describe the stack after
+  // this word is applied to a stack described by SHAPE.  The default
+  // implementation goes by the prototype map.  See
+  // tree::peg_overloads.
+  virtual void stack_effect (stack_shape &shape) const;
+
+  // Overload pegging.  If SHAPE, the statically known shape of the
+  // stack that this word will be applied to, determines what
+  // overload will be chosen, return a builtin that invokes that
+  // overload directly.  Otherwise return nullptr.
+  virtual std::shared_ptr <builtin> peg (stack_shape const &shape) const;
 };
 
 // Return either PRED, or PRED_NOT(PRED), depending on POSITIVE.
@@ -96,6 +118,11 @@ public:
   explicit pred_builtin (bool positive)
     : m_positive {positive}
   {}
+
+  // Predicates leave the stack as it is.
+  void
+  stack_effect (stack_shape &shape) const override
+  {}
 };
 
 struct vocabulary
@@ -174,6 +201,12 @@ add_simple_exec_builtin (vocabulary &voc, char const *name)
     {
       return Op::docstring ();
     }
+
+    void
+    stack_effect (stack_shape &shape) const override
+    {
+      Op::stack_effect (shape);
+    }
   };
 
   voc.add (std::make_shared <simple_exec_builtin> (name));
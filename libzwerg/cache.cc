@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 2014 Red Hat, Inc.
+   Copyright (C) 2014, 2015 Red Hat, Inc.
    This file is part of dwgrep.
 
    This file is free software; you can redistribute it and/or modify
@@ -26,94 +26,784 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
-#include <cassert>
+#include <fcntl.h>
+#include <gelf.h>
+#include <unistd.h>
+
 #include <algorithm>
-#include <memory>
+#include <atomic>
+#include <cassert>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <thread>
 
+#include "std-memory.hh"
 #include "cache.hh"
 #include "dwpp.hh"
 #include "dwit.hh"
 
-void
-parent_cache::recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-					 Dwarf_Off paroff)
+Dwarf_Off const parent_index::no_off;
+uint32_t const parent_index::no_parent;
+Dwarf_Off const parent_cache::no_off;
+
+namespace
 {
-  while (true)
-    {
-      Dwarf_Off off = dwarf_dieoffset (&die);
-      uc.push_back (std::make_pair (off, paroff));
+  // A contiguous run of units, given by offsets of their unit DIE's,
+  // whose DIE's are collected by one thread.  Parent positions are
+  // relative to the slice.
+  struct slice
+  {
+    std::vector <Dwarf_Off>::const_iterator begin;
+    std::vector <Dwarf_Off>::const_iterator end;
+    std::vector <Dwarf_Off> offsets;
+    std::vector <uint32_t> parents;
+    std::exception_ptr error;
+    bool done;
+  };
+
+  // Slices are only worth a thread if they have at least this many
+  // units.
+  size_t const min_slice_units = 16;
 
+  // Walk the unit iteratively, keeping ancestors of the current DIE
+  // on a stack of our own, so that deeply nested DIE's can't run the
+  // C stack out.
+  void
+  populate_unit (slice &sl, Dwarf_Die die)
+  {
+    std::vector <std::pair <Dwarf_Die, uint32_t>> path;
+    while (true)
       {
+	uint32_t pos = sl.offsets.size ();
+	sl.offsets.push_back (dwarf_dieoffset (&die));
+	sl.parents.push_back (path.empty () ? parent_index::no_parent
+			      : path.back ().second);
+
 	Dwarf_Die child;
 	if (dwpp_child (die, child))
-	  recursively_populate_unit (uc, child, off);
+	  {
+	    path.push_back (std::make_pair (die, pos));
+	    die = child;
+	    continue;
+	  }
+
+	// Move on to the nearest sibling of this DIE or of one of
+	// its ancestors.
+	while (true)
+	  {
+	    if (path.empty ())
+	      return;
+
+	    int ret = dwarf_siblingof (&die, &die);
+	    if (ret < 0)
+	      throw_libdw ();
+	    if (ret == 0)
+	      break;
+
+	    die = path.back ().first;
+	    path.pop_back ();
+	  }
       }
+  }
 
-      switch (dwarf_siblingof (&die, &die))
-	{
-	case 0:
-	  break;
-	case -1:
-	  throw_libdw ();
-	case 1:
-	  return;
-	}
+  void
+  populate_slice (slice &sl, Dwarf *dw)
+  {
+    try
+      {
+	for (auto it = sl.begin; it != sl.end; ++it)
+	  {
+	    Dwarf_Die cudie;
+	    if (dwarf_offdie (dw, *it, &cudie) == nullptr)
+	      throw_libdw ();
+	    populate_unit (sl, cudie);
+	  }
+      }
+    catch (...)
+      {
+	sl.error = std::current_exception ();
+      }
+    sl.done = true;
+  }
+
+  // A Dwarf handle of the calling thread's own.  DW is nullptr if
+  // the file couldn't be opened.
+  struct private_dwarf
+  {
+    int fd;
+    Elf *elf;
+    Dwarf *dw;
+
+    explicit private_dwarf (std::string const &fn)
+      : fd {open (fn.c_str (), O_RDONLY)}
+      , elf {nullptr}
+      , dw {nullptr}
+    {
+      if (fd == -1)
+	return;
+      elf = elf_begin (fd, ELF_C_READ_MMAP, nullptr);
+      if (elf != nullptr)
+	dw = dwarf_begin_elf (elf, DWARF_C_READ, nullptr);
+    }
+
+    ~private_dwarf ()
+    {
+      if (dw != nullptr)
+	dwarf_end (dw);
+      if (elf != nullptr)
+	elf_end (elf);
+      if (fd != -1)
+	close (fd);
+    }
+  };
+
+  // Populate SL from a fresh handle of FN.  If that fails for any
+  // reason, SL is left untouched for the caller to populate.
+  void
+  populate_slice_privately (slice &sl, std::string const &fn)
+  {
+    private_dwarf pdw {fn};
+    if (pdw.dw == nullptr)
+      return;
+
+    populate_slice (sl, pdw.dw);
+    if (sl.error != nullptr)
+      {
+	sl.offsets.clear ();
+	sl.parents.clear ();
+	sl.error = nullptr;
+	sl.done = false;
+      }
+  }
+
+  // Only libdwfl applies relocations of ET_REL files, a handle that
+  // we open ourselves would see a different Dwarf.
+  bool
+  is_relocatable (Dwarf *dw)
+  {
+    GElf_Ehdr ehdr;
+    Elf *elf = dwarf_getelf (dw);
+    return elf == nullptr || gelf_getehdr (elf, &ehdr) == nullptr
+      || ehdr.e_type == ET_REL;
+  }
+
+  std::vector <Dwarf_Off>
+  unit_offsets (Dwarf *dw)
+  {
+    std::vector <Dwarf_Off> cus;
+    for (auto it = cu_iterator {dw}; it != cu_iterator::end (); ++it)
+      cus.push_back (dwarf_dieoffset (*it));
+    return cus;
+  }
+}
+
+parent_index::parent_index (Dwarf *dw)
+{
+  build (dw, unit_offsets (dw), "", 1);
+}
+
+parent_index::parent_index (Dwarf *dw, std::string const &fn,
+			    unsigned nthreads)
+{
+  build (dw, unit_offsets (dw), fn, nthreads);
+}
+
+parent_index::parent_index (Dwarf_Die cudie)
+{
+  build (dwarf_cu_getdwarf (cudie.cu), {dwarf_dieoffset (&cudie)}, "", 1);
+}
+
+void
+parent_index::build (Dwarf *dw, std::vector <Dwarf_Off> const &cus,
+		     std::string const &fn, unsigned nthreads)
+{
+  if (fn.empty () || is_relocatable (dw))
+    nthreads = 1;
+
+  size_t nslices = std::min <size_t> (std::max (1u, nthreads),
+				      std::max <size_t> (1, cus.size ()
+							 / min_slice_units));
+
+  std::vector <slice> slices (nslices);
+  for (size_t i = 0; i < nslices; ++i)
+    {
+      slices[i].begin = cus.begin () + cus.size () * i / nslices;
+      slices[i].end = cus.begin () + cus.size () * (i + 1) / nslices;
+      slices[i].done = false;
+    }
+
+  std::vector <std::thread> threads;
+  for (size_t i = 1; i < nslices; ++i)
+    threads.emplace_back (populate_slice_privately, std::ref (slices[i]),
+			  std::cref (fn));
+  populate_slice (slices[0], dw);
+  for (auto &thr: threads)
+    thr.join ();
+
+  size_t size = 0;
+  for (auto &sl: slices)
+    {
+      if (! sl.done)
+	populate_slice (sl, dw);
+      if (sl.error != nullptr)
+	std::rethrow_exception (sl.error);
+      size += sl.offsets.size ();
+    }
+
+  // Units come in the order of their offsets, and so do DIE's
+  // within each unit, thus joining the slices keeps the offsets
+  // sorted.
+  m_offsets.reserve (size);
+  m_parents.reserve (size);
+  for (auto const &sl: slices)
+    {
+      uint32_t base = m_offsets.size ();
+      m_offsets.insert (m_offsets.end (),
+			sl.offsets.begin (), sl.offsets.end ());
+      for (uint32_t par: sl.parents)
+	m_parents.push_back (par == no_parent ? no_parent : base + par);
     }
 }
 
-parent_cache::unit_cache_t
-parent_cache::populate_unit (Dwarf_Die die)
+size_t
+parent_index::position (Dwarf_Off off) const
 {
-  unit_cache_t uc;
-  recursively_populate_unit (uc, die, no_off);
-  return uc;
+  auto it = std::lower_bound (m_offsets.begin (), m_offsets.end (), off);
+  assert (it != m_offsets.end ());
+  assert (*it == off);
+  return it - m_offsets.begin ();
+}
+
+Dwarf_Off
+parent_index::find_parent (Dwarf_Off off) const
+{
+  uint32_t par = m_parents[position (off)];
+  return par == no_parent ? no_off : m_offsets[par];
+}
+
+bool
+parent_index::is_root (Dwarf_Off off) const
+{
+  return m_parents[position (off)] == no_parent;
+}
+
+size_t
+parent_index::memory_size () const
+{
+  return sizeof (*this)
+    + m_offsets.capacity () * sizeof (m_offsets[0])
+    + m_parents.capacity () * sizeof (m_parents[0]);
+}
+
+parent_cache::parent_cache ()
+  : m_budget {0}
+  , m_streaming {false}
+  , m_threads {1}
+  , m_stats {}
+{}
+
+void
+parent_cache::set_budget (size_t budget)
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  m_budget = budget;
+  evict ();
+}
+
+void
+parent_cache::set_streaming (bool streaming)
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  m_streaming = streaming;
+}
+
+size_t
+parent_cache::get_budget ()
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  return m_budget;
+}
+
+bool
+parent_cache::get_streaming ()
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  return m_streaming;
+}
+
+void
+parent_cache::set_threads (unsigned nthreads,
+			   std::function <std::string (Dwarf *)> file_of)
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  m_threads = nthreads;
+  m_file_of = file_of;
+}
+
+cache_stats
+parent_cache::get_stats ()
+{
+  std::lock_guard <std::mutex> lock {m_mutex};
+  return m_stats;
+}
+
+void
+parent_cache::erase (std::list <entry>::iterator it)
+{
+  m_stats.bytes -= it->size;
+  --m_stats.entries;
+  m_entries.erase (it->key);
+  m_lru.erase (it);
+}
+
+void
+parent_cache::drop_passed (entry const &e)
+{
+  if (e.partial)
+    return;
+
+  for (auto it = m_lru.begin (); it != m_lru.end (); )
+    if (&*it != &e
+	&& it->key.first == e.key.first
+	&& it->owner == std::this_thread::get_id ()
+	&& ! it->partial)
+      {
+	erase (it++);
+	++m_stats.drops;
+      }
+    else
+      ++it;
+}
+
+void
+parent_cache::evict ()
+{
+  // The most recent entry stays even if it alone is over budget.
+  // Indices that are still in use stay alive through their
+  // shared_ptr's until the users are done with them.
+  while (m_budget != 0 && m_stats.bytes > m_budget && m_lru.size () > 1)
+    {
+      erase (std::prev (m_lru.end ()));
+      ++m_stats.evictions;
+    }
+}
+
+std::shared_ptr <parent_index const>
+parent_cache::get (Dwarf_Die die)
+{
+  Dwarf *dw = dwarf_cu_getdwarf (die.cu);
+  bool per_unit;
+  unsigned nthreads;
+  std::function <std::string (Dwarf *)> file_of;
+  {
+    std::lock_guard <std::mutex> lock {m_mutex};
+    per_unit = m_budget != 0 || m_streaming;
+    nthreads = m_threads;
+    file_of = m_file_of;
+  }
+
+  Dwarf_Die cudie;
+  key_type key {dw, no_off};
+  if (per_unit)
+    {
+      if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
+	throw_libdw ();
+      key.second = dwarf_dieoffset (&cudie);
+    }
+
+  {
+    std::lock_guard <std::mutex> lock {m_mutex};
+    auto it = m_entries.find (key);
+    if (it != m_entries.end ())
+      {
+	++m_stats.hits;
+	m_lru.splice (m_lru.begin (), m_lru, it->second);
+	if (m_streaming)
+	  drop_passed (m_lru.front ());
+	return m_lru.front ().index;
+      }
+  }
+
+  // Build the index without holding the lock, so that threads that
+  // look at other units aren't held up.
+  std::shared_ptr <parent_index const> index;
+  if (per_unit)
+    index = std::make_shared <parent_index> (cudie);
+  else if (nthreads > 1 && file_of != nullptr)
+    index = std::make_shared <parent_index> (dw, file_of (dw), nthreads);
+  else
+    index = std::make_shared <parent_index> (dw);
+
+  std::lock_guard <std::mutex> lock {m_mutex};
+  ++m_stats.misses;
+
+  // Another thread may have built the same index meanwhile.
+  if (m_entries.find (key) == m_entries.end ())
+    {
+      size_t size = index->memory_size ();
+      m_lru.push_front (entry {key, index, size,
+			       std::this_thread::get_id (),
+			       per_unit
+			       && dwarf_tag (&cudie) == DW_TAG_partial_unit});
+      m_entries.insert (std::make_pair (key, m_lru.begin ()));
+      ++m_stats.entries;
+      m_stats.bytes += size;
+      m_stats.peak_bytes = std::max (m_stats.peak_bytes, m_stats.bytes);
+
+      if (m_streaming)
+	drop_passed (m_lru.front ());
+      evict ();
+    }
+
+  return index;
 }
 
 Dwarf_Off
 parent_cache::find (Dwarf_Die die)
+{
+  return get (die)->find_parent (dwarf_dieoffset (&die));
+}
+
+bool
+parent_cache::is_root (Dwarf_Die die)
+{
+  return get (die)->is_root (dwarf_dieoffset (&die));
+}
+
+namespace
+{
+  uint64_t
+  die_abbrev_code (Dwarf_Die const &die)
+  {
+    // Each DIE starts with ULEB128-encoded code of its abbreviation.
+    auto ptr = static_cast <unsigned char const *> (die.addr);
+    uint64_t code = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+	unsigned char byte = *ptr++;
+	code |= (uint64_t) (byte & 0x7f) << shift;
+	if ((byte & 0x80) == 0)
+	  break;
+      }
+    return code;
+  }
+
+  std::atomic <uint64_t> abbrev_cache_ids {0};
+}
+
+bool
+abbrev_cache::abbrev_info::has_attr (unsigned atname) const
+{
+  if (atname < max_std_at)
+    return m_attrs.test (atname);
+  return std::binary_search (m_user_attrs.begin (), m_user_attrs.end (),
+			     atname);
+}
+
+abbrev_cache::unit_abbrevs::unit_abbrevs (Dwarf_Die die)
+  : dense {true}
 {
   Dwarf_Die cudie;
   if (dwarf_diecu (&die, &cudie, nullptr, nullptr) == nullptr)
     throw_libdw ();
 
-  Dwarf_Off cuoff = dwarf_dieoffset (&cudie);
-  Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto key = std::make_pair (dw, cuoff);
+  for (Dwarf_Off offset = 0; ; )
+    {
+      size_t length;
+      Dwarf_Abbrev *abbrev = dwarf_getabbrev (&cudie, offset, &length);
+      if (abbrev == nullptr)
+	throw_libdw ();
+      if (abbrev == DWARF_END_ABBREV)
+	break;
+      offset += length;
+      infos.push_back (summarize (*abbrev));
+    }
+
+  std::sort (infos.begin (), infos.end (),
+	     [] (abbrev_info const &a, abbrev_info const &b)
+	     {
+	       return a.m_code < b.m_code;
+	     });
 
-  auto it = m_cache.find (key);
-  if (it == m_cache.end ())
-    it = m_cache.insert (std::make_pair (key, populate_unit (cudie))).first;
+  for (size_t i = 0; i < infos.size (); ++i)
+    if (infos[i].m_code != i + 1)
+      dense = false;
+}
+
+abbrev_cache::abbrev_info const &
+abbrev_cache::unit_abbrevs::find (uint64_t code) const
+{
+  if (dense && code - 1 < infos.size ())
+    return infos[code - 1];
 
-  Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound
-    (it->second.begin (), it->second.end (), dieoff,
-     [] (std::pair <Dwarf_Off, Dwarf_Off> const &a, Dwarf_Off b)
-     {
-       return a.first < b;
-     });
+  auto it = std::lower_bound (infos.begin (), infos.end (), code,
+			      [] (abbrev_info const &a, uint64_t b)
+			      {
+				return a.m_code < b;
+			      });
+  if (it != infos.end () && it->m_code == code)
+    return *it;
 
-  assert (jt != it->second.end ());
-  assert (jt->first == dieoff);
-  return jt->second;
+  // libdw would refuse to decode such a DIE.  Pretend that it has
+  // no attributes, as that's what dwarf_hasattr says in that case.
+  static abbrev_info const unknown {};
+  return unknown;
 }
 
+abbrev_cache::abbrev_info
+abbrev_cache::summarize (Dwarf_Abbrev &abbrev)
+{
+  abbrev_info info;
+  info.m_code = dwarf_getabbrevcode (&abbrev);
+  info.m_tag = dwarf_getabbrevtag (&abbrev);
+  info.m_has_children = dwarf_abbrevhaschildren (&abbrev) == DW_CHILDREN_yes;
 
-bool
-root_cache::is_root (Dwarf_Die die)
+  unsigned int name, form;
+  Dwarf_Off offset;
+  for (size_t i = 0;
+       dwarf_getabbrevattr (&abbrev, i, &name, &form, &offset) == 0; ++i)
+    if (name < abbrev_info::max_std_at)
+      info.m_attrs.set (name);
+    else
+      info.m_user_attrs.push_back (name);
+
+  std::sort (info.m_user_attrs.begin (), info.m_user_attrs.end ());
+  return info;
+}
+
+abbrev_cache::abbrev_cache ()
+  : m_id {++abbrev_cache_ids}
+{}
+
+std::shared_ptr <abbrev_cache::unit_abbrevs const>
+abbrev_cache::get_unit (Dwarf_Die die)
 {
-  Dwarf *dw = dwarf_cu_getdwarf (die.cu);
-  auto it = m_cache.find (dw);
-  if (it == m_cache.end ())
+  std::lock_guard <std::mutex> lock {m_mutex};
+  auto it = m_units.find (die.cu);
+  if (it == m_units.end ())
+    it = m_units.insert (std::make_pair
+			 (die.cu, std::make_shared <unit_abbrevs> (die)))
+	   .first;
+  return it->second;
+}
+
+abbrev_cache::abbrev_info const &
+abbrev_cache::get (Dwarf_Die die)
+{
+  // Queries tend to look at many DIE's of one unit in a row.  Each
+  // thread remembers the unit that it looked at last, so that most
+  // lookups don't need to take the lock.
+  struct last_unit
+  {
+    uint64_t id;
+    Dwarf_CU *cu;
+    std::shared_ptr <unit_abbrevs const> unit;
+  };
+  static thread_local last_unit last {0, nullptr, nullptr};
+
+  if (last.id != m_id || last.cu != die.cu)
+    last = last_unit {m_id, die.cu, get_unit (die)};
+  return last.unit->find (die_abbrev_code (die));
+}
+
+void
+interval_list::add (Dwarf_Addr low, Dwarf_Addr high, uint64_t id)
+{
+  assert (m_max_high.empty ());
+  if (low < high)
+    m_intervals.push_back (interval {low, high, id});
+}
+
+void
+interval_list::seal ()
+{
+  std::sort (m_intervals.begin (), m_intervals.end (),
+	     [] (interval const &a, interval const &b)
+	     {
+	       return a.low < b.low;
+	     });
+
+  Dwarf_Addr max_high = 0;
+  m_max_high.reserve (m_intervals.size ());
+  for (auto const &iv: m_intervals)
+    {
+      max_high = std::max (max_high, iv.high);
+      m_max_high.push_back (max_high);
+    }
+}
+
+void
+interval_list::find (Dwarf_Addr low, Dwarf_Addr high,
+		     std::vector <uint64_t> &ret) const
+{
+  // Ranges from I on start at or past HIGH.
+  size_t i = std::lower_bound (m_intervals.begin (), m_intervals.end (),
+			       high,
+			       [] (interval const &iv, Dwarf_Addr addr)
+			       {
+				 return iv.low < addr;
+			       }) - m_intervals.begin ();
+
+  while (i-- > 0 && m_max_high[i] > low)
+    if (m_intervals[i].high > low)
+      ret.push_back (m_intervals[i].id);
+}
+
+namespace
+{
+  // Call CB with each range of DIE.
+  template <class F>
+  void
+  for_each_range (Dwarf_Die die, F cb)
+  {
+    Dwarf_Addr base, low, high;
+    for (ptrdiff_t off = 0;
+	 (off = dwarf_ranges (&die, off, &base, &low, &high)) != 0; )
+      if (off < 0)
+	throw_libdw ();
+      else
+	cb (low, high);
+  }
+}
+
+address_index::address_index (Dwarf *dw)
+  : m_has_partial {false}
+{
+  std::vector <Dwarf_Off> offsets;
+  for (auto it = cu_iterator {dw}; it != cu_iterator::end (); ++it)
     {
-      off_vect v;
-      for (auto jt = cu_iterator { dw }; jt != cu_iterator::end (); ++jt)
-	v.push_back (dwarf_dieoffset (*jt));
+      Dwarf_Die cudie = **it;
+      bool partial = dwarf_tag (&cudie) == DW_TAG_partial_unit;
+      m_has_partial = m_has_partial || partial;
+      offsets.push_back (dwarf_dieoffset (&cudie));
+      m_units.push_back (unit {cudie, partial, nullptr});
+    }
+
+  // A missing or unreadable .debug_aranges is not fatal, unit DIE's
+  // are consulted instead.
+  Dwarf_Aranges *aranges;
+  size_t naranges;
+  if (dwarf_getaranges (dw, &aranges, &naranges) != 0)
+    naranges = 0;
+
+  std::vector <bool> described (m_units.size (), false);
+  for (size_t i = 0; i < naranges; ++i)
+    {
+      Dwarf_Addr addr;
+      Dwarf_Word length;
+      Dwarf_Off cuoff;
+      if (dwarf_getarangeinfo (dwarf_onearange (aranges, i),
+			       &addr, &length, &cuoff) != 0)
+	throw_libdw ();
+
+      auto it = std::lower_bound (offsets.begin (), offsets.end (), cuoff);
+      if (it != offsets.end () && *it == cuoff)
+	{
+	  size_t u = it - offsets.begin ();
+	  m_unit_ranges.add (addr, addr + length, u);
+	  described[u] = true;
+	}
+    }
+
+  for (size_t u = 0; u < m_units.size (); ++u)
+    if (! described[u])
+      {
+	Dwarf_Die cudie = m_units[u].cudie;
+	if (! dwarf_hasattr (&cudie, DW_AT_ranges)
+	    && ! dwarf_hasattr (&cudie, DW_AT_high_pc))
+	  m_unplaced.push_back (u);
+	else
+	  for_each_range (cudie, [&] (Dwarf_Addr low, Dwarf_Addr high)
+			  {
+			    m_unit_ranges.add (low, high, u);
+			  });
+      }
+
+  m_unit_ranges.seal ();
+}
 
-      // Populate the cache for this Dwarf.
-      it = m_cache.insert (std::make_pair (dw, std::move (v))).first;
+std::unique_ptr <std::vector <interval_list> const>
+address_index::populate (Dwarf_Die cudie)
+{
+  auto levels = std::make_unique <std::vector <interval_list>> ();
+
+  // Walk the unit iteratively, as populate_unit does.
+  std::vector <Dwarf_Die> path;
+  Dwarf_Die die = cudie;
+  while (true)
+    {
+      size_t depth = path.size ();
+      Dwarf_Off off = dwarf_dieoffset (&die);
+      for_each_range (die, [&] (Dwarf_Addr low, Dwarf_Addr high)
+		      {
+			if (levels->size () <= depth)
+			  levels->resize (depth + 1);
+			(*levels)[depth].add (low, high, off);
+		      });
+
+      Dwarf_Die child;
+      if (dwpp_child (die, child))
+	{
+	  path.push_back (die);
+	  die = child;
+	  continue;
+	}
+
+      while (! path.empty ())
+	{
+	  int ret = dwarf_siblingof (&die, &die);
+	  if (ret < 0)
+	    throw_libdw ();
+	  if (ret == 0)
+	    break;
+
+	  die = path.back ();
+	  path.pop_back ();
+	}
+
+      if (path.empty ())
+	break;
+    }
+
+  for (auto &level: *levels)
+    level.seal ();
+
+  return std::move (levels);
+}
+
+std::vector <Dwarf_Off>
+address_index::find (Dwarf_Addr low, Dwarf_Addr high, bool partial)
+{
+  std::vector <uint64_t> units = m_unplaced;
+  m_unit_ranges.find (low, high, units);
+  std::sort (units.begin (), units.end ());
+  units.erase (std::unique (units.begin (), units.end ()), units.end ());
+
+  std::vector <Dwarf_Off> ret;
+  std::vector <uint64_t> offs;
+  for (uint64_t u: units)
+    {
+      if (m_units[u].partial && ! partial)
+	continue;
+
+      std::vector <interval_list> const *levels;
+      {
+	std::lock_guard <std::mutex> lock {m_mutex};
+	if (m_units[u].levels == nullptr)
+	  m_units[u].levels = populate (m_units[u].cudie);
+	levels = m_units[u].levels.get ();
+      }
+
+      for (size_t i = levels->size (); i-- > 0; )
+	{
+	  offs.clear ();
+	  (*levels)[i].find (low, high, offs);
+	  std::sort (offs.begin (), offs.end ());
+	  offs.erase (std::unique (offs.begin (), offs.end ()), offs.end ());
+	  ret.insert (ret.end (), offs.begin (), offs.end ());
+	}
     }
 
-  Dwarf_Off dieoff = dwarf_dieoffset (&die);
-  auto jt = std::lower_bound (it->second.begin (), it->second.end (), dieoff);
-  return jt != it->second.end () && *jt == dieoff;
+  return ret;
 }
@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 2014 Red Hat, Inc.
+   Copyright (C) 2014, 2015 Red Hat, Inc.
    This file is part of dwgrep.
 
    This file is free software; you can redistribute it and/or modify
@@ -29,39 +29,270 @@
 #ifndef _CACHE_H_
 #define _CACHE_H_
 
+#include <bitset>
+#include <cstdint>
+#include <functional>
+#include <list>
 #include <map>
-#include <unordered_set>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <elfutils/libdw.h>
 
+// Parents of DIE's of either one Dwarf, or one of its units.  The
+// index is laid out as two parallel arrays: offsets of all DIE's,
+// sorted, and for each DIE, position of its parent in the first
+// array.  A whole-Dwarf index is built for all units in one go.
+// Either kind is never modified after it's built, so any number of
+// threads can query it at once.
+class parent_index
+{
+  std::vector <Dwarf_Off> m_offsets;
+  std::vector <uint32_t> m_parents;
+
+  void build (Dwarf *dw, std::vector <Dwarf_Off> const &cus,
+	      std::string const &fn, unsigned nthreads);
+  size_t position (Dwarf_Off off) const;
+
+public:
+  static Dwarf_Off const no_off = (Dwarf_Off) -1;
+  static uint32_t const no_parent = (uint32_t) -1;
+
+  explicit parent_index (Dwarf *dw);
+  explicit parent_index (Dwarf_Die cudie);
+
+  // Build a whole-Dwarf index with units split among up to NTHREADS
+  // threads.  libdw can't be used concurrently over one Dwarf, so
+  // each of the extra threads opens FN, which DW was read from, with
+  // a handle of its own.  Slices that can't be done that way are
+  // done in the calling thread.
+  parent_index (Dwarf *dw, std::string const &fn, unsigned nthreads);
+
+  // Offset of parent of DIE at OFF, or no_off if that's a unit DIE.
+  Dwarf_Off find_parent (Dwarf_Off off) const;
+  bool is_root (Dwarf_Off off) const;
+
+  // Number of bytes that this index occupies.
+  size_t memory_size () const;
+};
+
+struct cache_stats
+{
+  uint64_t hits;	// Lookups answered from an existing entry.
+  uint64_t misses;	// Lookups that had to build an entry.
+  uint64_t evictions;	// Entries evicted to stay within budget.
+  uint64_t drops;	// Entries dropped in streaming mode.
+  size_t entries;	// Entries currently held.
+  size_t bytes;		// Bytes currently held.
+  size_t peak_bytes;	// Most bytes held at any one time.
+};
+
+// Parent indices of Dwarf's that have been asked about.  Indices
+// are built on first use.  The cache may be shared by several
+// threads.
+//
+// By default, one index covers a whole Dwarf and entries are kept
+// for as long as the cache lives.  When the cache is given a memory
+// budget, or is put to streaming mode, entries cover single units
+// instead.  With a budget, least recently used entries are evicted
+// whenever the cache holds more than that.  In streaming mode, when
+// a thread asks about a unit, entries that that thread created for
+// other units of the same Dwarf are dropped, on the assumption that
+// it's done with them.  Partial units are exempt from this, as they
+// tend to be imported from all over the place.
 class parent_cache
 {
-  using unit_cache_t = std::vector <std::pair <Dwarf_Off, Dwarf_Off>>;
-  using cache_t = std::map <std::pair <Dwarf *, Dwarf_Off>, unit_cache_t>;
+  typedef std::pair <Dwarf *, Dwarf_Off> key_type;
+
+  struct entry
+  {
+    key_type key;
+    std::shared_ptr <parent_index const> index;
+    size_t size;
+    std::thread::id owner;
+    bool partial;
+  };
+
+  std::mutex m_mutex;
+
+  // Most recently used entries come first.
+  std::list <entry> m_lru;
+  std::map <key_type, std::list <entry>::iterator> m_entries;
+
+  size_t m_budget;
+  bool m_streaming;
+  unsigned m_threads;
+  std::function <std::string (Dwarf *)> m_file_of;
+  cache_stats m_stats;
 
-  cache_t m_cache;
+  std::shared_ptr <parent_index const> get (Dwarf_Die die);
 
-  void recursively_populate_unit (unit_cache_t &uc, Dwarf_Die die,
-				  Dwarf_Off paroff);
-  unit_cache_t populate_unit (Dwarf_Die die);
+  // These must be called with m_mutex held.
+  void drop_passed (entry const &e);
+  void evict ();
+  void erase (std::list <entry>::iterator it);
 
 public:
-  static Dwarf_Off const no_off = (Dwarf_Off) -1;
+  static Dwarf_Off const no_off = parent_index::no_off;
+
+  parent_cache ();
+
+  // Keep the cache at roughly BUDGET bytes.  Zero means no limit.
+  void set_budget (size_t budget);
+  void set_streaming (bool streaming);
+  size_t get_budget ();
+  bool get_streaming ();
+
+  // Build whole-Dwarf indices in up to NTHREADS threads, opening for
+  // each the file that FILE_OF names for a given Dwarf, or an empty
+  // string if it doesn't know.  By default indices are built in the
+  // thread that asks about them.
+  void set_threads (unsigned nthreads,
+		    std::function <std::string (Dwarf *)> file_of);
+  cache_stats get_stats ();
+
   Dwarf_Off find (Dwarf_Die die);
+  bool is_root (Dwarf_Die die);
 };
 
-class root_cache
+// Summaries of abbreviations, kept for each unit separately.  All
+// DIE's that use a given abbreviation have the same tag, the same
+// set of attributes, and either all do or all don't have children.
+// Looking that up in a summary is cheaper than having libdw decode
+// the abbreviation each time.  The cache may be shared by several
+// threads.
+class abbrev_cache
 {
-  using off_vect = std::vector <Dwarf_Off>;
-  using cache_t = std::map <Dwarf *, off_vect>;
+public:
+  class abbrev_info
+  {
+    friend class abbrev_cache;
+
+    // Attribute codes from the standard range are kept in a bitset,
+    // the rest in a sorted vector.
+    static unsigned const max_std_at = 256;
+    std::bitset <max_std_at> m_attrs;
+    std::vector <unsigned> m_user_attrs;
+    unsigned m_code;
+    unsigned m_tag;
+    bool m_has_children;
+
+  public:
+    abbrev_info ()
+      : m_code {0}
+      , m_tag {0}
+      , m_has_children {false}
+    {}
+
+    bool has_attr (unsigned atname) const;
+    unsigned tag () const { return m_tag; }
+    bool has_children () const { return m_has_children; }
+  };
+
+  abbrev_cache ();
+
+  // Return a summary of the abbreviation that DIE uses.
+  abbrev_info const &get (Dwarf_Die die);
+
+private:
+  struct unit_abbrevs
+  {
+    // Sorted by code.  If DENSE, element I has code I + 1, which is
+    // the usual case.
+    std::vector <abbrev_info> infos;
+    bool dense;
+
+    explicit unit_abbrevs (Dwarf_Die die);
+    abbrev_info const &find (uint64_t code) const;
+  };
+
+  uint64_t m_id;
+  std::mutex m_mutex;
+  std::map <Dwarf_CU *, std::shared_ptr <unit_abbrevs const>> m_units;
+
+  static abbrev_info summarize (Dwarf_Abbrev &abbrev);
+  std::shared_ptr <unit_abbrevs const> get_unit (Dwarf_Die die);
+};
+
+// Address ranges, each tagged with an ID, sorted by their low ends.
+// Alongside, the highest high end among each prefix of the list is
+// kept, so that search for ranges that overlap a given one can stop
+// as soon as no earlier range reaches far enough.  This works best
+// for ranges that are mostly disjoint, such as those of DIE's at one
+// depth of the DIE tree.
+class interval_list
+{
+  struct interval
+  {
+    Dwarf_Addr low;
+    Dwarf_Addr high;
+    uint64_t id;
+  };
 
-  cache_t m_cache;
+  std::vector <interval> m_intervals;
+  std::vector <Dwarf_Addr> m_max_high;
 
 public:
-  bool is_root (Dwarf_Die die);
+  // Ranges can only be added before the list is sealed, and looked
+  // up only after that.  Empty ranges are ignored.
+  void add (Dwarf_Addr low, Dwarf_Addr high, uint64_t id);
+  void seal ();
+
+  // Append to RET ID's of ranges that overlap [LOW, HIGH).  An ID
+  // is appended once for each such range.
+  void find (Dwarf_Addr low, Dwarf_Addr high,
+	     std::vector <uint64_t> &ret) const;
 };
 
+// DIE's of one Dwarf that have addresses, looked up by address.
+// Units are first selected by .debug_aranges, or by ranges of the
+// unit DIE for units that .debug_aranges doesn't describe.  Units
+// with neither are considered for any address.  DIE's of a unit
+// are only walked when a lookup first selects that unit, and their
+// ranges are then kept in one interval_list for each depth.  The
+// index may be shared by several threads.
+//
+// The unit-level information is trusted to cover addresses of all
+// DIE's in the unit.  Users that need exact answers should check
+// candidates against dwarf_ranges.
+class address_index
+{
+  struct unit
+  {
+    Dwarf_Die cudie;
+    bool partial;
+    std::unique_ptr <std::vector <interval_list> const> levels;
+  };
+
+  std::mutex m_mutex;
+  std::vector <unit> m_units;
+
+  // Ranges of units, ID's are positions in M_UNITS.  Units that have
+  // no known ranges are listed in M_UNPLACED.
+  interval_list m_unit_ranges;
+  std::vector <uint64_t> m_unplaced;
+  bool m_has_partial;
+
+  static std::unique_ptr <std::vector <interval_list> const>
+  populate (Dwarf_Die cudie);
+
+public:
+  explicit address_index (Dwarf *dw);
+
+  bool has_partial_units () const
+  { return m_has_partial; }
+
+  // Offsets of DIE's that have ranges which overlap [LOW, HIGH).
+  // Units are in the order of their offsets, and within a unit,
+  // deeper DIE's come first, DIE's of one depth in the order of
+  // their offsets.  Thus for a single address, each unit yields
+  // the chain of DIE's that cover it innermost-first.  DIE's of
+  // partial units are only included if PARTIAL.
+  std::vector <Dwarf_Off> find (Dwarf_Addr low, Dwarf_Addr high,
+				bool partial);
+};
 
 #endif /* _CACHE_H_ */
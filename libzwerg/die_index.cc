@@ -0,0 +1,258 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "die_index.hh"
+#include "dwit.hh"
+
+namespace
+{
+  char const magic[8] = {'Z', 'W', 'D', 'I', 'D', 'X', '\0', '\0'};
+  uint32_t const format_version = 1;
+  size_t const max_build_id = 64;
+
+  struct header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t build_id_len;
+    unsigned char build_id[max_build_id];
+    uint64_t nrecords;
+    uint64_t strtab_size;
+  };
+
+  std::string
+  index_file_name (std::string const &dir,
+		   std::vector <unsigned char> const &build_id)
+  {
+    std::string ret = dir + "/";
+    for (unsigned char c: build_id)
+      {
+	char buf[3];
+	std::snprintf (buf, sizeof buf, "%02x", c);
+	ret += buf;
+      }
+    return ret + ".zwidx";
+  }
+
+  bool
+  write_all (int fd, void const *buf, size_t size)
+  {
+    char const *ptr = static_cast <char const *> (buf);
+    while (size > 0)
+      {
+	ssize_t ret = write (fd, ptr, size);
+	if (ret < 0)
+	  return false;
+	ptr += ret;
+	size -= ret;
+      }
+    return true;
+  }
+}
+
+die_index::die_index (void *map, size_t size)
+  : m_map {map}
+  , m_size {size}
+{
+  auto hdr = static_cast <header const *> (m_map);
+  m_nrecords = hdr->nrecords;
+  m_strtab_size = hdr->strtab_size;
+  m_records = reinterpret_cast <record const *> (hdr + 1);
+  m_strtab = reinterpret_cast <char const *> (m_records + m_nrecords);
+}
+
+die_index::~die_index ()
+{
+  munmap (m_map, m_size);
+}
+
+std::unique_ptr <die_index>
+die_index::load (std::string const &fn,
+		 std::vector <unsigned char> const &build_id)
+{
+  int fd = ::open (fn.c_str (), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && (size_t) st.st_size >= sizeof (header))
+    map = mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  size_t size = st.st_size;
+  auto hdr = static_cast <header const *> (map);
+  if (std::memcmp (hdr->magic, magic, sizeof magic) != 0
+      || hdr->version != format_version
+      || hdr->build_id_len != build_id.size ()
+      || std::memcmp (hdr->build_id, build_id.data (), build_id.size ()) != 0
+      || hdr->nrecords > (size - sizeof (header)) / sizeof (record)
+      || (sizeof (header) + hdr->nrecords * sizeof (record)
+	  + hdr->strtab_size) != size)
+    {
+      munmap (map, size);
+      return nullptr;
+    }
+
+  return std::unique_ptr <die_index> (new die_index (map, size));
+}
+
+bool
+die_index::build (std::string const &fn, Dwarf *dw,
+		  std::vector <unsigned char> const &build_id)
+{
+  std::vector <record> records;
+  std::string strtab;
+  std::map <std::string, uint32_t> strings;
+
+  for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+    {
+      Dwarf_Die *die = *it;
+      record rec = {};
+      rec.offset = dwarf_dieoffset (die);
+      rec.parent = it.parent_offset ();
+      rec.tag = dwarf_tag (die);
+      rec.has_children = dwarf_haschildren (die) > 0;
+      rec.name = no_name;
+
+      if (char const *name = dwarf_diename (die))
+	{
+	  auto jt = strings.find (name);
+	  if (jt == strings.end ())
+	    {
+	      jt = strings.insert (std::make_pair (name, strtab.size ())).first;
+	      strtab.append (name, std::strlen (name) + 1);
+	    }
+	  rec.name = jt->second;
+	}
+
+      records.push_back (rec);
+    }
+
+  // DIE's are laid out in pre-order, so the records come out sorted.
+  assert (std::is_sorted (records.begin (), records.end (),
+			  [] (record const &a, record const &b)
+			  {
+			    return a.offset < b.offset;
+			  }));
+
+  header hdr = {};
+  std::memcpy (hdr.magic, magic, sizeof magic);
+  hdr.version = format_version;
+  hdr.build_id_len = build_id.size ();
+  std::copy (build_id.begin (), build_id.end (), hdr.build_id);
+  hdr.nrecords = records.size ();
+  hdr.strtab_size = strtab.size ();
+
+  // Write to a temporary file first, and rename it when complete, so
+  // that concurrent readers never see a half-written index.
+  std::string tmp = fn + ".XXXXXX";
+  int fd = mkstemp (&tmp[0]);
+  if (fd < 0)
+    return false;
+
+  bool ok = write_all (fd, &hdr, sizeof hdr)
+    && write_all (fd, records.data (), records.size () * sizeof (record))
+    && write_all (fd, strtab.data (), strtab.size ());
+  ok = close (fd) == 0 && ok;
+
+  if (! ok || rename (tmp.c_str (), fn.c_str ()) != 0)
+    {
+      unlink (tmp.c_str ());
+      return false;
+    }
+
+  return true;
+}
+
+std::unique_ptr <die_index>
+die_index::open (std::string const &dir, Dwarf *dw,
+		 std::vector <unsigned char> const &build_id)
+{
+  if (build_id.empty () || build_id.size () > max_build_id)
+    return nullptr;
+
+  std::string fn = index_file_name (dir, build_id);
+  if (auto ret = load (fn, build_id))
+    return ret;
+
+  if (! build (fn, dw, build_id))
+    return nullptr;
+
+  return load (fn, build_id);
+}
+
+die_index::record const *
+die_index::find (Dwarf_Off off) const
+{
+  auto it = std::lower_bound (begin (), end (), off,
+			      [] (record const &rec, Dwarf_Off o)
+			      {
+				return rec.offset < o;
+			      });
+  if (it == end () || it->offset != off)
+    return nullptr;
+  return it;
+}
+
+char const *
+die_index::name (record const &rec) const
+{
+  if (rec.name == no_name || rec.name >= m_strtab_size)
+    return nullptr;
+  return m_strtab + rec.name;
+}
+
+uint32_t
+die_index::find_name (char const *name) const
+{
+  // Each name is stored in the string table only once.
+  size_t len = std::strlen (name);
+  for (size_t off = 0; off < m_strtab_size; )
+    {
+      char const *str = m_strtab + off;
+      size_t slen = strnlen (str, m_strtab_size - off);
+      if (slen == len && std::memcmp (str, name, len) == 0)
+	return off;
+      off += slen + 1;
+    }
+  return no_name;
+}
@@ -0,0 +1,109 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _DIE_INDEX_H_
+#define _DIE_INDEX_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <elfutils/libdw.h>
+
+// A persistent index of all DIE's of one Dwarf.  The index is stored
+// in a cache directory in a file named after the build ID of the
+// module that the Dwarf comes from, and is mapped to memory when
+// used.  For each DIE, it records its offset, tag, offset of its
+// parent, offset of its name in the index string table, and whether
+// the DIE has children.  Records are sorted by DIE offset.
+//
+// The index is built the first time it's requested for a given
+// build ID.  An index whose header doesn't match the build ID, or
+// that is otherwise damaged, is considered stale and rebuilt.
+class die_index
+{
+public:
+  struct record
+  {
+    uint64_t offset;
+    uint64_t parent;
+    uint32_t name;
+    uint16_t tag;
+    uint8_t has_children;
+    uint8_t reserved;
+  };
+
+  static Dwarf_Off const no_off = (Dwarf_Off) -1;
+  static uint32_t const no_name = (uint32_t) -1;
+
+  ~die_index ();
+
+  // Open an index of DW in directory DIR, building it first if
+  // necessary.  BUILD_ID is the build ID of the module that DW comes
+  // from.  Returns nullptr if there's no usable index and one can't
+  // be written either.
+  static std::unique_ptr <die_index>
+  open (std::string const &dir, Dwarf *dw,
+	std::vector <unsigned char> const &build_id);
+
+  record const *begin () const { return m_records; }
+  record const *end () const { return m_records + m_nrecords; }
+  size_t size () const { return m_nrecords; }
+
+  // Find a record for a DIE at offset OFF.  Returns nullptr if there
+  // is no such DIE in the index.
+  record const *find (Dwarf_Off off) const;
+
+  // Returns name of a DIE described by REC, or nullptr if it has
+  // none.
+  char const *name (record const &rec) const;
+
+  // Returns the value that the name field has in records of DIE's
+  // called NAME, or no_name if there are no such DIE's.
+  uint32_t find_name (char const *name) const;
+
+private:
+  void *m_map;
+  size_t m_size;
+  record const *m_records;
+  size_t m_nrecords;
+  char const *m_strtab;
+  size_t m_strtab_size;
+
+  die_index (void *map, size_t size);
+
+  static std::unique_ptr <die_index>
+  load (std::string const &fn, std::vector <unsigned char> const &build_id);
+
+  static bool
+  build (std::string const &fn, Dwarf *dw,
+	 std::vector <unsigned char> const &build_id);
+};
+
+#endif /* _DIE_INDEX_H_ */
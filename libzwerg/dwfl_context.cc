@@ -26,31 +26,182 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <atomic>
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include "std-memory.hh"
 #include "dwfl_context.hh"
-#include "cache.hh"
+#include "die_index.hh"
 #include "dwit.hh"
 
 struct dwfl_context::pimpl
 {
+  // The caches are populated lazily, and one context may be shared
+  // by several threads when units are evaluated in parallel.
+  // m_mutex guards the maps of DIE and address indices.  The parent
+  // and abbreviation caches, as well as the address indices
+  // themselves, have locks of their own.
+  std::mutex m_mutex;
+  Dwfl *m_dwfl;
   parent_cache m_parcache;
-  root_cache m_rootcache;
+  abbrev_cache m_abbrevcache;
+
+  std::string m_index_dir;
+  std::map <Dwarf *, std::unique_ptr <die_index>> m_indices;
+  std::map <Dwarf *, std::unique_ptr <address_index>> m_addr_indices;
+
+  // Import chains.  Each link is the imported_unit DIE and the ID of
+  // the rest of the chain.  Link 0 stands for no_import.  Links are
+  // looked up by the rest of the chain and address of the DIE.
+  //
+  // Links are walked whenever a cooked DIE looks at its parent, and
+  // are never changed once made, so they are read without locking.
+  // They are kept in segments that never move: segment K holds
+  // import_seg_size << K links, and is published only after it's set
+  // up.  M_IMPORT_MUTEX serializes making new links.
+  typedef std::pair <Dwarf_Die, import_id> import_link;
+  static size_t const import_seg_size = 64;
+  static size_t const import_nsegs = 32;
+  std::atomic <import_link *> m_import_segs[import_nsegs];
+
+  std::mutex m_import_mutex;
+  size_t m_nimports;
+  std::map <std::pair <import_id, void *>, import_id> m_import_ids;
+
+  explicit pimpl (Dwfl *dwfl)
+    : m_dwfl {dwfl}
+    , m_nimports {1}
+  {
+    for (auto &seg: m_import_segs)
+      seg.store (nullptr, std::memory_order_relaxed);
+  }
+
+  ~pimpl ()
+  {
+    for (auto &seg: m_import_segs)
+      delete[] seg.load (std::memory_order_relaxed);
+  }
+
+  // The link of ID.  If CREATE, the segment that it falls into is
+  // allocated if needed, which must be done with M_IMPORT_MUTEX held.
+  import_link &
+  import_slot (import_id id, bool create = false)
+  {
+    size_t i = id / import_seg_size + 1;
+    size_t k = 0;
+    while (i >> (k + 1) != 0)
+      ++k;
+    assert (k < import_nsegs);
+
+    import_link *seg = m_import_segs[k].load (std::memory_order_acquire);
+    if (seg == nullptr)
+      {
+	assert (create);
+	seg = new import_link[import_seg_size << k];
+	m_import_segs[k].store (seg, std::memory_order_release);
+      }
+
+    return seg[id - ((size_t (1) << k) - 1) * import_seg_size];
+  }
+
+  // Open the index of DW in DIR, building it if it's not there yet.
+  // Returns nullptr if DW has no build ID or the index can't be had.
+  std::unique_ptr <die_index>
+  open_index (std::string const &dir, Dwarf *dw)
+  {
+    for (auto it = dwfl_module_iterator {m_dwfl};
+	 it != dwfl_module_iterator::end (); ++it)
+      if ((*it).dwarf () == dw)
+	{
+	  const unsigned char *bits;
+	  GElf_Addr vaddr;
+	  int len = dwfl_module_build_id (*it, &bits, &vaddr);
+	  if (len > 0)
+	    return die_index::open (dir, dw,
+				    std::vector <unsigned char> (bits,
+								 bits + len));
+	  break;
+	}
+    return nullptr;
+  }
+
+  die_index const *
+  get_index (Dwarf *dw)
+  {
+    std::string dir;
+    {
+      std::lock_guard <std::mutex> lock {m_mutex};
+      if (m_index_dir.empty ())
+	return nullptr;
+
+      auto it = m_indices.find (dw);
+      if (it != m_indices.end ())
+	return it->second.get ();
+
+      dir = m_index_dir;
+    }
+
+    // Building an index walks all DIEs and writes a file.  Do that
+    // without holding the lock, so that threads working on other
+    // files aren't held up.  Two threads may end up building the
+    // same index, in which case the first one to insert it wins.
+    auto idx = open_index (dir, dw);
+
+    std::lock_guard <std::mutex> lock {m_mutex};
+    // The index directory was changed in the meantime.
+    if (m_index_dir != dir)
+      return nullptr;
+
+    // Remember failures as well, so that we don't retry each time.
+    return m_indices.insert (std::make_pair (dw, std::move (idx)))
+      .first->second.get ();
+  }
+
+  // Name of the file that DW was read from, or an empty string if
+  // DW is not of any module of this context.
+  std::string
+  file_of (Dwarf *dw)
+  {
+    for (auto it = dwfl_module_iterator {m_dwfl};
+	 it != dwfl_module_iterator::end (); ++it)
+      if ((*it).dwarf () == dw)
+	{
+	  char const *mainfile, *debugfile;
+	  dwfl_module_info (*it, nullptr, nullptr, nullptr, nullptr,
+			    nullptr, &mainfile, &debugfile);
+	  if (debugfile != nullptr)
+	    return debugfile;
+	  if (mainfile != nullptr)
+	    return mainfile;
+	  break;
+	}
+    return "";
+  }
 
   Dwarf_Off
   find_parent (Dwarf_Die die)
   {
+    if (auto idx = get_index (dwarf_cu_getdwarf (die.cu)))
+      if (auto rec = idx->find (dwarf_dieoffset (&die)))
+	return rec->parent;
     return m_parcache.find (die);
   }
 
   bool
   is_root (Dwarf_Die die)
   {
-    return m_rootcache.is_root (die);
+    if (auto idx = get_index (dwarf_cu_getdwarf (die.cu)))
+      if (auto rec = idx->find (dwarf_dieoffset (&die)))
+	return rec->parent == die_index::no_off;
+    return m_parcache.is_root (die);
   }
 };
 
 dwfl_context::dwfl_context (std::shared_ptr <Dwfl> dwfl)
-  : m_pimpl {std::make_unique <pimpl> ()}
+  : m_pimpl {std::make_unique <pimpl> (dwfl.get ())}
   , m_dwfl {dwfl}
 {}
 
@@ -69,6 +220,107 @@ dwfl_context::is_root (Dwarf_Die die)
   return m_pimpl->is_root (die);
 }
 
+void
+dwfl_context::set_index_dir (std::string const &dir)
+{
+  std::lock_guard <std::mutex> lock {m_pimpl->m_mutex};
+  m_pimpl->m_index_dir = dir;
+  m_pimpl->m_indices.clear ();
+}
+
+die_index const *
+dwfl_context::get_index (Dwarf *dw)
+{
+  return m_pimpl->get_index (dw);
+}
+
+void
+dwfl_context::set_cache_budget (size_t budget)
+{
+  m_pimpl->m_parcache.set_budget (budget);
+}
+
+void
+dwfl_context::set_cache_streaming (bool streaming)
+{
+  m_pimpl->m_parcache.set_streaming (streaming);
+}
+
+void
+dwfl_context::set_threads (unsigned nthreads)
+{
+  pimpl *p = m_pimpl.get ();
+  m_pimpl->m_parcache.set_threads (nthreads, [p] (Dwarf *dw)
+				   {
+				     return p->file_of (dw);
+				   });
+}
+
+cache_stats
+dwfl_context::get_cache_stats ()
+{
+  return m_pimpl->m_parcache.get_stats ();
+}
+
+abbrev_cache::abbrev_info const &
+dwfl_context::get_abbrev (Dwarf_Die die)
+{
+  return m_pimpl->m_abbrevcache.get (die);
+}
+
+void
+dwfl_context::copy_settings (dwfl_context &that)
+{
+  std::string dir;
+  {
+    std::lock_guard <std::mutex> lock {that.m_pimpl->m_mutex};
+    dir = that.m_pimpl->m_index_dir;
+  }
+
+  set_index_dir (dir);
+  set_cache_budget (that.m_pimpl->m_parcache.get_budget ());
+  set_cache_streaming (that.m_pimpl->m_parcache.get_streaming ());
+}
+
+address_index &
+dwfl_context::get_address_index (Dwarf *dw)
+{
+  std::lock_guard <std::mutex> lock {m_pimpl->m_mutex};
+  auto &idx = m_pimpl->m_addr_indices[dw];
+  if (idx == nullptr)
+    idx = std::make_unique <address_index> (dw);
+  return *idx;
+}
+
+import_id
+dwfl_context::intern_import (import_id parent, Dwarf_Die die)
+{
+  std::lock_guard <std::mutex> lock {m_pimpl->m_import_mutex};
+  auto key = std::make_pair (parent, die.addr);
+  auto it = m_pimpl->m_import_ids.find (key);
+  if (it != m_pimpl->m_import_ids.end ())
+    return it->second;
+
+  import_id id = m_pimpl->m_nimports++;
+  m_pimpl->import_slot (id, true) = std::make_pair (die, parent);
+  m_pimpl->m_import_ids.insert (std::make_pair (key, id));
+  return id;
+}
+
+Dwarf_Die
+dwfl_context::import_die (import_id id)
+{
+  assert (id != no_import);
+  return m_pimpl->import_slot (id).first;
+}
+
+import_id
+dwfl_context::import_parent (import_id id)
+{
+  assert (id != no_import);
+  return m_pimpl->import_slot (id).second;
+}
+
 int
 dwfl_context::get_machine () const
 {
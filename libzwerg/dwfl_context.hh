@@ -29,11 +29,24 @@
 #ifndef _DWFL_CONTEXT_H_
 #define _DWFL_CONTEXT_H_
 
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <elfutils/libdwfl.h>
 
+#include "cache.hh"
+
+class die_index;
+
+// Chains of DW_TAG_imported_unit DIE's that cooked DIE's went through
+// (see value_die) are interned in the context that the DIE's come
+// from, and referred to by ID's.  Equal chains have equal ID's.
+typedef uint32_t import_id;
+const import_id no_import = 0;
+
 // This represents a Dwfl handle together with some query caches.
 class dwfl_context
+  : public std::enable_shared_from_this <dwfl_context>
 {
   class pimpl;
   std::unique_ptr <pimpl> m_pimpl;
@@ -49,6 +62,43 @@ public:
   Dwarf_Off find_parent (Dwarf_Die die);
   bool is_root (Dwarf_Die die);
   int get_machine () const;
+
+  // Keep persistent DIE indices (see die_index.hh) in directory DIR.
+  // Indices are only used for modules that have a build ID.  This
+  // should be called before the context is first queried.
+  void set_index_dir (std::string const &dir);
+
+  // Return an index of DW, or nullptr if there's none.
+  die_index const *get_index (Dwarf *dw);
+
+  // Limits of the in-memory caches, see parent_cache for details.
+  // A BUDGET of zero means no limit.
+  void set_cache_budget (size_t budget);
+  void set_cache_streaming (bool streaming);
+  cache_stats get_cache_stats ();
+
+  // Let the in-memory caches be built by up to NTHREADS threads.
+  // One, the default, means they are built serially.
+  void set_threads (unsigned nthreads);
+
+  // Address index of DW, built on first use.
+  address_index &get_address_index (Dwarf *dw);
+
+  // Use the same index directory and cache limits as THAT.  The
+  // number of threads is not copied.
+  void copy_settings (dwfl_context &that);
+
+  // Summary of the abbreviation that DIE uses.
+  abbrev_cache::abbrev_info const &get_abbrev (Dwarf_Die die);
+
+  // Return ID of the import chain that starts at DIE, which is a
+  // DW_TAG_imported_unit DIE, and continues with the chain PARENT.
+  import_id intern_import (import_id parent, Dwarf_Die die);
+
+  // The DIE at the start of import chain ID, and ID of the rest of
+  // the chain.  ID shall not be no_import.
+  Dwarf_Die import_die (import_id id);
+  import_id import_parent (import_id id);
 };
 
 #endif /* _DWFL_CONTEXT_H_ */
@@ -319,6 +319,12 @@ all_dies_iterator::operator++ ()
       return *this;
     }
 
+  return skip_children ();
+}
+
+all_dies_iterator
+all_dies_iterator::skip_children ()
+{
   do
     switch (dwarf_siblingof (&m_die, &m_die))
       {
@@ -380,6 +386,15 @@ all_dies_iterator::parent () const
   return ret;
 }
 
+Dwarf_Off
+all_dies_iterator::parent_offset () const
+{
+  assert (*this != end ());
+  if (m_stack.empty ())
+    return (Dwarf_Off) -1;
+  return m_stack.back ();
+}
+
 cu_iterator
 all_dies_iterator::cu () const
 {
@@ -172,10 +172,18 @@ public:
   all_dies_iterator operator++ ();
   all_dies_iterator operator++ (int);
 
+  // Like operator++, but doesn't descend to children of the current
+  // DIE.  libdw uses DW_AT_sibling, where present, to jump over the
+  // whole subtree.
+  all_dies_iterator skip_children ();
+
   Dwarf_Die *operator* ();
 
   std::vector<Dwarf_Die> stack () const;
   all_dies_iterator parent () const;
+
+  // Offset of the parent DIE, or (Dwarf_Off)-1 for a CU DIE.
+  Dwarf_Off parent_offset () const;
   cu_iterator cu () const;
 };
 
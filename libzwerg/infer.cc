@@ -0,0 +1,508 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <algorithm>
+
+#include "infer.hh"
+#include "tree.hh"
+#include "value-cst.hh"
+#include "value-seq.hh"
+#include "value-str.hh"
+#include "value-closure.hh"
+
+stack_shape::stack_shape (stack const &stk)
+  : m_exact {true}
+  , m_sealed {false}
+  , m_underrun {false}
+{
+  for (size_t i = stk.size (); i > 0; --i)
+    m_types.push_back (stk.get (i - 1).get_type ());
+}
+
+stack_shape
+stack_shape::make_sealed (size_t n)
+{
+  stack_shape ret;
+  ret.m_sealed = true;
+  ret.m_types.resize (n, value_type {0});
+  return ret;
+}
+
+value_type
+stack_shape::get (size_t depth) const
+{
+  if (depth >= m_types.size ())
+    return value_type {0};
+  return *(m_types.rbegin () + depth);
+}
+
+void
+stack_shape::push (value_type vt)
+{
+  // value::vtype is what's declared by overloads that can yield
+  // values of any type.
+  if (vt == value::vtype)
+    vt = value_type {0};
+  m_types.push_back (vt);
+}
+
+void
+stack_shape::need (size_t n)
+{
+  if ((m_exact || m_sealed) && n > m_types.size ())
+    m_underrun = true;
+}
+
+void
+stack_shape::pop (size_t n)
+{
+  need (n);
+  m_types.resize (m_types.size () > n ? m_types.size () - n : 0,
+		  value_type {0});
+}
+
+stack_shape::match
+stack_shape::matches (std::vector <value_type> const &types) const
+{
+  match ret = match::yes;
+  size_t depth = 0;
+  for (auto it = types.rbegin (); it != types.rend (); ++it, ++depth)
+    {
+      // A slot that's not on an exact stack doesn't match anything.
+      if (m_exact && depth >= m_types.size ())
+	return match::no;
+
+      value_type vt = get (depth);
+      if (vt.code () == 0)
+	ret = match::maybe;
+      else if (vt != *it)
+	return match::no;
+    }
+  return ret;
+}
+
+void
+stack_shape::apply (builtin_protomap const &pm)
+{
+  // Like overload dispatch, consider prototypes in order, the first
+  // one that matches wins.  Collect all that might match up to the
+  // first that surely does.
+  bool have = false;
+  size_t arity = -1;
+  stack_shape ret;
+  for (auto const &proto: pm)
+    {
+      arity = std::min (arity, std::get <0> (proto).size ());
+      auto m = matches (std::get <0> (proto));
+      if (m == match::no)
+	continue;
+
+      // Predicates don't pop their arguments, but they need them.
+      stack_shape shape = *this;
+      shape.need (std::get <0> (proto).size ());
+      if (std::get <1> (proto) != yield::pred)
+	{
+	  shape.pop (std::get <0> (proto).size ());
+	  for (auto const &vt: std::get <2> (proto))
+	    shape.push (vt);
+	}
+
+      ret = have ? merge (ret, shape) : shape;
+      have = true;
+
+      if (m == match::yes)
+	break;
+    }
+
+  if (have)
+    *this = ret;
+  else
+    {
+      // Nothing matches.  If that's because there are too few values
+      // on the stack, that's an underrun.
+      if (! pm.empty ())
+	need (arity);
+      forget ();
+    }
+}
+
+stack_shape
+stack_shape::merge (stack_shape const &a, stack_shape const &b)
+{
+  stack_shape ret;
+  size_t n = std::min (a.m_types.size (), b.m_types.size ());
+  for (size_t i = n; i > 0; --i)
+    {
+      value_type va = a.get (i - 1);
+      value_type vb = b.get (i - 1);
+      ret.push (va == vb ? va : value_type {0});
+    }
+  ret.m_exact = a.m_exact && b.m_exact
+    && a.m_types.size () == b.m_types.size ();
+  ret.m_sealed = a.m_sealed && b.m_sealed;
+  ret.m_underrun = a.m_underrun || b.m_underrun;
+  return ret;
+}
+
+bool
+stack_shape::operator== (stack_shape const &that) const
+{
+  return m_types.size () == that.m_types.size ()
+    && m_exact == that.m_exact
+    && m_sealed == that.m_sealed
+    && std::equal (m_types.begin (), m_types.end (), that.m_types.begin ());
+}
+
+namespace
+{
+  struct infer_ctx
+  {
+    // Whether overloaded words should be pegged.  See
+    // tree::peg_overloads.
+    bool m_peg;
+
+    // In probe mode, underruns are not thrown, but clear M_CONFINED.
+    // M_CONFINED is also cleared when a sealed shape is lost track
+    // of.  See tree::invariant.
+    bool m_probe;
+    bool m_confined;
+  };
+
+  stack_shape infer (tree &t, stack_shape shape, infer_ctx &ctx);
+
+  // Throw if SHAPE ran out of values while T was evaluated.
+  void
+  check_underrun (stack_shape const &shape, tree const &t, infer_ctx &ctx)
+  {
+    if (! shape.underrun ())
+      return;
+    if (ctx.m_probe)
+      {
+	ctx.m_confined = false;
+	return;
+      }
+    if (t.tt () == tree_type::F_BUILTIN)
+      throw std::runtime_error (std::string ("stack underrun in `")
+				+ t.m_builtin->name () + "'");
+    throw std::runtime_error ("stack underrun");
+  }
+
+  // Predicates leave the stack alone, so their stack effect tells
+  // nothing about what values they look at.  Only go by prototypes,
+  // predicates without them might look at anything.
+  void
+  probe_pred (builtin const &b, stack_shape const &shape, infer_ctx &ctx)
+  {
+    stack_shape s = shape;
+    s.apply (b.protomap ());
+    if (s.underrun () || (shape.sealed () && ! s.sealed ()))
+      ctx.m_confined = false;
+  }
+
+  void
+  infer_pred (tree &t, stack_shape const &shape, infer_ctx &ctx)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::PRED_NOT:
+	infer_pred (t.child (0), shape, ctx);
+	return;
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+	infer_pred (t.child (0), shape, ctx);
+	infer_pred (t.child (1), shape, ctx);
+	return;
+
+      case tree_type::PRED_SUBX_ANY:
+	infer (t.child (0), shape, ctx);
+	return;
+
+      case tree_type::PRED_SUBX_CMP:
+	{
+	  // The comparison predicate sees the stack that the first
+	  // expression produced, with TOS of the second one pushed on
+	  // top.
+	  stack_shape a = infer (t.child (0), shape, ctx);
+	  stack_shape b = infer (t.child (1), shape, ctx);
+	  b.need (1);
+	  check_underrun (b, t, ctx);
+	  a.push (b.get (0));
+	  infer_pred (t.child (2), a, ctx);
+	  return;
+	}
+
+      case tree_type::F_BUILTIN:
+	if (ctx.m_peg)
+	  if (auto b = t.m_builtin->peg (shape))
+	    t.m_builtin = b;
+	if (ctx.m_probe)
+	  probe_pred (*t.m_builtin, shape, ctx);
+	return;
+
+      default:
+	return;
+      }
+  }
+
+  // Find a shape that describes SHAPE as well as all shapes that
+  // repeated application of T to SHAPE can produce.
+  stack_shape
+  closure_fixpoint (tree &t, stack_shape shape, infer_ctx &ctx)
+  {
+    infer_ctx sub = ctx;
+    sub.m_peg = false;
+    while (true)
+      {
+	stack_shape next = stack_shape::merge (shape, infer (t, shape, sub));
+	if (next == shape)
+	  {
+	    ctx.m_confined = ctx.m_confined && sub.m_confined;
+	    return shape;
+	  }
+	shape = next;
+      }
+  }
+
+  stack_shape
+  infer_1 (tree &t, stack_shape shape, infer_ctx &ctx)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::CAT:
+	for (auto &child: t.m_children)
+	  shape = infer (child, shape, ctx);
+	return shape;
+
+      case tree_type::ALT:
+      case tree_type::OR:
+	{
+	  stack_shape ret = infer (t.child (0), shape, ctx);
+	  for (size_t i = 1; i < t.m_children.size (); ++i)
+	    ret = stack_shape::merge (ret, infer (t.child (i), shape, ctx));
+	  return ret;
+	}
+
+      case tree_type::CAPTURE:
+	infer (t.child (0), shape, ctx);
+	shape.push (value_seq::vtype);
+	return shape;
+
+      case tree_type::COUNT:
+	infer (t.child (0), shape, ctx);
+	shape.push (value_cst::vtype);
+	return shape;
+
+      case tree_type::SUBX_EVAL:
+	{
+	  stack_shape sub = infer (t.child (0), shape, ctx);
+	  size_t keep = t.cst ().value ().uval ();
+	  sub.need (keep);
+	  check_underrun (sub, t, ctx);
+	  for (size_t i = keep; i > 0; --i)
+	    shape.push (sub.get (i - 1));
+	  return shape;
+	}
+
+      case tree_type::IFELSE:
+	infer (t.child (0), shape, ctx);
+	return stack_shape::merge (infer (t.child (1), shape, ctx),
+				   infer (t.child (2), shape, ctx));
+
+      case tree_type::SCOPE:
+	return infer (t.child (0), shape, ctx);
+
+      case tree_type::BLOCK:
+	// Nothing is known about the stack that the closure will be
+	// applied to.
+	infer (t.child (0), stack_shape {}, ctx);
+	shape.push (value_closure::vtype);
+	return shape;
+
+      case tree_type::BIND:
+	shape.pop (1);
+	check_underrun (shape, t, ctx);
+	return shape;
+
+      case tree_type::READ:
+	// If the variable holds a closure, reading it applies the
+	// closure, and that may do anything.
+	shape.forget ();
+	return shape;
+
+      case tree_type::NOP:
+      case tree_type::F_DEBUG:
+	return shape;
+
+      case tree_type::CLOSE_STAR:
+      case tree_type::CLOSE_PLUS:
+	{
+	  // IN describes all stacks that the iterated expression can
+	  // see.  With X*, that's also what comes out.
+	  stack_shape in = closure_fixpoint (t.child (0), shape, ctx);
+	  stack_shape out = infer (t.child (0), in, ctx);
+	  return t.tt () == tree_type::CLOSE_STAR ? in : out;
+	}
+
+      case tree_type::ASSERT:
+	infer_pred (t.child (0), shape, ctx);
+	return shape;
+
+      case tree_type::EMPTY_LIST:
+	shape.push (value_seq::vtype);
+	return shape;
+
+      case tree_type::CONST:
+	shape.push (value_cst::vtype);
+	return shape;
+
+      case tree_type::STR:
+	shape.push (value_str::vtype);
+	return shape;
+
+      case tree_type::FORMAT:
+	// Format sub-expressions are evaluated right to left, each on
+	// the stack that the previous one left behind, minus the
+	// value that it formatted.
+	for (auto it = t.m_children.rbegin (); it != t.m_children.rend (); ++it)
+	  if (it->tt () != tree_type::STR)
+	    {
+	      shape = infer (*it, shape, ctx);
+	      shape.pop (1);
+	      check_underrun (shape, t, ctx);
+	    }
+	shape.push (value_str::vtype);
+	return shape;
+
+      case tree_type::F_BUILTIN:
+	if (ctx.m_peg)
+	  if (auto b = t.m_builtin->peg (shape))
+	    t.m_builtin = b;
+	if (ctx.m_probe && t.m_builtin->build_pred () != nullptr)
+	  probe_pred (*t.m_builtin, shape, ctx);
+	t.m_builtin->stack_effect (shape);
+	check_underrun (shape, t, ctx);
+	return shape;
+
+      case tree_type::PRED_AND:
+      case tree_type::PRED_OR:
+      case tree_type::PRED_NOT:
+      case tree_type::PRED_SUBX_ANY:
+      case tree_type::PRED_SUBX_CMP:
+	assert (! "Should never get here.");
+	abort ();
+      }
+
+    abort ();
+  }
+
+  stack_shape
+  infer (tree &t, stack_shape shape, infer_ctx &ctx)
+  {
+    bool sealed = shape.sealed ();
+    stack_shape ret = infer_1 (t, shape, ctx);
+    if (sealed && ! ret.sealed ())
+      ctx.m_confined = false;
+    return ret;
+  }
+}
+
+void
+tree::peg_overloads ()
+{
+  infer_ctx ctx {true, false, true};
+  infer (*this, stack_shape {}, ctx);
+}
+
+void
+tree::check_stack_effect (stack const &stk) const
+{
+  // Without pegging, the tree is left intact.
+  infer_ctx ctx {false, false, true};
+  infer (const_cast <tree &> (*this), stack_shape {stk}, ctx);
+}
+
+namespace
+{
+  // Whether T keeps to itself when it comes to frames: it neither
+  // refers to variables of scopes that enclose it, nor debug-prints.
+  // SCOPES is the number of scopes between T and the expression
+  // whose invariance is in question.
+  bool
+  self_contained (tree const &t, size_t scopes)
+  {
+    switch (t.tt ())
+      {
+      case tree_type::F_DEBUG:
+	return false;
+
+      case tree_type::BIND:
+      case tree_type::READ:
+	if (t.cst ().value ().uval () >= scopes)
+	  return false;
+	break;
+
+      case tree_type::SCOPE:
+	++scopes;
+	break;
+
+      default:
+	break;
+      }
+
+    for (auto const &child: t.m_children)
+      if (! self_contained (child, scopes))
+	return false;
+    return true;
+  }
+
+  // Whether results of T depend on at most N values near TOS.
+  bool
+  confined (tree const &t, size_t n)
+  {
+    if (! self_contained (t, 0))
+      return false;
+
+    infer_ctx ctx {false, true, true};
+    infer (const_cast <tree &> (t), stack_shape::make_sealed (n), ctx);
+    return ctx.m_confined;
+  }
+}
+
+bool
+tree::invariant () const
+{
+  return confined (*this, 0);
+}
+
+bool
+tree::tos_function () const
+{
+  return confined (*this, 1);
+}
@@ -0,0 +1,145 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef _INFER_H_
+#define _INFER_H_
+
+#include <vector>
+
+#include "builtin.hh"
+#include "stack.hh"
+#include "value.hh"
+
+// Statically known shape of a stack.  This is what static analysis
+// of a query (see tree::peg_overloads) knows about the stack at a
+// given point of the program.
+//
+// The shape tracks types of some number of values near TOS.  Nothing
+// is known about the slots below those.  A tracked slot whose type
+// isn't known has a type with code 0, the same as what selector uses
+// for "any type".
+//
+// A shape may be exact, in which case the tracked slots are all there
+// is on the stack.  Exact shapes come from a known input stack (see
+// tree::check_stack_effect) and allow detecting stack underruns.
+//
+// A shape may also be sealed.  Then there may be other values below
+// the tracked slots, but using any of them counts as an underrun.
+// Sealed shapes are used for finding out whether an expression keeps
+// off its input stack (see tree::invariant).
+class stack_shape
+{
+  // rbegin is TOS.
+  std::vector <value_type> m_types;
+  bool m_exact;
+  bool m_sealed;
+  bool m_underrun;
+
+public:
+  stack_shape ()
+    : m_exact {false}
+    , m_sealed {false}
+    , m_underrun {false}
+  {}
+
+  // Exact shape of stack STK.
+  explicit stack_shape (stack const &stk);
+
+  // Sealed shape with N tracked slots of unknown types.
+  static stack_shape make_sealed (size_t n);
+
+  enum class match
+    {
+      no,	// The types are known not to match.
+      maybe,	// Might match, depending on the types not known.
+      yes,	// The types are known to match.
+    };
+
+  // Type of the value at DEPTH, or type with code 0 if it isn't
+  // known.
+  value_type get (size_t depth) const;
+
+  void push (value_type vt);
+  void pop (size_t n);
+
+  // Note that N values are needed on the stack.  If the shape is
+  // exact or sealed and there are fewer values than that, the shape
+  // is marked as underrun.
+  void need (size_t n);
+
+  // Forget everything that's known about the stack.
+  void
+  forget ()
+  {
+    m_types.clear ();
+    m_exact = false;
+    m_sealed = false;
+  }
+
+  size_t
+  size () const
+  {
+    return m_types.size ();
+  }
+
+  bool
+  exact () const
+  {
+    return m_exact;
+  }
+
+  bool
+  sealed () const
+  {
+    return m_sealed;
+  }
+
+  bool
+  underrun () const
+  {
+    return m_underrun;
+  }
+
+  // Whether values near TOS are of types TYPES.  rbegin of TYPES is
+  // TOS, as in builtin_prototype.
+  match matches (std::vector <value_type> const &types) const;
+
+  // Update the shape according to prototype map PM.  With an empty
+  // map, or when no prototype matches, everything is forgotten.
+  void apply (builtin_protomap const &pm);
+
+  // The shape of a stack that comes from either A or B.
+  static stack_shape merge (stack_shape const &a, stack_shape const &b);
+
+  bool operator== (stack_shape const &that) const;
+  bool operator!= (stack_shape const &that) const
+  { return ! (*this == that); }
+};
+
+#endif /* _INFER_H_ */
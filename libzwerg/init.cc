@@ -96,6 +96,7 @@ dwgrep_vocabulary_core ()
   add_builtin_constant (*voc, constant (1, &bool_constant_dom), "true");
   add_simple_exec_builtin <op_type> (*voc, "type");
   add_simple_exec_builtin <op_pos> (*voc, "pos");
+  add_simple_exec_builtin <op_limit> (*voc, "limit");
 
   // stack shuffling
   add_simple_exec_builtin <op_drop> (*voc, "drop");
@@ -30,6 +30,7 @@
 #include "libzwerg.hh"
 
 #include "builtin-dw.hh"
+#include "parallel.hh"
 #include "value-aset.hh"
 #include "value-dw.hh"
 #include "value-symbol.hh"
@@ -201,6 +202,21 @@ zw_value_is_dwarf (zw_value const *val)
   return val->is <value_dwarf> ();
 }
 
+zw_result *
+zw_query_execute_parallel (zw_query const *query,
+			   zw_stack const *input_stack,
+			   unsigned nthreads, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      stack stk;
+      for (auto const &emt: input_stack->m_values)
+	stk.push (emt->clone ());
+      query->m_query.check_stack_effect (stk);
+      return new zw_result
+	{ build_parallel_exec (query->m_query, stk, nthreads) };
+    }, nullptr, out_err);
+}
+
 bool
 zw_value_is_cu (zw_value const *val)
 {
@@ -299,6 +315,45 @@ zw_value_dwarf_machine (zw_value const *val, zw_error **out_err)
     }, nullptr, out_err);
 }
 
+bool
+zw_value_dwarf_set_index_dir (zw_value const *val, char const *dir,
+			      zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      dwarf (val).get_dwctx ()->set_index_dir (dir);
+      return true;
+    }, false, out_err);
+}
+
+bool
+zw_value_dwarf_set_cache_limits (zw_value const *val, size_t budget,
+				 bool streaming, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      auto ctx = dwarf (val).get_dwctx ();
+      ctx->set_cache_budget (budget);
+      ctx->set_cache_streaming (streaming);
+      return true;
+    }, false, out_err);
+}
+
+bool
+zw_value_dwarf_cache_stats (zw_value const *val, zw_cache_stats *out_stats,
+			    zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      cache_stats stats = dwarf (val).get_dwctx ()->get_cache_stats ();
+      out_stats->hits = stats.hits;
+      out_stats->misses = stats.misses;
+      out_stats->evictions = stats.evictions;
+      out_stats->drops = stats.drops;
+      out_stats->entries = stats.entries;
+      out_stats->bytes = stats.bytes;
+      out_stats->peak_bytes = stats.peak_bytes;
+      return true;
+    }, false, out_err);
+}
+
 
 namespace
 {
@@ -176,6 +176,58 @@ extern "C" {
   zw_machine const *zw_value_dwarf_machine (zw_value const *dw,
 					    zw_error **out_err);
 
+  // Make queries over DW, which shall be a DWARF value, keep
+  // persistent indices of DIE's in directory DIR, which shall exist.
+  // One index is kept for each module that has a build ID.  An index
+  // is built when it's first needed, and reused by later queries
+  // over modules with the same build ID.  Returns false on error, in
+  // which case it sets *OUT_ERR.  OUT_ERR shall be non-NULL.
+  bool zw_value_dwarf_set_index_dir (zw_value const *dw, char const *dir,
+				     zw_error **out_err);
+
+  // Make queries over DW, which shall be a DWARF value, keep their
+  // in-memory caches at roughly BUDGET bytes, evicting least recently
+  // used entries as necessary.  A BUDGET of zero means no limit.  If
+  // STREAMING, cached data of a unit is dropped as soon as the query
+  // moves on to a next unit, which suits queries that scan through
+  // the units one by one.  Returns false on error, in which case it
+  // sets *OUT_ERR.  OUT_ERR shall be non-NULL.
+  bool zw_value_dwarf_set_cache_limits (zw_value const *dw, size_t budget,
+					bool streaming, zw_error **out_err);
+
+  // Statistics of in-memory caches of a DWARF value.
+  typedef struct zw_cache_stats
+  {
+    uint64_t hits;		// Lookups answered from the cache.
+    uint64_t misses;		// Lookups that had to populate it.
+    uint64_t evictions;		// Entries evicted to stay within budget.
+    uint64_t drops;		// Entries dropped in streaming mode.
+    size_t entries;		// Entries currently held.
+    size_t bytes;		// Bytes currently held.
+    size_t peak_bytes;		// Most bytes held at any one time.
+  } zw_cache_stats;
+
+  // Fill *OUT_STATS with statistics of caches of DW, which shall be a
+  // DWARF value.  Returns false on error, in which case it sets
+  // *OUT_ERR.  OUT_ERR shall be non-NULL.
+  bool zw_value_dwarf_cache_stats (zw_value const *dw,
+				   zw_cache_stats *out_stats,
+				   zw_error **out_err);
+
+  // Like zw_query_execute, but if QUERY starts with `unit' or `entry'
+  // and there's a DWARF value on top of INPUT_STACK, split units of
+  // that value into at most NTHREADS slices and evaluate QUERY over
+  // each of them in a separate thread.  Stacks pulled from the
+  // result come in the same order as with zw_query_execute.  Queries
+  // that can't be split this way are executed serially.  Note that
+  // with `entry', this is only done when QUERY doesn't use `pos'.
+  // Returns NULL on error, in which case it sets *OUT_ERR.  OUT_ERR
+  // shall be non-NULL.
+  zw_result *zw_query_execute_parallel (zw_query const *query,
+					zw_stack const *input_stack,
+					unsigned nthreads,
+					zw_error **out_err);
+
 
   /**
    * CU.
@@ -36,8 +36,10 @@
 #include "init.hh"
 #include "op.hh"
 #include "parser.hh"
+#include "profile.hh"
 #include "stack.hh"
 #include "tree.hh"
+#include "vm.hh"
 
 #include "value-cst.hh"
 #include "value-str.hh"
@@ -151,11 +153,25 @@ zw_query *
 zw_query_parse_len (zw_vocabulary const *voc,
 		    char const *query, size_t query_len,
 		    zw_error **out_err)
+{
+  return zw_query_parse_backend (voc, query, query_len,
+				 ZW_BACKEND_OP, out_err);
+}
+
+zw_query *
+zw_query_parse_backend (zw_vocabulary const *voc,
+			char const *query, size_t query_len,
+			zw_backend backend, zw_error **out_err)
 {
   return capture_errors ([&] () {
       tree t = parse_query (*voc->m_voc, {query, query_len});
       t.simplify ();
-      return new zw_query { t };
+      t.reduce_strength ();
+      t.peg_overloads ();
+      auto ret = std::make_unique <zw_query> (zw_query { t });
+      if (backend == ZW_BACKEND_VM)
+	ret->m_vm = vm_compile (t);
+      return ret.release ();
     }, nullptr, out_err);
 }
 
@@ -186,11 +202,32 @@ zw_query_execute (zw_query const *query, zw_stack const *input_stack,
       auto stk = std::make_unique <stack> ();
       for (auto const &emt: input_stack->m_values)
 	stk->push (emt->clone ());
+      query->m_query.check_stack_effect (*stk);
       auto upstream = std::make_shared <op_origin> (std::move (stk));
+      if (query->m_vm != nullptr)
+	return new zw_result { std::make_shared <op_vm> (upstream,
+							 query->m_vm) };
       return new zw_result { query->m_query.build_exec (upstream) };
     }, nullptr, out_err);
 }
 
+zw_result *
+zw_query_execute_profile (zw_query const *query, zw_stack const *input_stack,
+			  zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      auto stk = std::make_unique <stack> ();
+      for (auto const &emt: input_stack->m_values)
+	stk->push (emt->clone ());
+      query->m_query.check_stack_effect (*stk);
+      auto upstream = std::make_shared <op_origin> (std::move (stk));
+
+      auto prof = std::make_shared <profiler> ();
+      profiler::install install {*prof};
+      return new zw_result { query->m_query.build_exec (upstream), prof };
+    }, nullptr, out_err);
+}
+
 bool
 zw_result_next (zw_result *result, zw_stack **out_stack, zw_error **out_err)
 {
@@ -216,12 +253,42 @@ zw_result_next (zw_result *result, zw_stack **out_stack, zw_error **out_err)
     }, false, out_err);
 }
 
+bool
+zw_result_count (zw_result *result, uint64_t *out_count, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      std::vector <stack::uptr> batch;
+      uint64_t n = 0;
+      while (size_t got = result->m_op->next_batch (batch, op_batch_size))
+	{
+	  n += got;
+	  batch.clear ();
+	}
+
+      *out_count = n;
+      return true;
+    }, false, out_err);
+}
+
 void
 zw_result_destroy (zw_result *result)
 {
   delete result;
 }
 
+zw_value *
+zw_result_profile (zw_result const *result, zw_error **out_err)
+{
+  return capture_errors ([&] () {
+      if (result->m_profiler == nullptr)
+	throw std::runtime_error ("result was not profiled");
+
+      std::stringstream ss;
+      result->m_profiler->format (ss);
+      return new value_str {ss.str (), 0};
+    }, nullptr, out_err);
+}
+
 bool
 zw_value_is_const (zw_value const *val)
 {
@@ -194,6 +194,27 @@ extern "C" {
 				char const *query, size_t query_len,
 				zw_error **out_err);
 
+  // Backends that a query can be executed on.  ZW_BACKEND_OP
+  // evaluates the query as a graph of operators, each of which pulls
+  // stacks from the previous one.  ZW_BACKEND_VM compiles the query
+  // to bytecode for a backtracking virtual machine.  Only the core
+  // control flow is compiled, words and the rest of the query still
+  // run as operators.  Both backends produce the same results in the
+  // same order.
+  typedef enum zw_backend
+    {
+      ZW_BACKEND_OP,
+      ZW_BACKEND_VM,
+    } zw_backend;
+
+  // Like zw_query_parse_len, but the query is executed on a given
+  // BACKEND.  zw_query_parse and zw_query_parse_len use
+  // ZW_BACKEND_OP.  Note that zw_query_execute_parallel always uses
+  // ZW_BACKEND_OP.
+  zw_query *zw_query_parse_backend (zw_vocabulary const *voc,
+				    char const *query, size_t query_len,
+				    zw_backend backend, zw_error **out_err);
+
   // Release resources associated with QUERY.
   void zw_query_destroy (zw_query *query);
 
@@ -205,6 +226,15 @@ extern "C" {
 			       zw_stack const *input_stack,
 			       zw_error **out_err);
 
+  // Like zw_query_execute, but every op and predicate of QUERY is
+  // instrumented to count calls, produced and rejected stacks, time
+  // and allocations.  The figures can be obtained by
+  // zw_result_profile.  The query is always executed on
+  // ZW_BACKEND_OP.
+  zw_result *zw_query_execute_profile (zw_query const *query,
+				       zw_stack const *input_stack,
+				       zw_error **out_err);
+
   // Pull next output stack from RESULT.  Returns true and sets
   // *OUT_STACK to the stack with output values, or to NULL, if there
   // are no more results.  Returns false on error, in which case it
@@ -212,9 +242,25 @@ extern "C" {
   bool zw_result_next (zw_result *result,
 		       zw_stack **out_stack, zw_error **out_err);
 
+  // Pull all remaining output stacks from RESULT and set *OUT_COUNT
+  // to their number.  This is cheaper than counting what
+  // zw_result_next yields, as the stacks are not exported.  Returns
+  // false on error, in which case it sets *OUT_ERR.  OUT_ERR shall
+  // be non-NULL.
+  bool zw_result_count (zw_result *result,
+			uint64_t *out_count, zw_error **out_err);
+
   // Release resources associated with RESULT.
   void zw_result_destroy (zw_result *result);
 
+  // Return a string value with the profile of RESULT, formatted as
+  // an annotated tree of the query.  The figures cover what was
+  // pulled from RESULT so far.  RESULT must have been created by
+  // zw_query_execute_profile.  Returns NULL on error, in which case
+  // it sets *OUT_ERR.  OUT_ERR shall be non-NULL.
+  zw_value *zw_result_profile (zw_result const *result,
+			       zw_error **out_err);
+
 
   /**
    * Values.
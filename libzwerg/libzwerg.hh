@@ -96,4 +96,12 @@ zw_result_next (zw_result &result)
   return std::unique_ptr <zw_stack, zw_deleter> {stk};
 }
 
+inline uint64_t
+zw_result_count (zw_result &result)
+{
+  uint64_t count;
+  zw_result_count (&result, &count, zw_throw_on_error {});
+  return count;
+}
+
 #endif
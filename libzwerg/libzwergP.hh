@@ -35,6 +35,7 @@
 #include "tree.hh"
 
 struct vocabulary;
+class vm_program;
 
 struct zw_error
 {
@@ -49,11 +50,19 @@ struct zw_vocabulary
 struct zw_query
 {
   tree m_query;
+
+  // Compiled query if it should run on the virtual machine.
+  std::shared_ptr <vm_program const> m_vm;
 };
 
+class profiler;
+
 struct zw_result
 {
   std::shared_ptr <op> m_op;
+
+  // Non-null if the result was created by zw_query_execute_profile.
+  std::shared_ptr <profiler> m_profiler;
 };
 
 struct zw_stack
@@ -29,17 +29,27 @@
 #include <iostream>
 #include <sstream>
 #include <memory>
-#include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
+#include <list>
 
 #include "op.hh"
 #include "builtin-closure.hh"
+#include "infer.hh"
 #include "overload.hh"
+#include "profile.hh"
 #include "value-closure.hh"
 #include "value-cst.hh"
 #include "value-seq.hh"
 #include "value-str.hh"
 
+void
+inner_op::stack_effect (stack_shape &shape)
+{
+  shape.forget ();
+}
+
 namespace
 {
   void
@@ -76,6 +86,18 @@ namespace
   }
 }
 
+size_t
+op::next_batch (std::vector <stack::uptr> &out, size_t n)
+{
+  size_t i = 0;
+  for (; i < n; ++i)
+    if (auto stk = next ())
+      out.push_back (std::move (stk));
+    else
+      break;
+  return i;
+}
+
 stack::uptr
 op_origin::next ()
 {
@@ -122,15 +144,60 @@ op_nop::name () const
 }
 
 
+void
+op_assert::reset_me ()
+{
+  m_block.clear ();
+  m_sel.clear ();
+  m_i = 0;
+}
+
+bool
+op_assert::refill (size_t n)
+{
+  reset_me ();
+  if (m_upstream->next_batch (m_block, n) == 0)
+    return false;
+
+  for (size_t i = 0; i < m_block.size (); ++i)
+    if (m_pred->result (*m_block[i]) == pred_result::yes)
+      m_sel.push_back (i);
+  return true;
+}
+
 stack::uptr
 op_assert::next ()
 {
+  // Hand out what's left of a block read by next_batch, but otherwise
+  // don't evaluate the predicate on stacks that nobody asked for yet.
+  if (m_i < m_sel.size ())
+    return std::move (m_block[m_sel[m_i++]]);
+
   while (auto stk = m_upstream->next ())
     if (m_pred->result (*stk) == pred_result::yes)
       return stk;
+
   return nullptr;
 }
 
+size_t
+op_assert::next_batch (std::vector <stack::uptr> &out, size_t n)
+{
+  size_t ret = 0;
+  do
+    for (; m_i < m_sel.size () && ret < n; ++ret)
+      out.push_back (std::move (m_block[m_sel[m_i++]]));
+  while (ret == 0 && refill (n));
+  return ret;
+}
+
+void
+op_assert::reset ()
+{
+  reset_me ();
+  m_upstream->reset ();
+}
+
 std::string
 op_assert::name () const
 {
@@ -391,6 +458,44 @@ op_merge::name () const
 }
 
 
+stack::uptr
+op_per_input::next ()
+{
+  while (true)
+    {
+      if (! m_primed)
+	{
+	  auto stk = m_upstream->next ();
+	  if (stk == nullptr)
+	    return nullptr;
+
+	  m_op->reset ();
+	  m_origin->set_next (std::move (stk));
+	  m_primed = true;
+	}
+
+      if (auto stk = m_op->next ())
+	return stk;
+
+      m_primed = false;
+    }
+}
+
+void
+op_per_input::reset ()
+{
+  m_primed = false;
+  m_op->reset ();
+  m_upstream->reset ();
+}
+
+std::string
+op_per_input::name () const
+{
+  return std::string ("per_input<") + m_op->name () + ">";
+}
+
+
 void
 op_or::reset_me ()
 {
@@ -456,6 +561,12 @@ op_capture::next ()
 {
   if (auto stk = m_upstream->next ())
     {
+      if (m_cached != nullptr)
+	{
+	  stk->push (m_cached->clone ());
+	  return stk;
+	}
+
       m_op->reset ();
       m_origin->set_next (std::make_unique <stack> (*stk));
 
@@ -463,7 +574,10 @@ op_capture::next ()
       while (auto stk2 = m_op->next ())
 	vv.push_back (stk2->pop ());
 
-      stk->push (std::make_unique <value_seq> (std::move (vv), 0));
+      auto seq = std::make_unique <value_seq> (std::move (vv), 0);
+      if (m_invariant)
+	m_cached = seq->clone ();
+      stk->push (std::move (seq));
       return stk;
     }
 
@@ -484,15 +598,62 @@ op_capture::name () const
 }
 
 
+stack::uptr
+op_count::next ()
+{
+  if (auto stk = m_upstream->next ())
+    {
+      m_op->reset ();
+      m_origin->set_next (std::make_unique <stack> (*stk));
+
+      uint64_t n = 0;
+      while (size_t got = m_op->next_batch (m_batch, op_batch_size))
+	{
+	  n += got;
+	  m_batch.clear ();
+	}
+
+      stk->push (std::make_unique <value_cst>
+		 (constant {n, &dec_constant_dom}, 0));
+      return stk;
+    }
+
+  return nullptr;
+}
+
+void
+op_count::reset ()
+{
+  m_op->reset ();
+  m_upstream->reset ();
+}
+
+std::string
+op_count::name () const
+{
+  return std::string ("count<") + m_op->name () + ">";
+}
+
+
 namespace
 {
-  struct deref_less
+  struct deref_hash
+  {
+    template <class T>
+    size_t
+    operator() (T const &a) const
+    {
+      return a->hash ();
+    }
+  };
+
+  struct deref_equal
   {
     template <class T>
     bool
-    operator() (T const &a, T const &b)
+    operator() (T const &a, T const &b) const
     {
-      return *a < *b;
+      return *a == *b;
     }
   };
 }
@@ -503,7 +664,8 @@ struct op_tr_closure::pimpl
   std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_op;
 
-  std::set <std::shared_ptr <stack>, deref_less> m_seen;
+  std::unordered_set <std::shared_ptr <stack>,
+		      deref_hash, deref_equal> m_seen;
   std::vector <std::shared_ptr <stack> > m_stks;
 
   bool m_is_plus;
@@ -656,14 +818,25 @@ struct op_subx::pimpl
   stack::uptr m_stk;
   size_t m_keep;
 
+  // For invariant sub-expressions, values kept from each yielded
+  // stack, bottom first.  Once M_COMPLETE is set, they are replayed
+  // instead of evaluating the sub-expression again.
+  bool m_invariant;
+  bool m_complete;
+  std::vector <std::vector <std::unique_ptr <value>>> m_results;
+  size_t m_i;
+
   pimpl (std::shared_ptr <op> upstream,
 	 std::shared_ptr <op_origin> origin,
 	 std::shared_ptr <op> op,
-	 size_t keep)
+	 size_t keep, bool invariant)
     : m_upstream {upstream}
     , m_origin {origin}
     , m_op {op}
     , m_keep {keep}
+    , m_invariant {invariant}
+    , m_complete {false}
+    , m_i {0}
   {}
 
   void
@@ -672,6 +845,15 @@ struct op_subx::pimpl
     m_stk = nullptr;
   }
 
+  stack::uptr
+  replay ()
+  {
+    auto ret = std::make_unique <stack> (*m_stk);
+    for (auto const &val: m_results[m_i++])
+      ret->push (val->clone ());
+    return ret;
+  }
+
   stack::uptr
   next ()
   {
@@ -680,25 +862,46 @@ struct op_subx::pimpl
 	while (m_stk == nullptr)
 	  if (m_stk = m_upstream->next ())
 	    {
-	      m_op->reset ();
-	      m_origin->set_next (std::make_unique <stack> (*m_stk));
+	      m_i = 0;
+	      if (! m_complete)
+		{
+		  // Whatever was recorded for a stack that wasn't
+		  // evaluated through is thrown away.
+		  m_results.clear ();
+		  m_op->reset ();
+		  m_origin->set_next (std::make_unique <stack> (*m_stk));
+		}
 	    }
 	  else
 	    return nullptr;
 
-	if (auto stk = m_op->next ())
+	if (m_complete)
+	  {
+	    if (m_i < m_results.size ())
+	      return replay ();
+	  }
+	else if (auto stk = m_op->next ())
 	  {
 	    auto ret = std::make_unique <stack> (*m_stk);
 	    std::vector <std::unique_ptr <value>> kept;
 	    for (size_t i = 0; i < m_keep; ++i)
 	      kept.push_back (stk->pop ());
+
+	    std::vector <std::unique_ptr <value>> rec;
 	    for (size_t i = 0; i < m_keep; ++i)
 	      {
+		if (m_invariant)
+		  rec.push_back (kept.back ()->clone ());
 		ret->push (std::move (kept.back ()));
 		kept.pop_back ();
 	      }
+
+	    if (m_invariant)
+	      m_results.push_back (std::move (rec));
 	    return ret;
 	  }
+	else if (m_invariant)
+	  m_complete = true;
 
 	reset_me ();
       }
@@ -715,8 +918,9 @@ struct op_subx::pimpl
 op_subx::op_subx (std::shared_ptr <op> upstream,
 		  std::shared_ptr <op_origin> origin,
 		  std::shared_ptr <op> op,
-		  size_t keep)
-  : m_pimpl {std::make_unique <pimpl> (upstream, origin, op, keep)}
+		  size_t keep, bool invariant)
+  : m_pimpl {std::make_unique <pimpl> (upstream, origin, op, keep,
+				       invariant)}
 {}
 
 op_subx::~op_subx ()
@@ -740,6 +944,238 @@ op_subx::name () const
   return std::string ("subx<") + m_pimpl->m_op->name () + ">";
 }
 
+namespace
+{
+  struct deref_identical
+  {
+    bool
+    operator() (value const *a, value const *b) const
+    {
+      return a->get_pos () == b->get_pos () && a->identical (*b);
+    }
+  };
+}
+
+struct op_memo::pimpl
+{
+  std::shared_ptr <op> m_upstream;
+  std::shared_ptr <op_origin> m_origin;
+  std::shared_ptr <op> m_op;
+  size_t m_capacity;
+  size_t m_entry_capacity;
+
+  // Values that the sub-expression pushed on top of what was below
+  // the input TOS, bottom first, for each yielded stack.
+  typedef std::vector <std::vector <std::unique_ptr <value>>> results_t;
+
+  struct entry
+  {
+    std::unique_ptr <value> m_key;
+    results_t m_results;
+    size_t m_size;
+  };
+
+  // Most recently used entries are at the front.  M_SIZE is the
+  // number of values that they hold.
+  std::list <entry> m_lru;
+  size_t m_size;
+  std::unordered_map <value const *, std::list <entry>::iterator,
+		      deref_hash, deref_identical> m_index;
+
+  stack::uptr m_stk;
+
+  // When replaying, the entry being replayed and index of the next
+  // result.  Otherwise, if M_KEY is set, results of the
+  // sub-expression are being recorded to M_RECORD, which holds
+  // M_RECORD_SIZE values.
+  entry const *m_replay;
+  size_t m_i;
+  std::unique_ptr <value> m_key;
+  results_t m_record;
+  size_t m_record_size;
+
+  profile_node *m_prof;
+
+  pimpl (std::shared_ptr <op> upstream,
+	 std::shared_ptr <op_origin> origin,
+	 std::shared_ptr <op> op,
+	 size_t capacity, size_t entry_capacity, profile_node *prof)
+    : m_upstream {upstream}
+    , m_origin {origin}
+    , m_op {op}
+    , m_capacity {capacity}
+    , m_entry_capacity {entry_capacity}
+    , m_size {0}
+    , m_replay {nullptr}
+    , m_i {0}
+    , m_record_size {0}
+    , m_prof {prof}
+  {}
+
+  void
+  reset_me ()
+  {
+    m_stk = nullptr;
+    m_replay = nullptr;
+    m_key = nullptr;
+    m_record.clear ();
+  }
+
+  void
+  remember ()
+  {
+    size_t size = 1 + m_record_size;
+    m_lru.push_front (entry {std::move (m_key), std::move (m_record), size});
+    m_index[m_lru.front ().m_key.get ()] = m_lru.begin ();
+    m_size += size;
+
+    while (m_size > m_capacity)
+      {
+	m_size -= m_lru.back ().m_size;
+	m_index.erase (m_lru.back ().m_key.get ());
+	m_lru.pop_back ();
+      }
+  }
+
+  // Look up TOS of M_STK.  Returns false if the sub-expression
+  // needs to be evaluated.
+  bool
+  lookup ()
+  {
+    if (m_stk->size () == 0)
+      return false;
+
+    // Such a value would only take up room in the cache.
+    value const &tos = m_stk->top ();
+    if (! tos.has_identity ())
+      return false;
+
+    auto it = m_index.find (&tos);
+    if (it != m_index.end ())
+      {
+	if (m_prof != nullptr)
+	  ++m_prof->m_memo_hits;
+	m_lru.splice (m_lru.begin (), m_lru, it->second);
+	m_replay = &*it->second;
+	m_i = 0;
+	return true;
+      }
+
+    if (m_prof != nullptr)
+      ++m_prof->m_memo_misses;
+    m_key = tos.clone ();
+    m_record.clear ();
+    m_record_size = 0;
+    return false;
+  }
+
+  stack::uptr
+  replay ()
+  {
+    auto ret = std::make_unique <stack> (*m_stk);
+    ret->pop ();
+    for (auto const &val: m_replay->m_results[m_i++])
+      ret->push (val->clone ());
+    return ret;
+  }
+
+  void
+  record (stack const &stk)
+  {
+    // The sub-expression only touched TOS, so whatever is above the
+    // values below it is what it pushed.
+    size_t base = m_stk->size () - 1;
+    assert (stk.size () >= base);
+
+    // Don't fill the cache with results that are unlikely to be asked
+    // for again.  Stop recording and forget the input value.
+    m_record_size += stk.size () - base;
+    if (m_record_size > m_entry_capacity)
+      {
+	m_key = nullptr;
+	m_record.clear ();
+	return;
+      }
+
+    std::vector <std::unique_ptr <value>> vals;
+    for (size_t i = stk.size () - base; i > 0; --i)
+      vals.push_back (stk.get (i - 1).clone ());
+    m_record.push_back (std::move (vals));
+  }
+
+  stack::uptr
+  next ()
+  {
+    while (true)
+      {
+	while (m_stk == nullptr)
+	  if ((m_stk = m_upstream->next ()))
+	    {
+	      if (! lookup ())
+		{
+		  m_op->reset ();
+		  m_origin->set_next (std::make_unique <stack> (*m_stk));
+		}
+	    }
+	  else
+	    return nullptr;
+
+	if (m_replay != nullptr)
+	  {
+	    if (m_i < m_replay->m_results.size ())
+	      return replay ();
+	  }
+	else if (auto stk = m_op->next ())
+	  {
+	    if (m_key != nullptr)
+	      record (*stk);
+	    return stk;
+	  }
+	else if (m_key != nullptr)
+	  remember ();
+
+	reset_me ();
+      }
+  }
+
+  void
+  reset ()
+  {
+    reset_me ();
+    m_upstream->reset ();
+  }
+};
+
+op_memo::op_memo (std::shared_ptr <op> upstream,
+		  std::shared_ptr <op_origin> origin,
+		  std::shared_ptr <op> op,
+		  size_t capacity, size_t entry_capacity,
+		  profile_node *prof)
+  : m_pimpl {std::make_unique <pimpl> (upstream, origin, op, capacity,
+				       entry_capacity, prof)}
+{}
+
+op_memo::~op_memo ()
+{}
+
+stack::uptr
+op_memo::next ()
+{
+  return m_pimpl->next ();
+}
+
+void
+op_memo::reset ()
+{
+  m_pimpl->reset ();
+}
+
+std::string
+op_memo::name () const
+{
+  return std::string ("memo<") + m_pimpl->m_op->name () + ">";
+}
+
 stack::uptr
 op_f_debug::next ()
 {
@@ -1164,12 +1600,20 @@ pred_or::name () const
 pred_result
 pred_subx_any::result (stack &stk)
 {
+  if (m_have_cached)
+    return m_cached;
+
   m_op->reset ();
   m_origin->set_next (std::make_unique <stack> (stk));
-  if (m_op->next () != nullptr)
-    return pred_result::yes;
-  else
-    return pred_result::no;
+  pred_result ret = m_op->next () != nullptr
+    ? pred_result::yes : pred_result::no;
+
+  if (m_invariant)
+    {
+      m_cached = ret;
+      m_have_cached = true;
+    }
+  return ret;
 }
 
 std::string
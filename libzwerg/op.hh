@@ -30,12 +30,17 @@
 #define _OP_H_
 
 #include <memory>
+#include <vector>
 #include <cassert>
 
 #include "stack.hh"
 #include "pred_result.hh"
 #include "tree.hh"
 
+// Number of stacks or values that ops that support batching ask for
+// at once.
+const size_t op_batch_size = 64;
+
 // Subclasses of class op represent computations.  An op node is
 // typically constructed such that it directly feeds from another op
 // node, called upstream (see tree::build_exec).
@@ -48,6 +53,18 @@ public:
   virtual stack::uptr next () = 0;
   virtual void reset () = 0;
   virtual std::string name () const = 0;
+
+  // Produce up to N next values and append them to OUT.  Returns the
+  // number of values produced.  Zero means that there is nothing
+  // left, like nullptr from next does, but fewer than N doesn't.  By
+  // default this calls next, ops that can do better override it.
+  //
+  // N is also a measure of demand: an op that only needs a handful
+  // of stacks (such as `limit') asks for just that many, and ops that
+  // read ahead should not read much further than that.  In particular
+  // next must not read ahead at all: predicates, `debug' and errors
+  // would otherwise run for stacks that are never asked for.
+  virtual size_t next_batch (std::vector <stack::uptr> &out, size_t n);
 };
 
 template <class RT>
@@ -57,8 +74,36 @@ struct value_producer
 
   // Produce next value.
   virtual std::unique_ptr <RT> next () = 0;
+
+  // Like op::next_batch.
+  virtual size_t
+  next_batch (std::vector <std::unique_ptr <RT>> &out, size_t n)
+  {
+    size_t i = 0;
+    for (; i < n; ++i)
+      if (auto v = next ())
+	out.push_back (std::move (v));
+      else
+	break;
+    return i;
+  }
 };
 
+// Implement next_batch of producer P by calling its next without
+// going through the virtual table for each value.
+template <class P, class RT>
+size_t
+fill_batch (P &p, std::vector <std::unique_ptr <RT>> &out, size_t n)
+{
+  size_t i = 0;
+  for (; i < n; ++i)
+    if (auto v = p.P::next ())
+      out.push_back (std::move (v));
+    else
+      break;
+  return i;
+}
+
 template <class RT>
 struct value_producer_cat
   : public value_producer <RT>
@@ -86,6 +131,15 @@ struct value_producer_cat
 	return v;
     return nullptr;
   }
+
+  size_t
+  next_batch (std::vector <std::unique_ptr <RT>> &out, size_t n) override
+  {
+    for (; m_i < m_vprs.size (); ++m_i)
+      if (size_t ret = m_vprs[m_i]->next_batch (out, n))
+	return ret;
+    return 0;
+  }
 };
 
 // An op that's not an origin has an upstream.
@@ -102,6 +156,10 @@ public:
 
   void reset () override
   { m_upstream->reset (); }
+
+  // Static stack effect, for ops wrapped by add_simple_exec_builtin.
+  // See builtin::stack_effect.  Nothing is known by default.
+  static void stack_effect (stack_shape &shape);
 };
 
 // Class pred is for holding predicates.  These don't alter the
@@ -181,23 +239,34 @@ public:
   { m_upstream->reset (); }
 };
 
+// When asked for a batch, stacks are pulled from upstream in a block.
+// The predicate is evaluated over the whole block, and indices of
+// stacks that pass are noted in a selection vector, from which stacks
+// are then handed out.  When asked for one stack, one stack at a time
+// is pulled from upstream.
 class op_assert
   : public op
 {
   std::shared_ptr <op> m_upstream;
   std::unique_ptr <pred> m_pred;
+  std::vector <stack::uptr> m_block;
+  std::vector <size_t> m_sel;
+  size_t m_i;
+
+  void reset_me ();
+  bool refill (size_t n);
 
 public:
   op_assert (std::shared_ptr <op> upstream, std::unique_ptr <pred> p)
     : m_upstream {upstream}
     , m_pred {std::move (p)}
+    , m_i {0}
   {}
 
   stack::uptr next () override;
+  size_t next_batch (std::vector <stack::uptr> &out, size_t n) override;
   std::string name () const override;
-
-  void reset () override
-  { m_upstream->reset (); }
+  void reset () override;
 };
 
 // The stringer hieararchy supports op_format, which implements
@@ -394,6 +463,34 @@ public:
   void reset () override;
 };
 
+// Evaluate OP anew for each incoming stack: reset it, feed it the
+// stack through ORIGIN, and yield everything that it produces.  This
+// is for branches of an alternation, which are otherwise not reset
+// between inputs, but may hold ops whose state is per input (such as
+// op_limit).
+class op_per_input
+  : public op
+{
+  std::shared_ptr <op> m_upstream;
+  std::shared_ptr <op_origin> m_origin;
+  std::shared_ptr <op> m_op;
+  bool m_primed;
+
+public:
+  op_per_input (std::shared_ptr <op> upstream,
+		std::shared_ptr <op_origin> origin,
+		std::shared_ptr <op> op)
+    : m_upstream {upstream}
+    , m_origin {origin}
+    , m_op {op}
+    , m_primed {false}
+  {}
+
+  stack::uptr next () override;
+  std::string name () const override;
+  void reset () override;
+};
+
 class op_or
   : public op
 {
@@ -424,17 +521,51 @@ public:
   std::string name () const override;
 };
 
+// Sub-expression ops (op_capture, op_subx, pred_subx_any) take an
+// INVARIANT flag.  When set, the sub-expression is known to yield the
+// same results for every input stack (see tree::invariant).  It is
+// then evaluated only once, and its results are replayed for the
+// following stacks.  The results are kept across resets.
+
 class op_capture
   : public op
 {
   std::shared_ptr <op> m_upstream;
   std::shared_ptr <op_origin> m_origin;
   std::shared_ptr <op> m_op;
+  bool m_invariant;
+  std::unique_ptr <value> m_cached;
 
 public:
   op_capture (std::shared_ptr <op> upstream,
 	      std::shared_ptr <op_origin> origin,
-	      std::shared_ptr <op> op)
+	      std::shared_ptr <op> op,
+	      bool invariant)
+    : m_upstream {upstream}
+    , m_origin {origin}
+    , m_op {op}
+    , m_invariant {invariant}
+  {}
+
+  void reset () override;
+  stack::uptr next () override;
+  std::string name () const override;
+};
+
+// Push the number of stacks that OP yields for each incoming stack.
+// This is what [X] length computes, but the stacks are only counted.
+class op_count
+  : public op
+{
+  std::shared_ptr <op> m_upstream;
+  std::shared_ptr <op_origin> m_origin;
+  std::shared_ptr <op> m_op;
+  std::vector <stack::uptr> m_batch;
+
+public:
+  op_count (std::shared_ptr <op> upstream,
+	    std::shared_ptr <op_origin> origin,
+	    std::shared_ptr <op> op)
     : m_upstream {upstream}
     , m_origin {origin}
     , m_op {op}
@@ -481,7 +612,7 @@ public:
   op_subx (std::shared_ptr <op> upstream,
 	   std::shared_ptr <op_origin> origin,
 	   std::shared_ptr <op> op,
-	   size_t keep);
+	   size_t keep, bool invariant);
 
   ~op_subx ();
 
@@ -490,6 +621,47 @@ public:
   void reset () override;
 };
 
+// Number of values, input values and results alike, that an op_memo
+// keeps.
+const size_t memo_cache_size = 4096;
+
+// Number of result values of a single input value beyond which an
+// op_memo doesn't remember them.  Closures such as `child*' lead to
+// whole subtrees, typically from values that never come again.
+const size_t memo_entry_size = 256;
+
+class profile_node;
+
+// Memoizing wrapper of sub-expression OP, which is fed through ORIGIN.
+// OP has to be a function of the value on TOS (see
+// tree::tos_function).  Its results are replayed when a value
+// identical to a recently seen TOS value comes again (see
+// value::identical).  Recently seen values and their results are
+// remembered until they take up more than CAPACITY values, and
+// values that lead to more than ENTRY_CAPACITY results are not
+// remembered at all.  Neither are TOS values that can't be identical
+// to anything.  If PROF is not nullptr, cache hits and misses are
+// counted there.
+class op_memo
+  : public op
+{
+  class pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+public:
+  op_memo (std::shared_ptr <op> upstream,
+	   std::shared_ptr <op_origin> origin,
+	   std::shared_ptr <op> op,
+	   size_t capacity, size_t entry_capacity,
+	   profile_node *prof = nullptr);
+
+  ~op_memo ();
+
+  stack::uptr next () override;
+  std::string name () const override;
+  void reset () override;
+};
+
 class op_f_debug
   : public op
 {
@@ -664,12 +836,19 @@ class pred_subx_any
 {
   std::shared_ptr <op> m_op;
   std::shared_ptr <op_origin> m_origin;
+  bool m_invariant;
+  bool m_have_cached;
+  pred_result m_cached;
 
 public:
   pred_subx_any (std::shared_ptr <op> op,
-		 std::shared_ptr <op_origin> origin)
+		 std::shared_ptr <op_origin> origin,
+		 bool invariant)
     : m_op {op}
     , m_origin {origin}
+    , m_invariant {invariant}
+    , m_have_cached {false}
+    , m_cached {pred_result::no}
   {}
 
   pred_result result (stack &stk) override;
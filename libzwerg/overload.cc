@@ -32,6 +32,8 @@
 
 #include "overload.hh"
 #include "docstring.hh"
+#include "infer.hh"
+#include "tree.hh"
 
 overload_instance::overload_instance
 	(std::vector <std::tuple <selector,
@@ -240,11 +242,11 @@ namespace
   struct named_overload_op
     : public overload_op
   {
-    char const *m_name;
+    std::string m_name;
 
     named_overload_op (std::shared_ptr <op> upstream,
 		       overload_instance ovl_inst,
-		       char const *name)
+		       std::string const &name)
       : overload_op {upstream, ovl_inst}
       , m_name {name}
     {}
@@ -289,14 +291,79 @@ overloaded_op_builtin::create_merged (std::shared_ptr <overload_tab> tab) const
   return std::make_shared <overloaded_op_builtin> (name (), tab);
 }
 
+namespace
+{
+  // An overload that doesn't know how to reduce ASSERTION is simply
+  // followed by that assertion.
+  struct asserted_overload_builtin
+    : public builtin
+  {
+    std::shared_ptr <builtin> m_overload;
+    tree m_assertion;
+
+    asserted_overload_builtin (std::shared_ptr <builtin> overload,
+			       tree const &assertion)
+      : m_overload {overload}
+      , m_assertion {assertion}
+    {}
+
+    std::shared_ptr <op>
+    build_exec (std::shared_ptr <op> upstream) const override
+    {
+      return m_assertion.build_exec (m_overload->build_exec (upstream));
+    }
+
+    char const *
+    name () const override
+    {
+      return "overload";
+    }
+
+    builtin_protomap
+    protomap () const override
+    {
+      // The assertion leaves the stack as it is.
+      return m_overload->protomap ();
+    }
+  };
+}
+
+std::shared_ptr <builtin>
+overloaded_op_builtin::reduce (tree const &assertion) const
+{
+  bool reduced = false;
+  auto tab = std::make_shared <overload_tab> ();
+  for (auto const &ovl: get_overload_tab ()->get_overloads ())
+    {
+      auto const &b = std::get <1> (ovl);
+      if (auto r = b->reduce (assertion))
+	{
+	  tab->add_overload (std::get <0> (ovl), r);
+	  reduced = true;
+	}
+      else
+	tab->add_overload (std::get <0> (ovl),
+			   std::make_shared <asserted_overload_builtin>
+				(b, assertion));
+    }
+
+  if (! reduced)
+    return nullptr;
+
+  // The reduced word is given a name of its own, so that it's not
+  // mistaken for the original word when inspecting the tree.
+  return std::make_shared <overloaded_op_builtin>
+    (std::string (name ()) + "/reduced", tab);
+}
+
 namespace
 {
   struct named_overload_pred
     : public overload_pred
   {
-    char const *m_name;
+    std::string m_name;
 
-    named_overload_pred (overload_instance ovl_inst, char const *name)
+    named_overload_pred (overload_instance ovl_inst, std::string const &name)
       : overload_pred {ovl_inst}
       , m_name {name}
     {}
@@ -323,3 +390,144 @@ overloaded_pred_builtin::create_merged
 {
   return std::make_shared <overloaded_pred_builtin> (name (), tab, m_positive);
 }
+
+
+// Overload pegging.
+
+void
+overloaded_builtin::stack_effect (stack_shape &shape) const
+{
+  // Like overload dispatch, the first matching overload wins.
+  bool have = false;
+  size_t arity = -1;
+  stack_shape ret;
+  for (auto const &ovl: m_ovl_tab->get_overloads ())
+    {
+      auto types = std::get <0> (ovl).get_types ();
+      arity = std::min (arity, types.size ());
+      auto m = shape.matches (types);
+      if (m == stack_shape::match::no)
+	continue;
+
+      // The overload may not pop its arguments (e.g. if it's a
+      // predicate), but it needs them.
+      stack_shape s = shape;
+      s.need (types.size ());
+      std::get <1> (ovl)->stack_effect (s);
+      ret = have ? stack_shape::merge (ret, s) : s;
+      have = true;
+
+      if (m == stack_shape::match::yes)
+	break;
+    }
+
+  if (have)
+    shape = ret;
+  else
+    {
+      // If there are too few values for any overload, the word
+      // underruns the stack.
+      if (! m_ovl_tab->get_overloads ().empty ())
+	shape.need (arity);
+      shape.forget ();
+    }
+}
+
+std::shared_ptr <builtin>
+overloaded_builtin::find_pegged (stack_shape const &shape) const
+{
+  for (auto const &ovl: m_ovl_tab->get_overloads ())
+    switch (shape.matches (std::get <0> (ovl).get_types ()))
+      {
+      case stack_shape::match::no:
+	continue;
+      case stack_shape::match::maybe:
+	return nullptr;
+      case stack_shape::match::yes:
+	return std::get <1> (ovl);
+      }
+
+  return nullptr;
+}
+
+namespace
+{
+  // An overloaded word whose overload was determined statically.
+  // This calls the overload directly, without dispatching on the
+  // stack profile.  It keeps the name of the original word, so that
+  // it can still be recognized when inspecting the tree.
+  struct pegged_overload_builtin
+    : public builtin
+  {
+    std::shared_ptr <builtin> m_overload;
+    std::string m_name;
+    bool m_is_pred;
+    bool m_positive;
+
+    pegged_overload_builtin (std::shared_ptr <builtin> overload,
+			     std::string const &name,
+			     bool is_pred, bool positive)
+      : m_overload {overload}
+      , m_name {name}
+      , m_is_pred {is_pred}
+      , m_positive {positive}
+    {}
+
+    std::unique_ptr <pred>
+    build_pred () const override
+    {
+      if (auto pred = m_overload->build_pred ())
+	return maybe_invert (std::move (pred), m_positive);
+      return nullptr;
+    }
+
+    std::shared_ptr <op>
+    build_exec (std::shared_ptr <op> upstream) const override
+    {
+      return m_overload->build_exec (upstream);
+    }
+
+    char const *
+    name () const override
+    {
+      return m_name.c_str ();
+    }
+
+    std::string
+    docstring () const override
+    {
+      return m_overload->docstring ();
+    }
+
+    builtin_protomap
+    protomap () const override
+    {
+      return m_overload->protomap ();
+    }
+
+    void
+    stack_effect (stack_shape &shape) const override
+    {
+      if (! m_is_pred)
+	m_overload->stack_effect (shape);
+    }
+  };
+}
+
+std::shared_ptr <builtin>
+overloaded_op_builtin::peg (stack_shape const &shape) const
+{
+  if (auto ovl = find_pegged (shape))
+    return std::make_shared <pegged_overload_builtin>
+      (ovl, name (), false, true);
+  return nullptr;
+}
+
+std::shared_ptr <builtin>
+overloaded_pred_builtin::peg (stack_shape const &shape) const
+{
+  if (auto ovl = find_pegged (shape))
+    return std::make_shared <pegged_overload_builtin>
+      (ovl, name (), true, m_positive);
+  return nullptr;
+}
@@ -141,17 +141,17 @@ public:
 class overloaded_builtin
   : public builtin
 {
-  char const *m_name;
+  std::string m_name;
   std::shared_ptr <overload_tab> m_ovl_tab;
 
 public:
-  overloaded_builtin (char const *name,
+  overloaded_builtin (std::string const &name,
 		      std::shared_ptr <overload_tab> ovl_tab)
     : m_name {name}
     , m_ovl_tab {ovl_tab}
   {}
 
-  explicit overloaded_builtin (char const *name)
+  explicit overloaded_builtin (std::string const &name)
     : overloaded_builtin {name, std::make_shared <overload_tab> ()}
   {}
 
@@ -159,12 +159,22 @@ public:
   { return m_ovl_tab; }
 
   char const *name () const override final
-  { return m_name; }
+  { return m_name.c_str (); }
 
   std::string docstring () const override final;
 
   virtual std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const = 0;
+
+  // The stack effect of an overloaded word is that of whichever
+  // overload SHAPE selects.  If that's not known, the effects of
+  // all candidates are merged.
+  void stack_effect (stack_shape &shape) const override;
+
+protected:
+  // If SHAPE determines which overload gets selected, return it.
+  // Otherwise return nullptr.
+  std::shared_ptr <builtin> find_pegged (stack_shape const &shape) const;
 };
 
 // Base class for overloaded operation builtins.
@@ -178,6 +188,15 @@ struct overloaded_op_builtin
 
   std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const override final;
+
+  // If at least one of the overloads reduces, this returns an
+  // overloaded builtin whose overloads are either those reductions,
+  // or the original overloads followed by ASSERTION.
+  std::shared_ptr <builtin> reduce (tree const &assertion)
+    const override final;
+
+  std::shared_ptr <builtin> peg (stack_shape const &shape)
+    const override final;
 };
 
 // Base class for overloaded predicate builtins.
@@ -185,7 +204,7 @@ struct overloaded_pred_builtin
   : public overloaded_builtin
 {
   bool m_positive;
-  overloaded_pred_builtin (char const *name,
+  overloaded_pred_builtin (std::string const &name,
 			   std::shared_ptr <overload_tab> ovl_tab,
 			   bool positive)
     : overloaded_builtin {name, ovl_tab}
@@ -196,6 +215,13 @@ struct overloaded_pred_builtin
 
   std::shared_ptr <overloaded_builtin>
   create_merged (std::shared_ptr <overload_tab> tab) const override final;
+
+  void
+  stack_effect (stack_shape &shape) const override final
+  {}
+
+  std::shared_ptr <builtin> peg (stack_shape const &shape)
+    const override final;
 };
 
 
@@ -253,6 +279,12 @@ overload_tab::add_op_overload (Args &&... args)
     {
       return Op::protomap ();
     }
+
+    std::shared_ptr <builtin>
+    reduce (tree const &assertion) const override
+    {
+      return Op::reduce (assertion);
+    }
   };
 
   add_overload (Op::get_selector (),
@@ -382,6 +414,10 @@ public:
   // the docstring () static itself.
   static std::string docstring ()
   { return ""; }
+
+  // Likewise for strength reduction.  See builtin::reduce.
+  static std::shared_ptr <builtin> reduce (tree const &assertion)
+  { return nullptr; }
 };
 
 template <class RT, class... VT>
@@ -417,6 +453,35 @@ public:
     return nullptr;
   }
 
+  // Map over a block of stacks from upstream, dropping those for
+  // which operate yields nothing.
+  size_t
+  next_batch (std::vector <stack::uptr> &out, size_t n) override final
+  {
+    size_t start = out.size ();
+    while (out.size () == start)
+      {
+	if (this->m_upstream->next_batch (out, n) == 0)
+	  return 0;
+
+	size_t j = start;
+	for (size_t i = start; i < out.size (); ++i)
+	  if (auto nv = call_operate
+		(std::index_sequence_for <VT...> {},
+		 op_overload_impl <VT...>::template collect <0, VT...>
+			(*out[i])))
+	    {
+	      out[i]->push (std::move (nv));
+	      if (i != j)
+		out[j] = std::move (out[i]);
+	      ++j;
+	    }
+	out.resize (j);
+      }
+
+    return out.size () - start;
+  }
+
   virtual std::unique_ptr <RT> operate (std::unique_ptr <VT>... vals) = 0;
 
   static builtin_protomap
@@ -461,6 +526,22 @@ public:
     return nullptr;
   }
 
+  size_t
+  next_batch (std::vector <stack::uptr> &out, size_t n) override final
+  {
+    size_t start = out.size ();
+    size_t ret = this->m_upstream->next_batch (out, n);
+    for (size_t i = start; i < out.size (); ++i)
+      {
+	auto v = call_operate
+		(std::index_sequence_for <VT...> {},
+		 op_overload_impl <VT...>::template collect <0, VT...>
+			(*out[i]));
+	out[i]->push (std::make_unique <RT> (std::move (v)));
+      }
+    return ret;
+  }
+
   virtual RT operate (std::unique_ptr <VT>... vals) = 0;
 
   static builtin_protomap
@@ -488,22 +569,27 @@ class op_yielding_overload
   stack::uptr m_stk;
   std::unique_ptr <value_producer <RT>> m_prod;
 
+  // Values are taken from the producer in blocks when a batch is
+  // asked for, and one at a time otherwise.
+  std::vector <std::unique_ptr <RT>> m_vals;
+  size_t m_i;
+
   void
   reset_me ()
   {
     m_prod = nullptr;
     m_stk = nullptr;
+    m_vals.clear ();
+    m_i = 0;
   }
 
-public:
-  op_yielding_overload (std::shared_ptr <op> upstream)
-    : stub_op {upstream}
-  {}
-
-  stack::uptr
-  next () override final
+  // Make sure there's a value to hand out, taking up to N more from
+  // the producer if needed.  Returns false if both the producer and
+  // upstream are drained.
+  bool
+  fill (size_t n)
   {
-    while (true)
+    while (m_i == m_vals.size ())
       {
 	while (m_prod == nullptr)
 	  if (auto stk = this->m_upstream->next ())
@@ -514,17 +600,46 @@ public:
 	      m_stk = std::move (stk);
 	    }
 	  else
-	    return nullptr;
+	    return false;
 
-	if (auto v = m_prod->next ())
-	  {
-	    auto ret = std::make_unique <stack> (*m_stk);
-	    ret->push (std::move (v));
-	    return ret;
-	  }
-
-	reset_me ();
+	m_vals.clear ();
+	m_i = 0;
+	if (m_prod->next_batch (m_vals, n) == 0)
+	  reset_me ();
       }
+
+    return true;
+  }
+
+  stack::uptr
+  take ()
+  {
+    auto ret = std::make_unique <stack> (*m_stk);
+    ret->push (std::move (m_vals[m_i++]));
+    return ret;
+  }
+
+public:
+  op_yielding_overload (std::shared_ptr <op> upstream)
+    : stub_op {upstream}
+    , m_i {0}
+  {}
+
+  stack::uptr
+  next () override final
+  {
+    if (! fill (1))
+      return nullptr;
+    return take ();
+  }
+
+  size_t
+  next_batch (std::vector <stack::uptr> &out, size_t n) override final
+  {
+    size_t ret = 0;
+    for (; ret < n && fill (n - ret); ++ret)
+      out.push_back (take ());
+    return ret;
   }
 
   void
@@ -550,12 +665,13 @@ template <class... VT>
 struct pred_overload
   : public stub_pred
 {
+  // Values are only looked at, and may be shared with other stacks.
   template <class T>
-  static std::tuple <T &> collect1 (stack &stk, size_t depth)
+  static std::tuple <T const &> collect1 (stack &stk, size_t depth)
   {
     auto dv = stk.get_as <T> (depth);
     assert (dv != nullptr);
-    return std::tuple <T &> (*dv);
+    return std::tuple <T const &> (*dv);
   }
 
   template <size_t N>
@@ -565,7 +681,7 @@ struct pred_overload
   }
 
   template <size_t N, class T, class... Ts>
-  static std::tuple <T &, Ts &...> collect (stack &stk)
+  static std::tuple <T const &, Ts const &...> collect (stack &stk)
   {
     auto rest = collect <N - 1, Ts...> (stk);
     return std::tuple_cat (collect1 <T> (stk, N - 1), rest);
@@ -573,7 +689,7 @@ struct pred_overload
 
   template <size_t... I>
   pred_result
-  call_result (std::index_sequence <I...>, std::tuple <VT &...> args)
+  call_result (std::index_sequence <I...>, std::tuple <VT const &...> args)
   {
     return result (std::get <I> (args)...);
   }
@@ -586,7 +702,7 @@ public:
 			collect <sizeof... (VT), VT...> (stk));
   }
 
-  virtual pred_result result (VT &... vals) = 0;
+  virtual pred_result result (VT const &... vals) = 0;
 
   static selector get_selector ()
   { return {VT::vtype...}; }
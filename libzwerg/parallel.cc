@@ -0,0 +1,389 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "builtin-dw.hh"
+#include "parallel.hh"
+#include "scope.hh"
+#include "tree.hh"
+
+namespace
+{
+  // How many stacks a branch may produce ahead of the consumer before
+  // it waits for it to catch up.
+  size_t const max_queued = 1024;
+}
+
+struct op_parallel::pimpl
+{
+  struct branch
+  {
+    std::shared_ptr <op_origin> m_origin;
+    std::shared_ptr <op> m_op;
+    std::deque <stack::uptr> m_queue;
+    std::exception_ptr m_exc;
+    bool m_done;
+
+    explicit branch (branch_t br)
+      : m_origin {br.first}
+      , m_op {br.second}
+      , m_done {false}
+    {}
+  };
+
+  std::shared_ptr <op> m_upstream;
+  std::deque <branch> m_branches;
+  std::vector <std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  size_t m_cur;
+  bool m_running;
+  bool m_cancel;
+
+  pimpl (std::shared_ptr <op> upstream, std::vector <branch_t> branches)
+    : m_upstream {upstream}
+    , m_cur {0}
+    , m_running {false}
+    , m_cancel {false}
+  {
+    for (auto &br: branches)
+      m_branches.emplace_back (br);
+  }
+
+  ~pimpl ()
+  {
+    stop ();
+  }
+
+  void
+  run_branch (branch &br)
+  {
+    try
+      {
+	while (auto stk = br.m_op->next ())
+	  {
+	    // The stack may share nodes with stacks that this thread
+	    // still works with.
+	    stk = stk->clone ();
+
+	    std::unique_lock <std::mutex> lock {m_mutex};
+	    m_cv.wait (lock, [&] () {
+		return m_cancel || br.m_queue.size () < max_queued;
+	      });
+	    if (m_cancel)
+	      break;
+	    br.m_queue.push_back (std::move (stk));
+	    m_cv.notify_all ();
+	  }
+      }
+    catch (...)
+      {
+	std::lock_guard <std::mutex> lock {m_mutex};
+	br.m_exc = std::current_exception ();
+      }
+
+    std::lock_guard <std::mutex> lock {m_mutex};
+    br.m_done = true;
+    m_cv.notify_all ();
+  }
+
+  void
+  start (stack::uptr stk)
+  {
+    assert (! m_running);
+    for (auto &br: m_branches)
+      {
+	br.m_op->reset ();
+	br.m_origin->set_next (stk->clone ());
+      }
+
+    m_cur = 0;
+    m_running = true;
+    for (auto &br: m_branches)
+      m_threads.emplace_back ([this, &br] () { run_branch (br); });
+  }
+
+  void
+  stop ()
+  {
+    {
+      std::lock_guard <std::mutex> lock {m_mutex};
+      m_cancel = true;
+      m_cv.notify_all ();
+    }
+
+    for (auto &thr: m_threads)
+      thr.join ();
+    m_threads.clear ();
+
+    for (auto &br: m_branches)
+      {
+	br.m_queue.clear ();
+	br.m_exc = nullptr;
+	br.m_done = false;
+      }
+
+    m_cancel = false;
+    m_running = false;
+  }
+
+  stack::uptr
+  next ()
+  {
+    while (true)
+      {
+	if (! m_running)
+	  {
+	    if (auto stk = m_upstream->next ())
+	      start (std::move (stk));
+	    else
+	      return nullptr;
+	  }
+
+	for (; m_cur < m_branches.size (); ++m_cur)
+	  {
+	    branch &br = m_branches[m_cur];
+	    std::unique_lock <std::mutex> lock {m_mutex};
+	    m_cv.wait (lock, [&] () {
+		return ! br.m_queue.empty () || br.m_done;
+	      });
+
+	    if (! br.m_queue.empty ())
+	      {
+		auto ret = std::move (br.m_queue.front ());
+		br.m_queue.pop_front ();
+		m_cv.notify_all ();
+		return ret;
+	      }
+
+	    if (br.m_exc != nullptr)
+	      {
+		auto exc = br.m_exc;
+		lock.unlock ();
+		stop ();
+		std::rethrow_exception (exc);
+	      }
+	  }
+
+	stop ();
+      }
+  }
+
+  void
+  reset ()
+  {
+    stop ();
+    m_upstream->reset ();
+  }
+};
+
+op_parallel::op_parallel (std::shared_ptr <op> upstream,
+			  std::vector <branch_t> branches)
+  : m_pimpl {std::make_unique <pimpl> (upstream, branches)}
+{}
+
+op_parallel::~op_parallel ()
+{}
+
+stack::uptr
+op_parallel::next ()
+{
+  return m_pimpl->next ();
+}
+
+void
+op_parallel::reset ()
+{
+  m_pimpl->reset ();
+}
+
+std::string
+op_parallel::name () const
+{
+  std::string ret = "parallel<";
+  bool seen = false;
+  for (auto const &br: m_pimpl->m_branches)
+    {
+      if (seen)
+	ret += ", ";
+      seen = true;
+      ret += br.m_op->name ();
+    }
+  return ret + ">";
+}
+
+
+namespace
+{
+  // Split QUERY to the leading word and the rest.  Returns nullptr if
+  // QUERY doesn't start with a word.
+  tree const *
+  split_head (tree const &query, tree &rest)
+  {
+    if (query.tt () == tree_type::F_BUILTIN)
+      {
+	rest = tree {tree_type::NOP};
+	return &query;
+      }
+
+    if (query.tt () == tree_type::CAT
+	&& query.child (0).tt () == tree_type::F_BUILTIN)
+      {
+	rest = tree {tree_type::CAT};
+	for (size_t i = 1; i < query.m_children.size (); ++i)
+	  rest.push_child (query.child (i));
+	return &query.child (0);
+      }
+
+    return nullptr;
+  }
+}
+
+std::shared_ptr <op>
+build_parallel_exec (tree const &query, stack const &input, unsigned nthreads)
+{
+  auto serial = [&] () {
+    return query.build_exec
+      (std::make_shared <op_origin> (std::make_unique <stack> (input)));
+  };
+
+  if (nthreads <= 1 || input.size () == 0)
+    return serial ();
+
+  auto dw = value::as <value_dwarf> (&input.get (0));
+  if (dw == nullptr)
+    return serial ();
+
+  // Whatever ends up evaluated over the input Dwarf itself may as
+  // well build its caches in parallel.
+  dw->get_dwctx ()->set_threads (nthreads);
+
+  // The query may be wrapped in a scope that holds its variables.
+  // In that case split the scope body instead and wrap each branch
+  // in a scope of its own.
+  tree const *body = &query;
+  if (body->tt () == tree_type::SCOPE)
+    body = &body->child (0);
+
+  tree rest;
+  tree const *head = split_head (*body, rest);
+  if (head == nullptr)
+    return serial ();
+
+  bool entry = is_builtin (*head, "entry");
+  if (! entry && ! is_builtin (*head, "unit"))
+    return serial ();
+
+  // Positions of DIE's yielded by op_entry_dwarf_slice only count
+  // from the beginning of their slice.
+  if (entry && mentions_builtin (query, "pos"))
+    return serial ();
+
+  // Each slice would count towards its own limit.
+  if (mentions_builtin (query, "limit"))
+    return serial ();
+
+  // libdw isn't safe to use from several threads over one Dwarf, so
+  // each slice gets a Dwarf of its own, opened anew from the same
+  // file.  Unit lists of all these are computed up front so that the
+  // slices can be cut consistently.
+  std::vector <std::shared_ptr <dwfl_context>> dwctxs;
+  std::vector <std::shared_ptr <unit_list const>> units;
+  size_t nunits = dwarf_units (dw->get_dwctx (), dw->get_doneness ()).size ();
+  size_t nslices = std::min <size_t> (nthreads, nunits);
+  if (nslices <= 1)
+    return serial ();
+
+  for (size_t i = 0; i < nslices; ++i)
+    {
+      std::shared_ptr <dwfl_context> dwctx;
+      try
+	{
+	  dwctx = value_dwarf (dw->get_fn (), 0, dw->get_doneness ())
+	    .get_dwctx ();
+	}
+      catch (std::runtime_error const &e)
+	{
+	  // E.g. a Dwarf that was not opened from a file.
+	  return serial ();
+	}
+
+      dwctx->copy_settings (*dw->get_dwctx ());
+      auto ul = std::make_shared <unit_list const>
+	(dwarf_units (dwctx, dw->get_doneness ()));
+      if (ul->size () != nunits)
+	return serial ();
+
+      dwctxs.push_back (dwctx);
+      units.push_back (ul);
+    }
+
+  std::vector <op_parallel::branch_t> branches;
+  for (size_t i = 0; i < nslices; ++i)
+    {
+      size_t begin = nunits * i / nslices;
+      size_t end = nunits * (i + 1) / nslices;
+
+      auto origin = std::make_shared <op_origin> (nullptr);
+      auto build_body = [&] (std::shared_ptr <op> upstream)
+	{
+	  std::shared_ptr <op> op;
+	  if (entry)
+	    op = std::make_shared <op_entry_dwarf_slice>
+	      (upstream, dwctxs[i], units[i], begin, end);
+	  else
+	    op = std::make_shared <op_unit_dwarf_slice>
+	      (upstream, dwctxs[i], units[i], begin, end);
+	  return rest.build_exec (op);
+	};
+
+      std::shared_ptr <op> op;
+      if (body != &query)
+	{
+	  auto scope_origin = std::make_shared <op_origin> (nullptr);
+	  op = std::make_shared <op_scope> (origin, scope_origin,
+					    build_body (scope_origin),
+					    query.scp ()->num_names ());
+	}
+      else
+	op = build_body (origin);
+
+      branches.push_back (std::make_pair (origin, op));
+    }
+
+  return std::make_shared <op_parallel>
+    (std::make_shared <op_origin> (std::make_unique <stack> (input)),
+     std::move (branches));
+}
@@ -0,0 +1,80 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <memory>
+#include <vector>
+
+#include "op.hh"
+
+struct tree;
+
+// Evaluate several independent branches, each in its own thread.
+// Each stack that comes from upstream is fed to origins of all
+// branches, and results are yielded in order of branches: first
+// everything that the first branch produced, then everything from
+// the second one, etc.  Thus the output is the same as if the
+// branches were evaluated one after another.
+class op_parallel
+  : public op
+{
+  struct pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+public:
+  typedef std::pair <std::shared_ptr <op_origin>,
+		     std::shared_ptr <op>> branch_t;
+
+  op_parallel (std::shared_ptr <op> upstream,
+	       std::vector <branch_t> branches);
+  ~op_parallel ();
+
+  stack::uptr next () override;
+  void reset () override;
+  std::string name () const override;
+};
+
+// Build an op that evaluates QUERY over INPUT.  If QUERY starts with
+// `unit' or `entry' and there's a Dwarf on TOS of INPUT, units of
+// that Dwarf are split into at most NTHREADS slices, and the query
+// is evaluated over each of them in a separate thread.  Otherwise
+// (or when there's nothing to split) the query is built as usual.
+//
+// Each slice is evaluated over a Dwarf of its own, opened anew from
+// the same file, because libdw can't be used concurrently over one
+// Dwarf.  Values yielded by different slices thus don't compare
+// equal to each other, or to values of the input Dwarf, by identity.
+// Caches of the input Dwarf are allowed to use up to NTHREADS
+// threads (see dwfl_context::set_threads).
+std::shared_ptr <op> build_parallel_exec (tree const &query,
+					  stack const &input,
+					  unsigned nthreads);
+
+#endif /* _PARALLEL_H_ */
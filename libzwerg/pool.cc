@@ -0,0 +1,164 @@
+/*
+   Copyright (C) 2014, 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <new>
+
+#include "pool.hh"
+
+namespace
+{
+  // Size classes are multiples of GRANULE bytes, up to NCLASSES *
+  // GRANULE.  That covers stacks as well as all the common value
+  // types.
+  size_t const GRANULE = 16;
+  size_t const NCLASSES = 16;
+
+  // Upper bound on the number of blocks cached per size class.
+  size_t const MAX_CACHED = 1024;
+
+  struct free_block
+  {
+    free_block *m_next;
+  };
+
+  // Set when this thread's free lists have been destroyed.  Objects
+  // may still be released after that point (e.g. by destructors of
+  // other thread-local or static objects), those go straight to the
+  // global allocator.  This is a POD, and as such is still accessible
+  // after thread-local destructors have run.
+  thread_local bool lists_gone = false;
+
+  struct free_lists
+  {
+    free_block *m_heads[NCLASSES];
+    size_t m_counts[NCLASSES];
+
+    free_lists ()
+      : m_heads {}
+      , m_counts {}
+    {}
+
+    ~free_lists ()
+    {
+      trim ();
+      lists_gone = true;
+    }
+
+    void
+    trim ()
+    {
+      for (size_t i = 0; i < NCLASSES; ++i)
+	{
+	  while (m_heads[i] != nullptr)
+	    {
+	      free_block *blk = m_heads[i];
+	      m_heads[i] = blk->m_next;
+	      ::operator delete (blk);
+	    }
+	  m_counts[i] = 0;
+	}
+    }
+  };
+
+  thread_local free_lists lists;
+  thread_local size_t allocations = 0;
+
+  size_t
+  size_class (size_t size)
+  {
+    return (size + GRANULE - 1) / GRANULE;
+  }
+}
+
+void *
+pool_allocate (size_t size)
+{
+  ++allocations;
+  size_t cls = size_class (size);
+  if (cls == 0 || cls > NCLASSES || lists_gone)
+    return ::operator new (size);
+
+  size_t i = cls - 1;
+  if (free_block *blk = lists.m_heads[i])
+    {
+      lists.m_heads[i] = blk->m_next;
+      --lists.m_counts[i];
+      return blk;
+    }
+
+  // Allocate the whole size class, so that the block can later be
+  // reused for any request that falls into the same class.
+  return ::operator new (cls * GRANULE);
+}
+
+void
+pool_release (void *ptr, size_t size)
+{
+  if (ptr == nullptr)
+    return;
+
+  size_t cls = size_class (size);
+  if (cls == 0 || cls > NCLASSES || lists_gone
+      || lists.m_counts[cls - 1] >= MAX_CACHED)
+    {
+      ::operator delete (ptr);
+      return;
+    }
+
+  size_t i = cls - 1;
+  free_block *blk = static_cast <free_block *> (ptr);
+  blk->m_next = lists.m_heads[i];
+  lists.m_heads[i] = blk;
+  ++lists.m_counts[i];
+}
+
+size_t
+pool_cached ()
+{
+  if (lists_gone)
+    return 0;
+
+  size_t ret = 0;
+  for (size_t i = 0; i < NCLASSES; ++i)
+    ret += lists.m_counts[i];
+  return ret;
+}
+
+size_t
+pool_allocations ()
+{
+  return allocations;
+}
+
+void
+pool_trim ()
+{
+  if (! lists_gone)
+    lists.trim ();
+}
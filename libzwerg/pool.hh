@@ -0,0 +1,123 @@
+/*
+   Copyright (C) 2014, 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <cstddef>
+
+// Query evaluation creates and destroys stacks and values at a very
+// high rate--nearly every op clones its input stack and pushes a
+// freshly allocated value or two.  Those objects are small and come
+// in only a handful of sizes, so instead of going to the global
+// allocator each time, they are recycled through per-thread free
+// lists segregated by size.
+//
+// The lists are per-thread, so no locking is involved.  Blocks
+// released in a different thread than they were allocated in simply
+// migrate to the releasing thread's list.  The number of cached
+// blocks per size class is bounded, anything above that, as well as
+// requests larger than the largest size class, goes straight to the
+// global allocator.
+
+void *pool_allocate (size_t size);
+void pool_release (void *ptr, size_t size);
+
+// Number of blocks currently cached on this thread's free lists.
+size_t pool_cached ();
+
+// Number of blocks handed out by pool_allocate on this thread so far.
+// This is used for profiling (see profile.hh).
+size_t pool_allocations ();
+
+// Release all blocks cached on this thread's free lists back to the
+// global allocator.
+void pool_trim ();
+
+// Classes that inherit from pooled get their instances allocated
+// through the above.  For polymorphic classes, the destructor needs
+// to be virtual, so that the right size is passed to the sized
+// operator delete.
+struct pooled
+{
+  static void *
+  operator new (size_t size)
+  {
+    return pool_allocate (size);
+  }
+
+  static void
+  operator delete (void *ptr, size_t size)
+  {
+    pool_release (ptr, size);
+  }
+};
+
+// An allocator for objects that are not classes of our own, such as
+// the blocks that std::allocate_shared puts an object and its
+// reference counts in.
+template <class T>
+struct pool_allocator
+{
+  typedef T value_type;
+
+  pool_allocator () = default;
+
+  template <class U>
+  pool_allocator (pool_allocator <U> const &)
+  {}
+
+  T *
+  allocate (size_t n)
+  {
+    return static_cast <T *> (pool_allocate (n * sizeof (T)));
+  }
+
+  void
+  deallocate (T *ptr, size_t n)
+  {
+    pool_release (ptr, n * sizeof (T));
+  }
+};
+
+template <class T, class U>
+bool
+operator== (pool_allocator <T> const &, pool_allocator <U> const &)
+{
+  return true;
+}
+
+template <class T, class U>
+bool
+operator!= (pool_allocator <T> const &, pool_allocator <U> const &)
+{
+  return false;
+}
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,280 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <cassert>
+
+#include "pool.hh"
+#include "std-memory.hh"
+#include "profile.hh"
+#include "tree.hh"
+
+namespace
+{
+  thread_local profiler *current_profiler = nullptr;
+
+  // A call into an instrumented op or pred.  Calls nest, and each
+  // one subtracts time and allocations of calls nested in it from its
+  // own.
+  class profile_call
+  {
+    profile_node &m_node;
+    profile_call *m_outer;
+    profile_node::clock::time_point m_start;
+    size_t m_start_allocs;
+    profile_node::clock::duration m_nested_time;
+    size_t m_nested_allocs;
+
+    static thread_local profile_call *s_current;
+
+  public:
+    explicit profile_call (profile_node &node)
+      : m_node (node)
+      , m_outer {s_current}
+      , m_start {profile_node::clock::now ()}
+      , m_start_allocs {pool_allocations ()}
+      , m_nested_time {0}
+      , m_nested_allocs {0}
+    {
+      s_current = this;
+      ++m_node.m_calls;
+    }
+
+    ~profile_call ()
+    {
+      auto time = profile_node::clock::now () - m_start;
+      size_t allocs = pool_allocations () - m_start_allocs;
+
+      m_node.m_time += time;
+      m_node.m_self_time += time - m_nested_time;
+      m_node.m_allocs += allocs;
+      m_node.m_self_allocs += allocs - m_nested_allocs;
+
+      s_current = m_outer;
+      if (m_outer != nullptr)
+	{
+	  m_outer->m_nested_time += time;
+	  m_outer->m_nested_allocs += allocs;
+	}
+    }
+  };
+
+  thread_local profile_call *profile_call::s_current = nullptr;
+
+  class op_profile
+    : public op
+  {
+    std::shared_ptr <op> m_op;
+    profile_node &m_node;
+
+  public:
+    op_profile (std::shared_ptr <op> op, profile_node &node)
+      : m_op {op}
+      , m_node (node)
+    {}
+
+    stack::uptr
+    next () override
+    {
+      profile_call call {m_node};
+      auto ret = m_op->next ();
+      if (ret != nullptr)
+	++m_node.m_produced;
+      return ret;
+    }
+
+    size_t
+    next_batch (std::vector <stack::uptr> &out, size_t n) override
+    {
+      profile_call call {m_node};
+      size_t ret = m_op->next_batch (out, n);
+      m_node.m_produced += ret;
+      return ret;
+    }
+
+    void
+    reset () override
+    {
+      m_op->reset ();
+    }
+
+    std::string
+    name () const override
+    {
+      return m_op->name ();
+    }
+  };
+
+  class pred_profile
+    : public pred
+  {
+    std::unique_ptr <pred> m_pred;
+    profile_node &m_node;
+
+  public:
+    pred_profile (std::unique_ptr <pred> pred, profile_node &node)
+      : m_pred {std::move (pred)}
+      , m_node (node)
+    {}
+
+    pred_result
+    result (stack &stk) override
+    {
+      profile_call call {m_node};
+      auto ret = m_pred->result (stk);
+      if (ret == pred_result::yes)
+	++m_node.m_produced;
+      else
+	++m_node.m_rejected;
+      return ret;
+    }
+
+    void
+    reset () override
+    {
+      m_pred->reset ();
+    }
+
+    std::string
+    name () const override
+    {
+      return m_pred->name ();
+    }
+  };
+}
+
+profile_node::profile_node (std::string label)
+  : m_label {label}
+  , m_calls {0}
+  , m_produced {0}
+  , m_rejected {0}
+  , m_time {0}
+  , m_self_time {0}
+  , m_allocs {0}
+  , m_self_allocs {0}
+  , m_memo_hits {0}
+  , m_memo_misses {0}
+{}
+
+void
+profile_node::format (std::ostream &os, unsigned depth) const
+{
+  typedef std::chrono::duration <double, std::milli> ms;
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision (3)
+     << std::string (2 * depth, ' ') << m_label
+     << "  (calls=" << m_calls << " produced=" << m_produced;
+  if (m_rejected != 0)
+    ss << " rejected=" << m_rejected;
+  if (m_memo_hits != 0 || m_memo_misses != 0)
+    ss << " memo_hits=" << m_memo_hits << " memo_misses=" << m_memo_misses;
+  ss << " time=" << ms (m_time).count ()
+     << "ms self=" << ms (m_self_time).count ()
+     << "ms allocs=" << m_allocs << " self=" << m_self_allocs << ")\n";
+  os << ss.str ();
+
+  for (auto const &child: m_children)
+    child->format (os, depth + 1);
+}
+
+profiler::profiler ()
+  : m_root {"query"}
+{
+  m_building.push_back (&m_root);
+}
+
+profiler::install::install (profiler &prof)
+  : m_prev {current_profiler}
+{
+  current_profiler = &prof;
+}
+
+profiler::install::~install ()
+{
+  current_profiler = m_prev;
+}
+
+profiler *
+profiler::current ()
+{
+  return current_profiler;
+}
+
+profile_node &
+profiler::enter (tree const &t)
+{
+  // Label the node the way the tree would be dumped, but without the
+  // sub-trees.
+  tree bare = t;
+  bare.m_children.clear ();
+  std::stringstream ss;
+  ss << bare;
+  std::string label = ss.str ();
+
+  auto &children = m_building.back ()->m_children;
+  children.push_back
+    (std::make_unique <profile_node> (label.substr (1, label.size () - 2)));
+  m_building.push_back (children.back ().get ());
+  return *m_building.back ();
+}
+
+void
+profiler::leave ()
+{
+  assert (m_building.size () > 1);
+  m_building.pop_back ();
+}
+
+profile_node &
+profiler::building ()
+{
+  return *m_building.back ();
+}
+
+void
+profiler::format (std::ostream &os) const
+{
+  for (auto const &child: m_root.m_children)
+    child->format (os, 0);
+}
+
+std::shared_ptr <op>
+profile_op (std::shared_ptr <op> op, profile_node &node)
+{
+  return std::make_shared <op_profile> (op, node);
+}
+
+std::unique_ptr <pred>
+profile_pred (std::unique_ptr <pred> pred, profile_node &node)
+{
+  return std::make_unique <pred_profile> (std::move (pred), node);
+}
@@ -0,0 +1,128 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "op.hh"
+
+// Per-op profiling.  While a profiler is installed on a thread (see
+// profiler::install), each op and pred that tree::build_exec and
+// tree::build_pred create on that thread is wrapped in a node that
+// records what it did.  The nodes form a tree that follows the
+// structure of the query, and that can be formatted as a plan
+// annotated with the gathered statistics.
+//
+// Time and allocations are recorded both inclusive and exclusive of
+// other instrumented nodes that are called in the meantime.  Since an
+// op calls its upstream to get its input, inclusive figures of an op
+// cover everything that comes before it in the same expression.
+class profile_node
+{
+public:
+  typedef std::chrono::steady_clock clock;
+
+  std::string m_label;
+  std::vector <std::unique_ptr <profile_node>> m_children;
+
+  // Number of calls to next or result.
+  uint64_t m_calls;
+
+  // Number of stacks produced, or that a predicate held for.
+  uint64_t m_produced;
+
+  // Number of stacks that a predicate didn't hold for.
+  uint64_t m_rejected;
+
+  clock::duration m_time;
+  clock::duration m_self_time;
+
+  // Number of stacks and values allocated.
+  uint64_t m_allocs;
+  uint64_t m_self_allocs;
+
+  // Number of lookups of an op_memo that were answered from its
+  // cache, and that weren't.
+  uint64_t m_memo_hits;
+  uint64_t m_memo_misses;
+
+  explicit profile_node (std::string label);
+
+  void format (std::ostream &os, unsigned depth) const;
+};
+
+class profiler
+{
+  profile_node m_root;
+  std::vector <profile_node *> m_building;
+
+public:
+  profiler ();
+
+  // While an object of this class exists, queries built on this
+  // thread are instrumented by a given profiler.
+  class install
+  {
+    profiler *m_prev;
+
+  public:
+    explicit install (profiler &prof);
+    ~install ();
+  };
+
+  // Profiler installed on this thread, or nullptr.
+  static profiler *current ();
+
+  // Track nodes that are built for parts of tree T in a new profile
+  // node nested in the one that is currently being built.
+  profile_node &enter (tree const &t);
+  void leave ();
+
+  // The node that is currently being built.
+  profile_node &building ();
+
+  // Write the plan with statistics to OS.
+  void format (std::ostream &os) const;
+};
+
+// Wrap OP so that it records statistics in NODE.
+std::shared_ptr <op> profile_op (std::shared_ptr <op> op,
+				 profile_node &node);
+
+// Wrap PRED so that it records statistics in NODE.
+std::unique_ptr <pred> profile_pred (std::unique_ptr <pred> pred,
+				     profile_node &node);
+
+#endif /* _PROFILE_H_ */
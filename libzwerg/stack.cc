@@ -26,6 +26,7 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include "std-memory.hh"
 #include "stack.hh"
 #include "value-closure.hh"
 
@@ -74,30 +75,90 @@ frame::~frame ()
 }
 
 stack::stack (stack const &that)
-  : m_frame {that.m_frame != nullptr ? that.m_frame->clone () : nullptr}
-  , m_profile {that.m_profile}
+  : m_top {that.m_top}
+  , m_size {that.m_size}
+  , m_frame {that.m_frame != nullptr ? that.m_frame->clone () : nullptr}
+{}
+
+selector::sel_t
+stack::profile () const
+{
+  selector::sel_t ret = 0;
+  stack_node const *n = m_top.get ();
+  for (unsigned i = 0; i < selector::W && n != nullptr;
+       ++i, n = n->m_next.get ())
+    ret |= ((selector::sel_t) n->m_value->get_type ().code ()) << (8 * i);
+  return ret;
+}
+
+std::unique_ptr <value>
+stack::pop ()
+{
+  need (1);
+  auto n = std::move (m_top);
+  m_top = n->m_next;
+  --m_size;
+
+  // If nobody else refers to the node, the value can be taken over.
+  // Otherwise it's shared with another stack and needs to be cloned.
+  return n.use_count () == 1 ? std::move (n->m_value) : n->m_value->clone ();
+}
+
+value &
+stack::mutable_top ()
 {
-  for (auto const &v: that.m_values)
-    m_values.push_back (v->clone ());
+  need (1);
+  if (m_top.use_count () != 1)
+    m_top = stack_node::make (m_top->m_value->clone (), m_top->m_next);
+  return *m_top->m_value;
+}
+
+stack::uptr
+stack::clone () const
+{
+  std::vector <value const *> vals;
+  for (stack_node const *n = m_top.get (); n != nullptr;
+       n = n->m_next.get ())
+    vals.push_back (n->m_value.get ());
+
+  auto ret = std::make_unique <stack> ();
+  ret->m_frame = m_frame != nullptr ? m_frame->clone () : nullptr;
+  for (auto it = vals.rbegin (); it != vals.rend (); ++it)
+    ret->push ((*it)->clone ());
+  return ret;
 }
 
 namespace
 {
+  // Collect values of the two stacks from the top down, up to the
+  // first node that the two have in common.  Since the stacks are of
+  // the same size, everything below that node is the same in both.
+  void
+  differing_values (stack_node const *a, stack_node const *b,
+		    std::vector <value const *> &va,
+		    std::vector <value const *> &vb)
+  {
+    for (; a != b; a = a->m_next.get (), b = b->m_next.get ())
+      {
+	va.push_back (a->m_value.get ());
+	vb.push_back (b->m_value.get ());
+      }
+  }
+
+  // A and B are listed from the top of the stack down, but are
+  // compared bottom-up.
   int
-  compare_stack (std::vector <std::unique_ptr <value> > const &a,
-	       std::vector <std::unique_ptr <value> > const &b)
+  compare_stack (std::vector <value const *> const &a,
+		 std::vector <value const *> const &b)
   {
-    if (a.size () < b.size ())
-      return -1;
-    else if (a.size () > b.size ())
-      return 1;
+    assert (a.size () == b.size ());
 
     // The stack that has nullptr where the other has non-nullptr is
     // smaller.
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
+      auto it = a.rbegin ();
+      auto jt = b.rbegin ();
+      for (; it != a.rend (); ++it, ++jt)
 	if (*it == nullptr && *jt != nullptr)
 	  return -1;
 	else if (*it != nullptr && *jt == nullptr)
@@ -106,9 +167,9 @@ namespace
 
     // The stack with "smaller" types is smaller.
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
+      auto it = a.rbegin ();
+      auto jt = b.rbegin ();
+      for (; it != a.rend (); ++it, ++jt)
 	if (*it != nullptr && *jt != nullptr)
 	  {
 	    if ((*it)->get_type () < (*jt)->get_type ())
@@ -121,9 +182,9 @@ namespace
     // We have the same number of slots with values of the same type.
     // Now compare the values directly.
     {
-      auto it = a.begin ();
-      auto jt = b.begin ();
-      for (; it != a.end (); ++it, ++jt)
+      auto it = a.rbegin ();
+      auto jt = b.rbegin ();
+      for (; it != a.rend (); ++it, ++jt)
 	if (*it != nullptr && *jt != nullptr)
 	  switch ((*it)->cmp (**jt))
 	    {
@@ -144,16 +205,38 @@ namespace
   }
 }
 
+int
+stack::compare (stack const &that) const
+{
+  if (m_size < that.m_size)
+    return -1;
+  else if (m_size > that.m_size)
+    return 1;
+
+  std::vector <value const *> va, vb;
+  differing_values (m_top.get (), that.m_top.get (), va, vb);
+  return compare_stack (va, vb);
+}
+
+size_t
+stack::hash () const
+{
+  size_t ret = m_size;
+  for (stack_node const *n = m_top.get (); n != nullptr; n = n->m_next.get ())
+    ret = hash_combine (ret, n->m_value->hash ());
+  return ret;
+}
+
 bool
 stack::operator< (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) < 0;
+  return compare (that) < 0;
 }
 
 bool
 stack::operator== (stack const &that) const
 {
-  return compare_stack (m_values, that.m_values) == 0;
+  return compare (that) == 0;
 }
 
 stack::~stack ()
@@ -34,6 +34,7 @@
 
 #include "value.hh"
 #include "selector.hh"
+#include "pool.hh"
 
 enum var_id: unsigned {};
 
@@ -58,19 +59,64 @@ struct frame
   std::shared_ptr <frame> clone () const;
 };
 
+// A node of a value stack.  Nodes are linked from the top of the
+// stack towards the bottom, and are shared between stacks that were
+// copied from one another.  A shared node is never modified, a stack
+// that needs to change a shared value takes a private copy of it.
+struct stack_node
+{
+  std::unique_ptr <value> m_value;
+  std::shared_ptr <stack_node> m_next;
+
+  stack_node (std::unique_ptr <value> value,
+	      std::shared_ptr <stack_node> next)
+    : m_value {std::move (value)}
+    , m_next {std::move (next)}
+  {}
+
+  // Nodes are made on every push, so they come from the pool, along
+  // with their reference counts.
+  static std::shared_ptr <stack_node>
+  make (std::unique_ptr <value> value, std::shared_ptr <stack_node> next)
+  {
+    return std::allocate_shared <stack_node>
+      (pool_allocator <stack_node> {}, std::move (value), std::move (next));
+  }
+};
+
 // Value file is a container type that's used for maintaining stacks
 // of dwgrep values.
+//
+// Copying a stack is cheap: the copy shares the value nodes of the
+// original, and values are only cloned when they are popped off a
+// stack while some other stack still refers to them.  Values obtained
+// through top, get and friends may therefore be shared with other
+// stacks and must not be modified.  Pop the value to get a private
+// copy instead.
 class stack
+  : public pooled
 {
-  std::vector <std::unique_ptr <value>> m_values;
+  std::shared_ptr <stack_node> m_top;
+  size_t m_size;
   std::shared_ptr <frame> m_frame;
-  selector::sel_t m_profile;
+
+  stack_node const &
+  node (unsigned depth) const
+  {
+    need (depth + 1);
+    stack_node const *n = m_top.get ();
+    for (unsigned i = 0; i < depth; ++i)
+      n = n->m_next.get ();
+    return *n;
+  }
+
+  int compare (stack const &that) const;
 
 public:
   typedef std::unique_ptr <stack> uptr;
 
   stack ()
-    : m_profile {0}
+    : m_size {0}
   {}
 
   stack (stack const &other);
@@ -95,44 +141,30 @@ public:
   size_t
   size () const
   {
-    return m_values.size ();
+    return m_size;
   }
 
-  selector::sel_t
-  profile () const
-  {
-    return m_profile;
-  }
+  // Types of values near TOS, as used for overload dispatch.  The
+  // profile is not maintained by push and pop, it's computed when
+  // asked for.  Overloads that were pegged statically (see
+  // tree::peg_overloads) never ask.
+  selector::sel_t profile () const;
 
   void
   push (std::unique_ptr <value> vp)
   {
-    m_profile <<= 8;
-    m_profile |= vp->get_type ().code ();
-    m_values.push_back (std::move (vp));
+    m_top = stack_node::make (std::move (vp), std::move (m_top));
+    ++m_size;
   }
 
   void
   need (unsigned depth) const
   {
-    if (depth > m_values.size ())
+    if (depth > m_size)
       throw std::runtime_error ("stack overflow");
   }
 
-  std::unique_ptr <value>
-  pop ()
-  {
-    need (1);
-    auto ret = std::move (m_values.back ());
-    m_values.pop_back ();
-    m_profile >>= 8;
-    if (m_values.size () >= selector::W)
-      {
-	auto code = get (selector::W - 1).get_type ().code ();
-	m_profile |= ((selector::sel_t) code) << 24;
-      }
-    return ret;
-  }
+  std::unique_ptr <value> pop ();
 
   template <class T>
   std::unique_ptr <T>
@@ -143,45 +175,48 @@ public:
     return std::unique_ptr <T> (static_cast <T *> (vp.release ()));
   }
 
-  value &
-  top ()
+  value const &
+  top () const
   {
     need (1);
-    return *m_values.back ().get ();
-  }
-
-  value &
-  get (unsigned depth)
-  {
-    need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
+    return *m_top->m_value;
   }
 
   value const &
   get (unsigned depth) const
   {
-    need (depth + 1);
-    return *(m_values.rbegin () + depth)->get ();
+    return *node (depth).m_value;
   }
 
   template <class T>
-  T *
-  top_as ()
+  T const *
+  top_as () const
   {
-    value const &ret = top ();
-    return value::as <T> (const_cast <value *> (&ret));
+    return value::as <T> (&top ());
   }
 
   template <class T>
-  T *
-  get_as (unsigned depth)
+  T const *
+  get_as (unsigned depth) const
   {
-    value const &ret = get (depth);
-    return value::as <T> (const_cast <value *> (&ret));
+    return value::as <T> (&get (depth));
   }
 
+  // Return TOS for modification.  If its node is shared with another
+  // stack, the value is cloned first.
+  value &mutable_top ();
+
+  // Return a copy of this stack that shares no nodes with it.  Whether
+  // pop clones a value depends on who else refers to its node, which
+  // is only reliable among stacks of one thread.  Stacks that are
+  // handed over to another thread should be cloned this way.
+  uptr clone () const;
+
   bool operator< (stack const &that) const;
   bool operator== (stack const &that) const;
+
+  // Stacks that compare equal hash equal.
+  size_t hash () const;
 };
 
 #endif /* _STK_H_ */
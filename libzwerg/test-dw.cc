@@ -27,20 +27,26 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <gtest/gtest.h>
+#include <sstream>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <unistd.h>
 
 #include "atval.hh"
 #include "builtin-dw-abbrev.hh"
 #include "builtin-dw.hh"
 #include "builtin-symbol.hh"
 #include "builtin.hh"
+#include "cache.hh"
+#include "die_index.hh"
 #include "dwit.hh"
 #include "init.hh"
 #include "op.hh"
+#include "parallel.hh"
 #include "parser.hh"
 #include "stack.hh"
 #include "test-zw-aux.hh"
+#include "tree.hh"
 #include "value-dw.hh"
 
 std::string
@@ -504,6 +510,41 @@ TEST_F (ZwTest, attribute_die_cooked_no_dup)
   EXPECT_TRUE (seen_abstract_origin);
 }
 
+TEST_F (ZwTest, die_keeps_context_alive)
+{
+  std::unique_ptr <value_dwarf> vdw;
+  Dwarf *dw;
+  get_sole_dwarf ("twocus", vdw, dw);
+  ASSERT_TRUE (vdw != nullptr);
+
+  auto copy = value_die (vdw->get_dwctx (), dwpp_offdie (dw, 0x80), 0,
+			 doneness::cooked).clone ();
+  vdw = nullptr;
+
+  auto vd = value::as <value_die> (copy.get ());
+  ASSERT_TRUE (vd != nullptr);
+  auto parent = vd->get_parent ();
+  ASSERT_TRUE (parent != nullptr);
+  Dwarf_Die die = parent->get_die ();
+  EXPECT_EQ (0x5e, dwarf_dieoffset (&die));
+}
+
+TEST_F (ZwTest, dwopen_in_capture)
+{
+  // Once the capture is done, the context that dwopen creates is
+  // only owned by the DIE's that come from it.
+  auto yielded = run_query (*builtins, std::make_unique <stack> (),
+			    "[\"" + test_file ("twocus") + "\" dwopen entry]"
+			    " elem (name == \"main\") parent");
+  ASSERT_EQ (1, yielded.size ());
+  ASSERT_EQ (1, yielded[0]->size ());
+
+  auto vd = value::as <value_die> (&yielded[0]->get (0));
+  ASSERT_TRUE (vd != nullptr);
+  Dwarf_Die die = vd->get_die ();
+  EXPECT_EQ (0x5e, dwarf_dieoffset (&die));
+}
+
 TEST_F (ZwTest, entry_dwarf_counts_every_unit_anew)
 {
   std::unique_ptr <value_dwarf> vdw;
@@ -517,6 +558,93 @@ TEST_F (ZwTest, entry_dwarf_counts_every_unit_anew)
     ASSERT_EQ (i++, va->get_pos ());
 }
 
+TEST_F (ZwTest, parent_index_matches_tree)
+{
+  for (char const *fn: {"twocus", "a1.out", "dwz-partial"})
+    {
+      std::unique_ptr <value_dwarf> vdw;
+      Dwarf *dw;
+      get_sole_dwarf (fn, vdw, dw);
+      ASSERT_TRUE (vdw != nullptr);
+
+      // The threaded build reads the file anew in each thread.
+      parent_index serial {dw};
+      parent_index threaded {dw, test_file (fn), 4};
+      for (auto const *idx: {&serial, &threaded})
+	for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	  {
+	    Dwarf_Off off = dwarf_dieoffset (*it);
+	    EXPECT_EQ (it.parent_offset (), idx->find_parent (off)) << fn;
+	    EXPECT_EQ (it.parent_offset () == parent_index::no_off,
+		       idx->is_root (off)) << fn;
+	  }
+    }
+}
+
+TEST_F (ZwTest, parent_cache_limits)
+{
+  std::unique_ptr <value_dwarf> vdw;
+  Dwarf *dw;
+  get_sole_dwarf ("twocus", vdw, dw);
+  ASSERT_TRUE (vdw != nullptr);
+
+  Dwarf_Die a = dwpp_offdie (dw, 0xb);
+  Dwarf_Die b = dwpp_offdie (dw, 0x5e);
+
+  {
+    parent_cache cache;
+    cache.set_budget (1);
+    EXPECT_EQ (parent_cache::no_off, cache.find (a));
+    EXPECT_TRUE (cache.is_root (b));
+
+    auto stats = cache.get_stats ();
+    EXPECT_EQ (0, stats.hits);
+    EXPECT_EQ (2, stats.misses);
+    EXPECT_EQ (1, stats.evictions);
+    EXPECT_EQ (1, stats.entries);
+    EXPECT_LT (stats.bytes, stats.peak_bytes);
+  }
+
+  {
+    parent_cache cache;
+    cache.set_streaming (true);
+    cache.find (a);
+    cache.find (a);
+    cache.find (b);
+
+    auto stats = cache.get_stats ();
+    EXPECT_EQ (1, stats.hits);
+    EXPECT_EQ (2, stats.misses);
+    EXPECT_EQ (0, stats.evictions);
+    EXPECT_EQ (1, stats.drops);
+    EXPECT_EQ (1, stats.entries);
+  }
+}
+
+TEST_F (ZwTest, abbrev_cache_matches_libdw)
+{
+  for (char const *fn: {"twocus", "a1.out", "nullptr.o"})
+    {
+      std::unique_ptr <value_dwarf> vdw;
+      Dwarf *dw;
+      get_sole_dwarf (fn, vdw, dw);
+      ASSERT_TRUE (vdw != nullptr);
+
+      abbrev_cache cache;
+      for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+	{
+	  auto const &abbrev = cache.get (**it);
+	  EXPECT_EQ (dwarf_tag (*it), abbrev.tag ()) << fn;
+	  EXPECT_EQ (dwarf_haschildren (*it) > 0, abbrev.has_children ())
+	    << fn;
+	  for (unsigned at: {DW_AT_name, DW_AT_type, DW_AT_specification,
+			     DW_AT_low_pc, DW_AT_MIPS_linkage_name})
+	    EXPECT_EQ (dwarf_hasattr (*it, at) != 0, abbrev.has_attr (at))
+	      << fn << ": " << at;
+	}
+    }
+}
+
 namespace
 {
   void
@@ -892,3 +1020,372 @@ TEST_F (ZwTest, symbol_cmp)
        auto val = prod->next (); )
     EXPECT_EQ (cmp_result::equal, val->cmp (*val));
 }
+
+namespace
+{
+  std::vector <std::unique_ptr <stack>>
+  run_parallel_dwquery (vocabulary &voc, std::string fn, doneness d,
+			std::string q, unsigned nthreads)
+  {
+    std::shared_ptr <op> op = build_parallel_exec
+      (parse_query (voc, q), *stack_with_value (dw (fn, d)), nthreads);
+
+    std::vector <std::unique_ptr <stack>> yielded;
+    while (auto r = op->next ())
+      yielded.push_back (std::move (r));
+
+    return yielded;
+  }
+}
+
+TEST_F (ZwTest, parallel_units_match_serial)
+{
+  for (auto d: {doneness::raw, doneness::cooked})
+    for (auto fn: {"twocus", "dwz-partial"})
+      for (auto q: {"unit", "unit pos", "entry", "entry pos",
+		    "entry ?TAG_subprogram name", "entry (|E| E parent)"})
+	{
+	  auto serial = run_parallel_dwquery (*builtins, fn, d, q, 1);
+	  for (unsigned nthreads: {2, 3, 16})
+	    {
+	      auto parallel = run_parallel_dwquery (*builtins, fn, d, q,
+						    nthreads);
+	      ASSERT_EQ (serial.size (), parallel.size ())
+		<< fn << ": " << q << " with " << nthreads << " threads";
+	      // Each slice opens a Dwarf of its own, so values don't
+	      // compare equal by identity.  Compare what they show and
+	      // where they are instead.
+	      for (size_t i = 0; i < serial.size (); ++i)
+		{
+		  ASSERT_EQ (serial[i]->size (), parallel[i]->size ());
+		  for (size_t j = 0; j < serial[i]->size (); ++j)
+		    {
+		      auto const &a = serial[i]->get (j);
+		      auto const &b = parallel[i]->get (j);
+		      std::ostringstream as, bs;
+		      a.show (as);
+		      b.show (bs);
+		      EXPECT_EQ (as.str (), bs.str ())
+			<< fn << ": " << q << " with " << nthreads
+			<< " threads";
+		      EXPECT_EQ (a.get_pos (), b.get_pos ())
+			<< fn << ": " << q << " with " << nthreads
+			<< " threads";
+		    }
+		}
+	    }
+	}
+}
+
+TEST_F (ZwTest, die_index_parent_and_root)
+{
+  char dirbuf[] = "/tmp/zw-index-XXXXXX";
+  ASSERT_TRUE (mkdtemp (dirbuf) != nullptr);
+  std::string dir = dirbuf;
+
+  for (auto fn: {"twocus", "dwz-partial"})
+    for (auto q: {"entry parent", "entry ?root", "entry root"})
+      {
+	auto plain = run_dwquery (*builtins, fn, q);
+
+	auto vdw = dw (fn, doneness::cooked);
+	vdw->get_dwctx ()->set_index_dir (dir);
+	auto indexed = run_query (*builtins, stack_with_value (std::move (vdw)),
+				  q);
+
+	ASSERT_EQ (plain.size (), indexed.size ()) << fn << ": " << q;
+	for (size_t i = 0; i < plain.size (); ++i)
+	  {
+	    // The two runs open separate Dwarf handles, so compare
+	    // offsets rather than whole values.
+	    auto a = value::as <value_die> (&plain[i]->get (0));
+	    auto b = value::as <value_die> (&indexed[i]->get (0));
+	    ASSERT_TRUE (a != nullptr && b != nullptr);
+	    Dwarf_Die a_die = a->get_die ();
+	    Dwarf_Die b_die = b->get_die ();
+	    EXPECT_EQ (dwarf_dieoffset (&a_die),
+		       dwarf_dieoffset (&b_die)) << fn << ": " << q;
+	  }
+      }
+
+  std::unique_ptr <value_dwarf> vdw;
+  Dwarf *dw;
+  get_sole_dwarf ("twocus", vdw, dw);
+  ASSERT_TRUE (dw != nullptr);
+  vdw->get_dwctx ()->set_index_dir (dir);
+  die_index const *idx = vdw->get_dwctx ()->get_index (dw);
+  ASSERT_TRUE (idx != nullptr);
+
+  size_t count = 0;
+  for (all_dies_iterator it {dw}; it != all_dies_iterator::end (); ++it)
+    {
+      auto rec = idx->find (dwarf_dieoffset (*it));
+      ASSERT_TRUE (rec != nullptr);
+      EXPECT_EQ (dwarf_tag (*it), rec->tag);
+      EXPECT_EQ (it.parent_offset (), rec->parent);
+
+      char const *name = dwarf_diename (*it);
+      if (name == nullptr)
+	EXPECT_TRUE (idx->name (*rec) == nullptr);
+      else
+	EXPECT_STREQ (name, idx->name (*rec));
+      count++;
+    }
+  EXPECT_EQ (count, idx->size ());
+
+  // A damaged index is rebuilt.
+  std::string fn = dir + "/9d25435716a6a312bce7d2a87569c768a3172a4c.zwidx";
+  ASSERT_EQ (0, truncate (fn.c_str (), 10));
+  vdw->get_dwctx ()->set_index_dir (dir);
+  idx = vdw->get_dwctx ()->get_index (dw);
+  ASSERT_TRUE (idx != nullptr);
+  EXPECT_EQ (count, idx->size ());
+
+  for (auto name: {"9d25435716a6a312bce7d2a87569c768a3172a4c.zwidx",
+		   "ce69c6925351a6370870a8b7c51b9f9ebaa8b998.zwidx"})
+    unlink ((dir + "/" + name).c_str ());
+  rmdir (dir.c_str ());
+}
+
+namespace
+{
+  std::vector <std::unique_ptr <stack>>
+  run_tree (tree const &t, stack const &stk)
+  {
+    auto op = t.build_exec (std::make_shared <op_origin>
+				(std::make_unique <stack> (stk)));
+
+    std::vector <std::unique_ptr <stack>> yielded;
+    while (auto r = op->next ())
+      yielded.push_back (std::move (r));
+    return yielded;
+  }
+
+  // Check that Q yields the same over FN whether strength reduction
+  // is done or not.  With CHECK_POS, positions of yielded values have
+  // to agree as well.  If INDEX_DIR is given, DIE indices are used.
+  // Returns the number of yielded stacks.
+  size_t
+  check_reduction (vocabulary &voc, char const *fn, doneness d,
+		   std::string q, bool expect_reduced, bool check_pos = false,
+		   std::string index_dir = "")
+  {
+    auto vdw = dw (fn, d);
+    if (index_dir != "")
+      vdw->get_dwctx ()->set_index_dir (index_dir);
+    auto stk = stack_with_value (std::move (vdw));
+
+    tree t = parse_query (voc, q);
+    t.simplify ();
+    tree rt = t;
+    rt.reduce_strength ();
+
+    std::ostringstream ss;
+    ss << rt;
+    EXPECT_EQ (expect_reduced,
+	       ss.str ().find ("/reduced") != std::string::npos) << q;
+
+    auto plain = run_tree (t, *stk);
+    auto reduced = run_tree (rt, *stk);
+    EXPECT_EQ (plain.size (), reduced.size ()) << fn << ": " << q;
+    for (size_t i = 0; i < std::min (plain.size (), reduced.size ()); ++i)
+      {
+	EXPECT_EQ (plain[i]->size (), reduced[i]->size ());
+	EXPECT_EQ (cmp_result::equal,
+		   plain[i]->get (0).cmp (reduced[i]->get (0)))
+	  << fn << ": " << q;
+	if (check_pos)
+	  EXPECT_EQ (plain[i]->get (0).get_pos (),
+		     reduced[i]->get (0).get_pos ()) << fn << ": " << q;
+      }
+
+    return reduced.size ();
+  }
+}
+
+TEST_F (ZwTest, strength_reduction_offset)
+{
+  for (auto d: {doneness::raw, doneness::cooked})
+    {
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "entry (offset == 0x80)", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "entry (0x80 == offset) name", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "entry (offset == 0xb)", true));
+      EXPECT_EQ (0, check_reduction (*builtins, "twocus", d,
+				     "entry (offset == 0x81)", true));
+      EXPECT_EQ (0, check_reduction (*builtins, "twocus", d,
+				     "entry (offset == DW_TAG_member)", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "unit (offset == 0x53)", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "unit entry (offset == 0xa3)", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "entry (offset == 0x80) pos", false));
+
+      // `pos' elsewhere doesn't matter, unless it may see the DIE.
+      EXPECT_EQ (3, check_reduction (*builtins, "twocus", d,
+				     "(entry (offset == 0x80), unit pos)",
+				     true));
+      EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				     "{pos} -> F; entry (offset == 0x80) F",
+				     false));
+    }
+
+  // In cooked mode, DIE's of partial units are yielded once for each
+  // import.
+  EXPECT_EQ (1, check_reduction (*builtins, "dwz-partial", doneness::raw,
+				 "entry (offset == 0x14)", true));
+  EXPECT_EQ (4, check_reduction (*builtins, "dwz-partial", doneness::cooked,
+				 "entry (offset == 0x14)", true));
+  EXPECT_EQ (4, check_reduction (*builtins, "dwz-partial", doneness::cooked,
+				 "unit entry (offset == 0x14)", true));
+  EXPECT_EQ (1, check_reduction (*builtins, "dwz-partial", doneness::raw,
+				 "unit (offset == 0)", true));
+  EXPECT_EQ (0, check_reduction (*builtins, "dwz-partial", doneness::cooked,
+				 "unit (offset == 0)", true));
+}
+
+TEST_F (ZwTest, strength_reduction_tags)
+{
+  char dirbuf[] = "/tmp/zw-index-XXXXXX";
+  ASSERT_TRUE (mkdtemp (dirbuf) != nullptr);
+  std::string dir = dirbuf;
+
+  for (auto d: {doneness::raw, doneness::cooked})
+    for (auto idx: {std::string (""), dir})
+      {
+	EXPECT_EQ (3, check_reduction (*builtins, "twocus", d,
+				       "entry ?TAG_subprogram", true, true,
+				       idx));
+	EXPECT_EQ (5, check_reduction (*builtins, "twocus", d,
+				       "entry (?TAG_subprogram"
+				       " || ?TAG_compile_unit)", true, true,
+				       idx));
+	check_reduction (*builtins, "twocus", d,
+			 "entry !TAG_subprogram", true, true, idx);
+	check_reduction (*builtins, "twocus", d,
+			 "unit entry ?DW_TAG_base_type", true, true, idx);
+	check_reduction (*builtins, "twocus", d,
+			 "unit root child ?TAG_subprogram", true, true, idx);
+	check_reduction (*builtins, "twocus", d,
+			 "entry ?TAG_subprogram pos", false, true, idx);
+
+	check_reduction (*builtins, "dwz-partial", d,
+			 "entry ?TAG_pointer_type", true, true, idx);
+	check_reduction (*builtins, "dwz-partial", d,
+			 "unit root child !TAG_pointer_type", true, true, idx);
+      }
+
+  for (auto name: {"9d25435716a6a312bce7d2a87569c768a3172a4c.zwidx",
+		   "ce69c6925351a6370870a8b7c51b9f9ebaa8b998.zwidx"})
+    unlink ((dir + "/" + name).c_str ());
+  rmdir (dir.c_str ());
+}
+
+TEST_F (ZwTest, strength_reduction_name)
+{
+  char dirbuf[] = "/tmp/zw-index-XXXXXX";
+  ASSERT_TRUE (mkdtemp (dirbuf) != nullptr);
+  std::string dir = dirbuf;
+
+  for (auto d: {doneness::raw, doneness::cooked})
+    for (auto idx: {std::string (""), dir})
+      {
+	EXPECT_EQ (2, check_reduction (*builtins, "twocus", d,
+				       "entry (name == \"foo\")", true, false,
+				       idx));
+	EXPECT_EQ (2, check_reduction (*builtins, "twocus", d,
+				       "entry (\"int\" == name)", true, false,
+				       idx));
+	EXPECT_EQ (2, check_reduction (*builtins, "twocus", d,
+				       "entry ?TAG_subprogram"
+				       " (name == \"foo\")", true, false,
+				       idx));
+	EXPECT_EQ (0, check_reduction (*builtins, "twocus", d,
+				       "entry ?TAG_base_type"
+				       " (name == \"foo\")", true, false,
+				       idx));
+	EXPECT_EQ (0, check_reduction (*builtins, "twocus", d,
+				       "entry (name == \"fo\")", true, false,
+				       idx));
+	EXPECT_EQ (1, check_reduction (*builtins, "twocus", d,
+				       "entry (name == \"main\") pos", false,
+				       false, idx));
+
+	// Cooked name integrates from specifications.
+	check_reduction (*builtins, "nullptr.o", d,
+			 "entry (name == \"foo\")", true, false, idx);
+      }
+
+  unlink ((dir + "/9d25435716a6a312bce7d2a87569c768a3172a4c.zwidx")
+	  .c_str ());
+  rmdir (dir.c_str ());
+}
+
+TEST_F (ZwTest, strength_reduction_address)
+{
+  for (auto d: {doneness::raw, doneness::cooked})
+    {
+      // The lexical block covers [0x10004, 0x10009) and [0x1000e,
+      // 0x10015), bar and the unit cover [0x10000, 0x1001a).
+      EXPECT_EQ (3, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?(address 0x10005 ?contains)",
+				     true));
+      EXPECT_EQ (2, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?(address 0x10009 ?contains)",
+				     true));
+      EXPECT_EQ (0, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?(address 0x1001a ?contains)",
+				     true));
+      EXPECT_EQ (2, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?(address 0x10005 0x10000 aset"
+				     " ?contains)", true));
+      EXPECT_EQ (3, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?(address 0x10000 0x10005 aset"
+				     " ?overlaps)", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "aranges.o", d,
+				     "entry ?TAG_lexical_block"
+				     " ?(address 0x10010 ?contains)", true));
+      check_reduction (*builtins, "aranges.o", d,
+		       "entry !(address 0x10005 ?contains)", false);
+
+      EXPECT_EQ (2, check_reduction (*builtins, "twocus", d,
+				     "entry ?(address 0x4004bd ?contains)",
+				     true));
+      EXPECT_EQ (4, check_reduction (*builtins, "twocus", d,
+				     "entry ?(address 0x4004b2 0x4004cd aset"
+				     " ?overlaps)", true));
+
+      // In cooked mode, DIE's of partial units are iterated as usual.
+      check_reduction (*builtins, "dwz-partial", d,
+		       "entry ?(address 0 0x1000000 aset ?overlaps)", true);
+    }
+}
+
+TEST_F (ZwTest, strength_reduction_prune)
+{
+  // These tags only appear at particular places in the DIE tree, so
+  // other subtrees are not explored at all.  Positions of the yielded
+  // values don't agree with plain iteration in that case.
+  for (auto d: {doneness::raw, doneness::cooked})
+    {
+      EXPECT_EQ (2, check_reduction (*builtins, "twocus", d,
+				     "entry ?TAG_compile_unit", true));
+      EXPECT_EQ (1, check_reduction (*builtins, "float_const_value.o", d,
+				     "entry ?TAG_namespace", true));
+      EXPECT_EQ (2, check_reduction (*builtins, "float_const_value.o", d,
+				     "entry (?TAG_namespace"
+				     " || ?TAG_compile_unit)", true));
+      EXPECT_EQ (4, check_reduction (*builtins, "dwz-partial", d,
+				     "entry ?TAG_compile_unit", true));
+    }
+
+  EXPECT_EQ (5, check_reduction (*builtins, "dwz-partial", doneness::raw,
+				 "entry (?TAG_compile_unit"
+				 " || ?TAG_partial_unit)", true));
+  EXPECT_EQ (4, check_reduction (*builtins, "dwz-partial", doneness::cooked,
+				 "entry (?TAG_compile_unit"
+				 " || ?TAG_partial_unit)", true));
+}
@@ -27,11 +27,18 @@
    not, see <http://www.gnu.org/licenses/>.  */
 
 #include <gtest/gtest.h>
+#include <sstream>
 #include "std-memory.hh"
 
 #include "op.hh"
 #include "init.hh"
+#include "overload.hh"
+#include "parser.hh"
+#include "profile.hh"
 #include "value-cst.hh"
+#include "value-seq.hh"
+#include "value-str.hh"
+#include "vm.hh"
 #include "test-zw-aux.hh"
 
 struct ZwTest
@@ -173,3 +180,432 @@ TEST_F (ZwTest, frame_with_value_referencing_it_doesnt_leak_3)
   run_query (*builtins, std::move (stk), "{{} apply}->F G; ?(G)");
   ASSERT_EQ (1, counter.use_count ());
 }
+
+TEST_F (ZwTest, stack_copy_shares_values)
+{
+  stack stk;
+  stk.push (std::make_unique <value_cst> (constant {1, &dec_constant_dom}, 0));
+  stk.push (std::make_unique <value_cst> (constant {2, &dec_constant_dom}, 0));
+  value const *bottom = &stk.get (1);
+  value const *top = &stk.top ();
+
+  {
+    stack stk2 {stk};
+    EXPECT_EQ (top, &stk2.top ());
+    EXPECT_EQ (bottom, &stk2.get (1));
+    EXPECT_TRUE (stk == stk2);
+
+    // Popping a shared value gives a copy and leaves the original be.
+    auto v = stk2.pop ();
+    EXPECT_NE (top, v.get ());
+    EXPECT_EQ (top, &stk.top ());
+    EXPECT_EQ (2u, stk.size ());
+    EXPECT_EQ (1u, stk2.size ());
+    EXPECT_TRUE (stk2 < stk);
+
+    stk2.push (std::make_unique <value_cst> (constant {3, &dec_constant_dom}, 0));
+    EXPECT_TRUE (stk < stk2);
+  }
+
+  // Once the value is not shared anymore, it is popped as is.
+  auto v2 = stk.pop ();
+  EXPECT_EQ (top, v2.get ());
+}
+
+TEST_F (ZwTest, stack_mutable_top_and_clone)
+{
+  stack stk;
+  stk.push (std::make_unique <value_cst> (constant {1, &dec_constant_dom}, 0));
+  stk.push (std::make_unique <value_cst> (constant {2, &dec_constant_dom}, 0));
+  value const *bottom = &stk.get (1);
+  value const *top = &stk.top ();
+
+  {
+    // A shared TOS is cloned before it's handed out for writing.
+    stack stk2 {stk};
+    EXPECT_NE (top, &stk2.mutable_top ());
+    EXPECT_EQ (top, &stk.top ());
+    EXPECT_EQ (bottom, &stk2.get (1));
+  }
+
+  // A private one is not.
+  EXPECT_EQ (top, &stk.mutable_top ());
+
+  // A clone shares nothing, but compares equal.
+  auto stk3 = stk.clone ();
+  EXPECT_NE (top, &stk3->top ());
+  EXPECT_NE (bottom, &stk3->get (1));
+  EXPECT_TRUE (stk == *stk3);
+}
+
+namespace
+{
+  // Return the builtins of F_BUILTIN nodes named NAME in T.
+  void
+  find_builtins (tree const &t, std::string const &name,
+		 std::vector <builtin const *> &ret)
+  {
+    if (t.tt () == tree_type::F_BUILTIN && t.m_builtin->name () == name)
+      ret.push_back (t.m_builtin.get ());
+    for (auto const &child: t.m_children)
+      find_builtins (child, name, ret);
+  }
+
+  bool
+  is_pegged (builtin const *bi)
+  {
+    return dynamic_cast <overloaded_builtin const *> (bi) == nullptr;
+  }
+}
+
+TEST_F (ZwTest, overload_pegging)
+{
+  tree t = parse_query (*builtins, "length \"abcxyz\" dup length swap length add");
+  t.simplify ();
+  t.peg_overloads ();
+
+  std::vector <builtin const *> lengths;
+  find_builtins (t, "length", lengths);
+  ASSERT_EQ (3u, lengths.size ());
+
+  // Type of the input stack is not known.
+  EXPECT_FALSE (is_pegged (lengths[0]));
+  EXPECT_TRUE (is_pegged (lengths[1]));
+  EXPECT_TRUE (is_pegged (lengths[2]));
+
+  std::vector <builtin const *> adds;
+  find_builtins (t, "add", adds);
+  ASSERT_EQ (1u, adds.size ());
+  EXPECT_TRUE (is_pegged (adds[0]));
+
+  auto stk = stack_with_value (std::make_unique <value_str> ("foo", 0));
+  auto op = t.build_exec (std::make_shared <op_origin> (std::move (stk)));
+  auto ret = op->next ();
+  ASSERT_TRUE (ret != nullptr);
+  ASSERT_EQ (2u, ret->size ());
+  auto cst = ret->top_as <value_cst> ();
+  ASSERT_TRUE (cst != nullptr);
+  EXPECT_EQ (constant (12, &dec_constant_dom), cst->get_constant ());
+  EXPECT_TRUE (op->next () == nullptr);
+}
+
+TEST_F (ZwTest, overload_pegging_merges_alternatives)
+{
+  // Both branches yield a T_CONST, but the type of the one below it
+  // differs.
+  tree t = parse_query (*builtins,
+			"(\"ab\" 1, [] 2) swap length");
+  t.simplify ();
+  t.peg_overloads ();
+
+  std::vector <builtin const *> lengths;
+  find_builtins (t, "length", lengths);
+  ASSERT_EQ (1u, lengths.size ());
+  EXPECT_FALSE (is_pegged (lengths[0]));
+
+  tree t2 = parse_query (*builtins, "(\"ab\" 1, \"cd\" 2) swap length");
+  t2.simplify ();
+  t2.peg_overloads ();
+
+  lengths.clear ();
+  find_builtins (t2, "length", lengths);
+  ASSERT_EQ (1u, lengths.size ());
+  EXPECT_TRUE (is_pegged (lengths[0]));
+}
+
+TEST_F (ZwTest, stack_underrun_detected_statically)
+{
+  auto stk = stack_with_value (std::make_unique <value_str> ("foo", 0));
+
+  tree t = parse_query (*builtins, "drop drop");
+  EXPECT_THROW (t.check_stack_effect (*stk), std::runtime_error);
+
+  tree t2 = parse_query (*builtins, "dup add");
+  EXPECT_NO_THROW (t2.check_stack_effect (*stk));
+
+  // No overload of length is applicable to an empty stack.
+  tree t3 = parse_query (*builtins, "drop length");
+  EXPECT_THROW (t3.check_stack_effect (*stk), std::runtime_error);
+
+  // After applying a closure, nothing is known about the stack.
+  tree t4 = parse_query (*builtins, "{} apply drop drop");
+  EXPECT_NO_THROW (t4.check_stack_effect (*stk));
+}
+
+namespace
+{
+  std::vector <std::string>
+  results (std::shared_ptr <op> op)
+  {
+    std::vector <std::string> ret;
+    while (auto stk = op->next ())
+      {
+	std::stringstream ss;
+	for (size_t i = stk->size (); i > 0; --i)
+	  {
+	    stk->get (i - 1).show (ss);
+	    ss << ";";
+	  }
+	ret.push_back (ss.str ());
+      }
+    return ret;
+  }
+}
+
+TEST_F (ZwTest, vm_matches_op_graph)
+{
+  for (char const *query: {
+      "(\"ab\", \"cde\") length",
+      "[1, 2, 3] elem (10, 20) add",
+      "[1, 5, 9] elem (== 5 || 7)",
+      "let A := (1, 2); let B := A 10 mul; A B add",
+      "[(1, 2, 3) dup 2 ?gt] length",
+      "1 (2, 3) (|A B| A B sub)",
+      "0 (1 add dup 4 ?lt)*",
+      "{|N| (?(N 2 ?lt) 1 || N 1 sub fact N mul)} -> fact; 5 fact",
+      "[1, 2, 3, 4, 5] elem 2 limit",
+      "(1, 2) [[3, 4, 5] elem 2 limit]",
+      "[1, 2] elem ([3, 4, 5] elem 1 limit, 7)",
+      "(1, 2, 3) (10, 20, 30)",
+      "(1, 2) (3, 4) (5, 6)",
+      "(1, 2) [(3, 4) (5, 6)]",
+      "(1, 2) ((3, 4) (7, 8) 3 limit, 6)",
+      "(1, 2) (|X| (X, 10) (7, 8))",
+      "(1, 2) (|X| (3, 4, 5) 2 limit)",
+    })
+    {
+      tree t = parse_query (*builtins, query);
+      t.simplify ();
+
+      auto stk1 = std::make_unique <stack> ();
+      auto stk2 = std::make_unique <stack> ();
+      auto op1 = t.build_exec (std::make_shared <op_origin> (std::move (stk1)));
+      auto op2 = std::make_shared <op_vm>
+	(std::make_shared <op_origin> (std::move (stk2)), vm_compile (t));
+      EXPECT_EQ (results (op1), results (op2)) << query;
+    }
+}
+
+TEST_F (ZwTest, next_is_lazy)
+{
+  // The predicate throws on the second stack, but only once that
+  // stack is asked for.
+  tree t = parse_query (*builtins, "(1, \"a\") ?(dup limit)");
+  auto op = t.build_exec (nullptr);
+  EXPECT_TRUE (op->next () != nullptr);
+  EXPECT_THROW (op->next (), std::runtime_error);
+}
+
+TEST_F (ZwTest, next_batch)
+{
+  tree t = parse_query (*builtins, "[1, 2, 3, 4, 5] elem 3 ?ge");
+  auto op = t.build_exec (nullptr);
+
+  std::vector <stack::uptr> out;
+  EXPECT_EQ (2u, op->next_batch (out, 2));
+  EXPECT_EQ (1u, op->next_batch (out, 2));
+  EXPECT_EQ (0u, op->next_batch (out, 2));
+
+  ASSERT_EQ (3u, out.size ());
+  for (size_t i = 0; i < out.size (); ++i)
+    {
+      auto cst = out[i]->get_as <value_cst> (1);
+      ASSERT_TRUE (cst != nullptr);
+      EXPECT_EQ (constant (i + 3, &dec_constant_dom), cst->get_constant ());
+    }
+}
+
+TEST_F (ZwTest, profile)
+{
+  tree t = parse_query (*builtins, "[1, 2, 3, 4, 5] elem 3 ?ge");
+
+  profiler prof;
+  std::shared_ptr <op> op;
+  {
+    profiler::install install {prof};
+    op = t.build_exec (nullptr);
+  }
+
+  size_t n = 0;
+  while (op->next () != nullptr)
+    ++n;
+  EXPECT_EQ (3u, n);
+
+  std::stringstream ss;
+  prof.format (ss);
+  EXPECT_NE (std::string::npos, ss.str ().find ("produced=3 rejected=2"))
+    << ss.str ();
+  EXPECT_NE (std::string::npos, ss.str ().find ("F_BUILTIN<elem>"))
+    << ss.str ();
+}
+
+TEST_F (ZwTest, invariant_subexpressions)
+{
+  EXPECT_TRUE (parse_query (*builtins, "[4, 5] length").invariant ());
+  EXPECT_TRUE (parse_query (*builtins, "1 2 add").invariant ());
+  EXPECT_FALSE (parse_query (*builtins, "2 add").invariant ());
+  EXPECT_FALSE (parse_query (*builtins, "dup").invariant ());
+  EXPECT_FALSE (parse_query (*builtins, "2 ?gt").invariant ());
+  EXPECT_FALSE (parse_query (*builtins, "let A := 1; A").invariant ());
+
+  // The invariant capture is evaluated once, but each stack gets its
+  // own copy of the result.
+  tree t = parse_query (*builtins, "(1, 2, 3) [4, 5] elem");
+  auto op = t.build_exec (nullptr);
+  size_t n = 0;
+  while (auto stk = op->next ())
+    {
+      ASSERT_EQ (2u, stk->size ());
+      ++n;
+    }
+  EXPECT_EQ (6u, n);
+}
+
+TEST_F (ZwTest, memo)
+{
+  EXPECT_TRUE (parse_query (*builtins, "length").tos_function ());
+  EXPECT_TRUE (parse_query (*builtins, "(elem)*").tos_function ());
+  EXPECT_FALSE (parse_query (*builtins, "add").tos_function ());
+  EXPECT_FALSE (parse_query (*builtins, "swap").tos_function ());
+
+  // Each entry takes up two values, the string and its length.
+  for (size_t capacity: {2, 4})
+    {
+      tree t1 = parse_query (*builtins, "(\"ab\", \"c\", \"ab\")");
+      tree t2 = parse_query (*builtins, "length");
+      auto origin = std::make_shared <op_origin> (nullptr);
+      profile_node node {"memo"};
+      op_memo memo {t1.build_exec (nullptr), origin,
+		    t2.build_exec (origin), capacity, 1, &node};
+
+      std::vector <constant> results;
+      while (auto stk = memo.next ())
+	results.push_back (stk->get_as <value_cst> (0)->get_constant ());
+
+      EXPECT_EQ ((std::vector <constant> {
+	    constant (2, &dec_constant_dom),
+	    constant (1, &dec_constant_dom),
+	    constant (2, &dec_constant_dom)}), results);
+      EXPECT_EQ (capacity == 2 ? 0u : 1u, node.m_memo_hits);
+      EXPECT_EQ (capacity == 2 ? 3u : 2u, node.m_memo_misses);
+    }
+
+  // Inputs that lead to more results than an entry may hold are not
+  // remembered.
+  {
+    tree t1 = parse_query (*builtins, "(\"ab\", \"ab\")");
+    tree t2 = parse_query (*builtins, "(length, length)");
+    auto origin = std::make_shared <op_origin> (nullptr);
+    profile_node node {"memo"};
+    op_memo memo {t1.build_exec (nullptr), origin,
+		  t2.build_exec (origin), 16, 1, &node};
+
+    size_t n = 0;
+    while (memo.next () != nullptr)
+      ++n;
+    EXPECT_EQ (4u, n);
+    EXPECT_EQ (0u, node.m_memo_hits);
+    EXPECT_EQ (2u, node.m_memo_misses);
+  }
+
+  // Closures can't be identical to anything, so they aren't looked
+  // up at all.
+  {
+    tree t1 = parse_query (*builtins, "({}, {})");
+    tree t2 = parse_query (*builtins, "drop 1");
+    auto origin = std::make_shared <op_origin> (nullptr);
+    profile_node node {"memo"};
+    op_memo memo {t1.build_exec (nullptr), origin,
+		  t2.build_exec (origin), 4, 1, &node};
+
+    size_t n = 0;
+    while (memo.next () != nullptr)
+      ++n;
+    EXPECT_EQ (2u, n);
+    EXPECT_EQ (0u, node.m_memo_hits);
+    EXPECT_EQ (0u, node.m_memo_misses);
+  }
+}
+
+TEST_F (ZwTest, capture_length_counts)
+{
+  tree t = parse_query (*builtins, "[(1, 2, 3) (4, 5)] length");
+  t.simplify ();
+  t.reduce_strength ();
+
+  std::stringstream ss;
+  ss << t;
+  EXPECT_NE (std::string::npos, ss.str ().find ("COUNT")) << ss.str ();
+  EXPECT_EQ (std::string::npos, ss.str ().find ("length")) << ss.str ();
+
+  auto op = t.build_exec (nullptr);
+  auto stk = op->next ();
+  ASSERT_TRUE (stk != nullptr);
+  ASSERT_EQ (1u, stk->size ());
+  auto cst = stk->get_as <value_cst> (0);
+  ASSERT_TRUE (cst != nullptr);
+  EXPECT_EQ (constant (6, &dec_constant_dom), cst->get_constant ());
+  EXPECT_TRUE (op->next () == nullptr);
+
+  // `pos' doesn't see the count, so it doesn't stand in the way.
+  t = parse_query (*builtins, "[(1, 2, 3) (4, 5)] length (1, 2) pos");
+  t.simplify ();
+  t.reduce_strength ();
+
+  std::stringstream ss2;
+  ss2 << t;
+  EXPECT_NE (std::string::npos, ss2.str ().find ("COUNT")) << ss2.str ();
+}
+
+TEST_F (ZwTest, limit)
+{
+  auto run = [&] (std::string q)
+    {
+      return run_query (*builtins, std::make_unique <stack> (), q);
+    };
+
+  EXPECT_EQ (2u, run ("[1, 2, 3, 4, 5] elem 2 limit").size ());
+  EXPECT_EQ (0u, run ("[1, 2, 3] elem 0 limit").size ());
+  EXPECT_EQ (3u, run ("[1, 2, 3] elem 5 limit").size ());
+
+  // Limit is counted anew for each stack that comes to the capture.
+  auto yielded = run ("(1, 2) [(3, 4, 5) 2 limit]");
+  ASSERT_EQ (2u, yielded.size ());
+  for (auto &stk: yielded)
+    EXPECT_EQ (2u, stk->get_as <value_seq> (0)->get_seq ()->size ());
+
+  // Likewise for each stack that comes to an alternation.
+  EXPECT_EQ (4u, run ("[1, 2] elem ([3, 4, 5] elem 1 limit, 7)").size ());
+
+  EXPECT_THROW (run ("1 \"x\" limit"), std::runtime_error);
+
+  // Once the limit is reached, nothing more is asked of upstream.
+  struct counting_op
+    : public op
+  {
+    size_t m_pulls = 0;
+
+    stack::uptr
+    next () override
+    {
+      ++m_pulls;
+      auto stk = std::make_unique <stack> ();
+      stk->push (std::make_unique <value_cst>
+		 (constant (3, &dec_constant_dom), 0));
+      return stk;
+    }
+
+    void reset () override {}
+    std::string name () const override { return "counting"; }
+  };
+
+  auto upstream = std::make_shared <counting_op> ();
+  tree t = parse_query (*builtins, "limit");
+  auto op = t.build_exec (upstream);
+
+  std::vector <stack::uptr> out;
+  while (op->next_batch (out, op_batch_size) != 0)
+    ;
+  EXPECT_EQ (3u, out.size ());
+  EXPECT_EQ (3u, upstream->m_pulls);
+}
@@ -0,0 +1,111 @@
+/*
+   Copyright (C) 2014, 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <gtest/gtest.h>
+#include "pool.hh"
+#include "stack.hh"
+#include "value-str.hh"
+
+TEST (PoolTest, blocks_are_recycled)
+{
+  pool_trim ();
+  EXPECT_EQ (0u, pool_cached ());
+
+  void *a = pool_allocate (24);
+  pool_release (a, 24);
+  EXPECT_EQ (1u, pool_cached ());
+
+  // A request from the same size class gets the same block.
+  void *b = pool_allocate (32);
+  EXPECT_EQ (a, b);
+  EXPECT_EQ (0u, pool_cached ());
+  pool_release (b, 32);
+
+  // Other size classes are kept apart.
+  void *c = pool_allocate (48);
+  EXPECT_NE (a, c);
+  pool_release (c, 48);
+  EXPECT_EQ (2u, pool_cached ());
+
+  pool_trim ();
+  EXPECT_EQ (0u, pool_cached ());
+}
+
+TEST (PoolTest, large_blocks_bypass_pool)
+{
+  pool_trim ();
+  void *a = pool_allocate (4096);
+  pool_release (a, 4096);
+  EXPECT_EQ (0u, pool_cached ());
+}
+
+TEST (PoolTest, stacks_and_values)
+{
+  pool_trim ();
+  {
+    auto stk = std::make_unique <stack> ();
+    stk->push (std::make_unique <value_str> ("foo", 0));
+    auto stk2 = std::make_unique <stack> (*stk);
+    EXPECT_EQ (1u, stk2->size ());
+  }
+
+  // The copy shares the node, and with it the string, of the
+  // original.  Both stacks, the one node and the one string went back
+  // to the free lists.
+  EXPECT_EQ (4u, pool_cached ());
+
+  // A stack, a node and a string are taken from there again.
+  auto stk = std::make_unique <stack> ();
+  stk->push (std::make_unique <value_str> ("bar", 0));
+  EXPECT_EQ (1u, pool_cached ());
+  pool_trim ();
+}
+
+TEST (PoolTest, push_pop_reuses_nodes)
+{
+  pool_trim ();
+  stack stk;
+  stk.push (std::make_unique <value_str> ("foo", 0));
+  stk.pop ();
+
+  // The node and the string are cached ...
+  size_t cached = pool_cached ();
+  EXPECT_EQ (2u, cached);
+
+  // ... and reused by further pushes, without going to the global
+  // allocator.
+  for (int i = 0; i < 10; ++i)
+    {
+      stk.push (std::make_unique <value_str> ("foo", 0));
+      EXPECT_EQ (cached - 2, pool_cached ());
+      stk.pop ();
+      EXPECT_EQ (cached, pool_cached ());
+    }
+  pool_trim ();
+}
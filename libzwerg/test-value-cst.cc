@@ -55,3 +55,14 @@ TEST (ValueCstTest, comparison_of_different_domains)
   EXPECT_EQ (cst_a.cmp (cst_b), cst_c.cmp (cst_d));
   EXPECT_EQ (cst_b.cmp (cst_a), cst_d.cmp (cst_c));
 }
+
+TEST (ValueCstTest, equal_constants_hash_equal)
+{
+  value_cst cst_a {constant {7, &dec_constant_dom}, 0};
+  value_cst cst_b {constant {7, &hex_constant_dom}, 0};
+  value_cst cst_c {constant {-7, &dec_constant_dom}, 0};
+
+  ASSERT_EQ (cmp_result::equal, cst_a.cmp (cst_b));
+  EXPECT_EQ (cst_a.hash (), cst_b.hash ());
+  EXPECT_NE (cmp_result::equal, cst_a.cmp (cst_c));
+}
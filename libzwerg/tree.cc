@@ -29,6 +29,7 @@
 #include <algorithm>
 #include <cassert>
 #include <climits>
+#include <cstring>
 #include <iostream>
 #include "std-memory.hh"
 #include <set>
@@ -325,3 +326,167 @@ tree::simplify ()
 	}
     }
 }
+
+bool
+is_builtin (tree const &t, char const *name)
+{
+  return t.tt () == tree_type::F_BUILTIN
+    && std::strcmp (t.m_builtin->name (), name) == 0;
+}
+
+bool
+mentions_builtin (tree const &t, char const *name)
+{
+  if (is_builtin (t, name))
+    return true;
+  for (auto const &child: t.m_children)
+    if (mentions_builtin (child, name))
+      return true;
+  return false;
+}
+
+namespace
+{
+  // The CAPTURE node of [X], or nullptr if T is not that.  The
+  // parser wraps captures in a scope.
+  tree *
+  find_capture (tree &t)
+  {
+    if (t.tt () == tree_type::CAPTURE)
+      return &t;
+    if (t.tt () == tree_type::SCOPE
+	&& t.child (0).tt () == tree_type::CAPTURE)
+      return &t.child (0);
+    return nullptr;
+  }
+
+  bool
+  mentions_pos_in_closure (tree const &t)
+  {
+    if (t.tt () == tree_type::BLOCK)
+      return mentions_builtin (t, "pos");
+    for (auto const &child: t.m_children)
+      if (mentions_pos_in_closure (child))
+	return true;
+    return false;
+  }
+
+  // Whether `pos' is mentioned in children of T from BEGIN on.
+  bool
+  pos_from (tree const &t, size_t begin)
+  {
+    for (size_t i = begin; i < t.m_children.size (); ++i)
+      if (mentions_builtin (t.child (i), "pos"))
+	return true;
+    return false;
+  }
+
+  // POS_AFTER tells whether `pos' may be applied to values that T
+  // yields.  Within a CAT, that's the case for values of a child if
+  // `pos' is mentioned in any of the children that follow it.
+  void
+  reduce_strength_rec (tree &t, bool pos_after)
+  {
+    for (size_t i = 0; i < t.m_children.size (); ++i)
+      reduce_strength_rec (t.child (i),
+			   pos_after || (t.tt () == tree_type::CAT
+					 && pos_from (t, i + 1)));
+
+    if (t.tt () != tree_type::CAT)
+      return;
+
+    // [X] length counts results of X without collecting them.  The
+    // count has the same position as the length would.
+    for (size_t i = 0; i + 1 < t.m_children.size (); ++i)
+      if (is_builtin (t.child (i + 1), "length"))
+	if (tree *capture = find_capture (t.child (i)))
+	  {
+	    capture->m_tt = tree_type::COUNT;
+	    t.m_children.erase (t.m_children.begin () + i + 1);
+	  }
+
+    // A reduced word is offered the tree that follows it as well, so
+    // that e.g. (entry ?TAG_x (name == "y")) reduces both.  Reduced
+    // words don't track value positions, so a word is left alone if
+    // `pos' may see its values.
+    for (size_t i = 0; i + 1 < t.m_children.size (); )
+      {
+	std::shared_ptr <builtin> b;
+	if (t.child (i).tt () == tree_type::F_BUILTIN
+	    && ! pos_after && ! pos_from (t, i + 1))
+	  b = t.child (i).m_builtin->reduce (t.child (i + 1));
+
+	if (b != nullptr)
+	  {
+	    t.child (i).m_builtin = b;
+	    t.m_children.erase (t.m_children.begin () + i + 1);
+	  }
+	else
+	  ++i;
+      }
+
+    if (t.m_children.size () == 1)
+      t = t.child (0);
+  }
+}
+
+void
+tree::reduce_strength ()
+{
+  // A closure may be applied to values from anywhere in the query,
+  // so if any uses `pos', all positions need to be kept.
+  reduce_strength_rec (*this, mentions_pos_in_closure (*this));
+}
+
+constant const *
+tree::match_eq_constant (char const *word) const
+{
+  if (m_tt != tree_type::ASSERT
+      || child (0).m_tt != tree_type::PRED_SUBX_CMP
+      || ! is_builtin (child (0).child (2), "?eq"))
+    return nullptr;
+
+  tree const &a = child (0).child (0);
+  tree const &b = child (0).child (1);
+  if (is_builtin (a, word) && b.m_tt == tree_type::CONST)
+    return &b.cst ();
+  if (is_builtin (b, word) && a.m_tt == tree_type::CONST)
+    return &a.cst ();
+  return nullptr;
+}
+
+namespace
+{
+  // Whether T is a string literal, i.e. a format string without any
+  // computation in it.
+  bool
+  is_string_literal (tree const &t, std::string &ret)
+  {
+    if (t.tt () != tree_type::FORMAT)
+      return false;
+
+    std::string str;
+    for (auto const &child: t.m_children)
+      if (child.tt () == tree_type::STR)
+	str += child.str ();
+      else
+	return false;
+
+    ret = str;
+    return true;
+  }
+}
+
+bool
+tree::match_eq_string (char const *word, std::string &ret) const
+{
+  if (m_tt != tree_type::ASSERT
+      || child (0).m_tt != tree_type::PRED_SUBX_CMP
+      || ! is_builtin (child (0).child (2), "?eq"))
+    return false;
+
+  tree const &a = child (0).child (0);
+  tree const &b = child (0).child (1);
+  return (is_builtin (a, word) && is_string_literal (b, ret))
+    || (is_builtin (b, word) && is_string_literal (a, ret));
+}
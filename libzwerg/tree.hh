@@ -65,6 +65,8 @@ enum class tree_arity_v
 // CAT -- A node for holding concatenation (X Y Z).
 // ALT -- A node for holding alternation (X, Y, Z).
 // CAPTURE -- For holding [X].
+// COUNT -- For holding [X] length.  Pushes the number of results of
+// X, without collecting them.  See tree::reduce_strength.
 // OR -- For holding first-match alternation (X || Y || Z)
 //
 // NOP -- For holding a no-op that comes up in "%s" and (,X).
@@ -97,6 +99,7 @@ enum class tree_arity_v
   TREE_TYPE (ALT, BINARY)			\
   TREE_TYPE (OR, BINARY)			\
   TREE_TYPE (CAPTURE, UNARY)			\
+  TREE_TYPE (COUNT, UNARY)			\
   TREE_TYPE (SUBX_EVAL, CST)			\
   TREE_TYPE (IFELSE, TERNARY)			\
   TREE_TYPE (SCOPE, SCOPE)			\
@@ -186,6 +189,57 @@ public:
   // XXX this should actually be hidden behind build_exec or what not.
   void simplify ();
 
+  // Replace iteration words that are directly followed by an
+  // assertion with a cheaper computation, where the word knows one
+  // (see builtin::reduce).  E.g. in (entry (offset == 0x123)), the
+  // DIE can be looked up directly instead of filtered out of all
+  // DIE's in the file, and in (entry ?TAG_subprogram), DIE's of
+  // other tags are skipped before they become values.  Reduced words
+  // don't track value positions, so a word is left alone where "pos"
+  // may be applied to its values.
+  void reduce_strength ();
+
+  // If this is an assertion of the form (WORD == CONSTANT) or
+  // (CONSTANT == WORD), where WORD is a builtin of that name, return
+  // the constant.  Otherwise return nullptr.  This is meant for
+  // implementations of builtin::reduce.
+  constant const *match_eq_constant (char const *word) const;
+
+  // Likewise for (WORD == "literal") and ("literal" == WORD).  If
+  // this is such an assertion, store the literal to RET and return
+  // true.
+  bool match_eq_string (char const *word, std::string &ret) const;
+
+  // Overload pegging.  Statically infer types of values on stack,
+  // going by prototypes of the words involved, and bind overloaded
+  // words whose overload is thereby determined directly to that
+  // overload.  Runtime dispatch is left in place where the types are
+  // not known.  E.g. in (entry name), entry might be applied to
+  // anything, but name is surely applied to a T_DIE.  This is
+  // implemented in infer.cc.
+  void peg_overloads ();
+
+  // Static stack effect analysis.  Check that the query doesn't
+  // underrun the stack when applied to stack STK, and throw a
+  // runtime_error if it surely does.  Only what is known to happen
+  // is reported, places where the stack shape is not known (e.g.
+  // after applying a closure) are let through to the runtime check.
+  // This is implemented in infer.cc.
+  void check_stack_effect (stack const &stk) const;
+
+  // Whether this expression yields the same results no matter what
+  // stack it's applied to.  That is the case if it provably uses
+  // none of the values on the input stack, and reads no variables of
+  // enclosing scopes.  Sub-expressions that are invariant are
+  // evaluated once and their results replayed (see build_exec).
+  // This is implemented in infer.cc.
+  bool invariant () const;
+
+  // Whether results of this expression depend on nothing but the
+  // value on TOS.  Such expressions are memoized (see op_memo).  This
+  // is implemented in infer.cc.
+  bool tos_function () const;
+
   // This should build an op node corresponding to this expression.
   //
   // Not every expression node needs to have an associated op, some
@@ -199,6 +253,16 @@ public:
   // Produce program suitable for interpretation.
   std::unique_ptr <pred> build_pred () const;
 
+  // When a profiler is installed (see profile.hh), build_exec and
+  // build_pred wrap what these produce in profiling nodes.
+private:
+  std::shared_ptr <op>
+  do_build_exec (std::shared_ptr <op> upstream) const;
+
+  std::unique_ptr <pred> do_build_pred () const;
+
+public:
+
   // === Parser interface ===
   //
   // The following methods are implemented in tree_cr.hh and
@@ -256,4 +320,10 @@ public:
 
 std::ostream &operator<< (std::ostream &o, tree const &t);
 
+// Whether T is a builtin word called NAME.
+bool is_builtin (tree const &t, char const *name);
+
+// Whether T or any of its descendants is a builtin word called NAME.
+bool mentions_builtin (tree const &t, char const *name);
+
 #endif /* _TREE_H_ */
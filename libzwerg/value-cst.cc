@@ -78,6 +78,22 @@ value_cst::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+bool
+value_cst::identical (value const &that) const
+{
+  auto v = value::as <value_cst> (&that);
+  return v != nullptr && m_cst.dom () == v->m_cst.dom ()
+    && compare (m_cst, v->m_cst) == cmp_result::equal;
+}
+
+size_t
+value_cst::hash () const
+{
+  // Constants from different domains may compare equal, so only the
+  // magnitude is hashed.
+  return std::hash <uint64_t> {} (m_cst.value ().m_u);
+}
+
 
 // value
 
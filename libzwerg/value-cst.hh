@@ -54,6 +54,10 @@ public:
   void show (std::ostream &o) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
+  bool identical (value const &that) const override;
+  bool has_identity () const override
+  { return true; }
 };
 
 struct op_value_cst
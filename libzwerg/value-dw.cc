@@ -185,6 +185,12 @@ value_dwarf::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_dwarf::hash () const
+{
+  return std::hash <Dwfl *> {} (m_dwctx->get_dwfl ());
+}
+
 
 value_type const value_cu::vtype = value_type::alloc ("T_CU",
 R"docstring(
@@ -221,17 +227,13 @@ value_cu::cmp (value const &that) const
     return cmp_result::fail;
 }
 
-
-namespace
+size_t
+value_cu::hash () const
 {
-  template <class T>
-  T &
-  unconst (T const &t)
-  {
-    return const_cast <T &> (t);
-  }
+  return std::hash <Dwarf_CU *> {} (&m_cu);
 }
 
+
 value_type const value_die::vtype = value_type::alloc ("T_DIE",
 R"docstring(
 
@@ -250,13 +252,68 @@ CU's::
 
 )docstring");
 
+value_die::value_die (value_die const &that)
+  : value {that}
+  , doneness_aspect {that}
+  , m_import {that.m_import}
+  , m_dwctx {that.m_dwctx}
+  , m_addr {that.m_addr}
+  , m_cu {that.m_cu}
+  , m_abbrev {that.m_abbrev}
+{
+  // Like with dwarf_value_cache, the cached Dwarf value is not
+  // copied.
+}
+
 void
 value_die::show (std::ostream &o) const
 {
-  Dwarf_Die *die = &unconst (m_die);
+  Dwarf_Die die = get_die ();
   ios_flag_saver fs {o};
-  o << '[' << std::hex << dwarf_dieoffset (die) << "] "
-    << constant (dwarf_tag (die), &dw_tag_dom (), brevity::brief);
+  o << '[' << std::hex << dwarf_dieoffset (&die) << "] "
+    << constant (dwarf_tag (&die), &dw_tag_dom (), brevity::brief);
+}
+
+namespace
+{
+  Dwarf_Off
+  die_offset (Dwarf_Die die)
+  {
+    return dwarf_dieoffset (&die);
+  }
+
+  // Compare import chains A and B the way value_die::cmp compares
+  // DIE's.
+  cmp_result
+  compare_imports (dwfl_context &a_ctx, import_id a,
+		   dwfl_context &b_ctx, import_id b)
+  {
+    // If import paths are different, then each DIE comes from a
+    // different part of the tree and they are logically different.
+    // But if one of DIE's has an import path and the other does not,
+    // the other is in a sense a template that describes potentially
+    // several DIEs.
+    while (a != no_import && b != no_import)
+      {
+	if (&a_ctx == &b_ctx && a == b)
+	  break;
+
+	Dwarf_Die a_die = a_ctx.import_die (a);
+	Dwarf_Die b_die = b_ctx.import_die (b);
+
+	auto ret = compare (dwarf_cu_getdwarf (a_die.cu),
+			    dwarf_cu_getdwarf (b_die.cu));
+	if (ret == cmp_result::equal)
+	  ret = compare (die_offset (a_die), die_offset (b_die));
+	if (ret != cmp_result::equal)
+	  return ret;
+
+	a = a_ctx.import_parent (a);
+	b = b_ctx.import_parent (b);
+      }
+
+    return cmp_result::equal;
+  }
 }
 
 cmp_result
@@ -265,84 +322,105 @@ value_die::cmp (value const &that) const
   if (auto v = value::as <value_die> (&that))
     {
       {
-	auto ret = compare (dwarf_cu_getdwarf (m_die.cu),
-			    dwarf_cu_getdwarf (v->m_die.cu));
+	auto ret = compare (dwarf_cu_getdwarf (m_cu),
+			    dwarf_cu_getdwarf (v->m_cu));
 	if (ret != cmp_result::equal)
 	  return ret;
       }
 
       {
-	auto ret = compare (dwarf_dieoffset ((Dwarf_Die *) &m_die),
-			    dwarf_dieoffset ((Dwarf_Die *) &v->m_die));
+	auto ret = compare (die_offset (get_die ()),
+			    die_offset (v->get_die ()));
 	if (ret != cmp_result::equal)
 	  return ret;
 
-	// If import paths are different, then each DIE comes from a
-	// different part of the tree and they are logically
-	// different.  But if one of DIE's has an import path and the
-	// other does not, the other is in a sense a template that
-	// describes potentially several DIEs.  If one of the DIE's is
-	// raw, its import path (if any) is ignored.
-	if (is_raw () || m_import == nullptr
-	    || v->is_raw () || v->m_import == nullptr)
+	// If one of the DIE's is raw, its import path (if any) is
+	// ignored.
+	if (is_raw () || v->is_raw ())
 	  return ret;
       }
 
-      assert (m_import != nullptr);
-      assert (v->m_import != nullptr);
-
-      // Explore recursively.
-      return m_import->cmp (*v->m_import);
+      return compare_imports (*m_dwctx, m_import, *v->m_dwctx, v->m_import);
     }
   else
     return cmp_result::fail;
 }
 
+size_t
+value_die::hash () const
+{
+  // Import paths are not hashed, DIE's with different import paths
+  // may still compare equal.
+  return hash_combine (std::hash <Dwarf *> {} (dwarf_cu_getdwarf (m_cu)),
+		       die_offset (get_die ()));
+}
+
+bool
+value_die::identical (value const &that) const
+{
+  // Unlike cmp, this also distinguishes DIE's that were reached
+  // through different imports, or cooked DIE's from raw ones.
+  // Import chains are interned, so equal chains have equal ID's.
+  auto v = value::as <value_die> (&that);
+  return v != nullptr
+    && get_doneness () == v->get_doneness ()
+    && m_dwctx == v->m_dwctx
+    && m_addr == v->m_addr
+    && m_import == v->m_import;
+}
+
+value_dwarf &
+value_die::get_dwarf ()
+{
+  if (m_dwcache == nullptr)
+    m_dwcache = std::make_unique <dwarf_value_cache> ();
+  return m_dwcache->get_dwarf (m_dwctx, 0, get_doneness ());
+}
+
 namespace
 {
   bool
-  get_parent (value_die const &value, Dwarf_Die &ret)
+  find_parent_die (dwfl_context &dwctx, Dwarf_Die die, Dwarf_Die &ret)
   {
-    Dwarf_Off par_off = value.get_dwctx ()->find_parent (value.get_die ());
+    Dwarf_Off par_off = dwctx.find_parent (die);
     if (par_off == parent_cache::no_off)
       return false;
 
-    if (dwarf_offdie (dwarf_cu_getdwarf (value.get_die ().cu),
-		      par_off, &ret) == nullptr)
+    if (dwarf_offdie (dwarf_cu_getdwarf (die.cu), par_off, &ret) == nullptr)
       throw_libdw ();
 
     return true;
   }
-
-  std::unique_ptr <value_die>
-  fetch_parent_die (value_die const *a)
-  {
-    assert (a != nullptr);
-    doneness d = a->get_doneness ();
-
-    // Both cooked and raw DIE's have parents (unless they don't, in
-    // which case we are already at root).  But for cooked DIE's,
-    // when the parent is partial unit root, we need to traverse
-    // further along the import chain.
-    Dwarf_Die par_die;
-    do
-      if (! get_parent (*a, par_die))
-	return nullptr;
-    while (d == doneness::cooked
-	   // Import another partial unit if possible, and keep
-	   // looking for the actual parent.
-	   && dwarf_tag (&par_die) == DW_TAG_partial_unit
-	   && a->get_import () != nullptr
-	   && (a = a->get_import ().get ()));
-
-    return std::make_unique <value_die> (a->get_dwctx (), par_die, 0, d);
-  }
 }
 
 std::unique_ptr <value_die>
 value_die::get_parent () const
 {
-  return fetch_parent_die (this);
+  // Both cooked and raw DIE's have parents (unless they don't, in
+  // which case we are already at root).  But for cooked DIE's, when
+  // the parent is partial unit root, we need to traverse further
+  // along the import chain.
+  Dwarf_Die die = get_die ();
+  import_id import = m_import;
+  Dwarf_Die par_die;
+  while (true)
+    {
+      if (! find_parent_die (*m_dwctx, die, par_die))
+	return nullptr;
+
+      if (is_raw ()
+	  || dwarf_tag (&par_die) != DW_TAG_partial_unit
+	  || import == no_import)
+	break;
+
+      // Import another partial unit, and keep looking for the
+      // actual parent.
+      die = m_dwctx->import_die (import);
+      import = m_dwctx->import_parent (import);
+    }
+
+  return std::make_unique <value_die> (m_dwctx, no_import, par_die, 0,
+				      get_doneness ());
 }
 
 
@@ -388,8 +466,8 @@ value_attr::cmp (value const &that) const
 {
   if (auto v = value::as <value_attr> (&that))
     {
-      Dwarf_Off a = dwarf_dieoffset (const_cast <Dwarf_Die *> (&get_die ()));
-      Dwarf_Off b = dwarf_dieoffset (const_cast <Dwarf_Die *> (&v->get_die ()));
+      Dwarf_Off a = die_offset (get_die ());
+      Dwarf_Off b = die_offset (v->get_die ());
       if (a != b)
 	return compare (a, b);
       else
@@ -400,6 +478,24 @@ value_attr::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_attr::hash () const
+{
+  return hash_combine
+    (die_offset (get_die ()),
+     dwarf_whatattr ((Dwarf_Attribute *) &m_attr));
+}
+
+bool
+value_attr::identical (value const &that) const
+{
+  auto v = value::as <value_attr> (&that);
+  return v != nullptr && get_doneness () == v->get_doneness ()
+    && m_die.identical (v->m_die)
+    && dwarf_whatattr ((Dwarf_Attribute *) &m_attr)
+	== dwarf_whatattr ((Dwarf_Attribute *) &v->m_attr);
+}
+
 
 value_type const value_abbrev_unit::vtype = value_type::alloc ("T_ABBREV_UNIT",
 R"docstring(
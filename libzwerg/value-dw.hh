@@ -87,6 +87,7 @@ public:
 
   void show (std::ostream &o) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -127,6 +128,7 @@ public:
 
   void show (std::ostream &o) const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
   std::unique_ptr <value> clone () const override;
 };
 
@@ -161,51 +163,68 @@ public:
   }
 };
 
+// DIE's are produced in large numbers, and copied around a lot, so
+// they are kept small and cheap to copy.  Besides a reference to the
+// context that they come from, which keeps it alive, DIE's only hold
+// an ID of their import chain and the parts of Dwarf_Die that matter.
+// The Dwarf_Die is rebuilt each time it's asked for, and things that
+// only a few DIE's ever need are allocated on demand.
 class value_die
   : public value
   , public doneness_aspect
 {
+  // For cooked DIE's, the chain of DW_TAG_imported_unit DIE's that
+  // this DIE went through during child traversals.
+  import_id m_import;
+
   std::shared_ptr <dwfl_context> m_dwctx;
-  Dwarf_Die m_die;
 
-  // For cooked DIE's, the DW_TAG_imported_unit DIE that this DIE went
-  // through during child traversals.
-  std::shared_ptr <value_die> m_import;
+  void *m_addr;
+  Dwarf_CU *m_cu;
+  Dwarf_Abbrev *m_abbrev;
 
-  dwarf_value_cache m_dwcache;
+  mutable std::unique_ptr <dwarf_value_cache> m_dwcache;
 
 public:
   static value_type const vtype;
 
-  value_die (std::shared_ptr <dwfl_context> dwctx,
-	     std::shared_ptr <value_die> import,
+  value_die (std::shared_ptr <dwfl_context> dwctx, import_id import,
 	     Dwarf_Die die, size_t pos, doneness d)
     : value {vtype, pos}
     , doneness_aspect {d}
-    , m_dwctx {(assert (dwctx != nullptr), dwctx)}
-    , m_die (die)
     , m_import {import}
+    , m_dwctx {(assert (dwctx != nullptr), std::move (dwctx))}
+    , m_addr {die.addr}
+    , m_cu {die.cu}
+    , m_abbrev {die.abbrev}
   {}
 
   value_die (std::shared_ptr <dwfl_context> dwctx,
 	     Dwarf_Die die, size_t pos, doneness d)
-    : value_die {dwctx, nullptr, die, pos, d}
+    : value_die {std::move (dwctx), no_import, die, pos, d}
   {}
 
-  std::shared_ptr <value_die>
+  value_die (value_die const &that);
+
+  import_id
   get_import () const
   {
-    assert (is_cooked ());
+    assert (is_cooked () || m_import == no_import);
     return m_import;
   }
 
-  Dwarf_Die &get_die ()
-  { return m_die; }
-
-  Dwarf_Die const &get_die () const
-  { return m_die; }
+  Dwarf_Die
+  get_die () const
+  {
+    Dwarf_Die ret;
+    ret.addr = m_addr;
+    ret.cu = m_cu;
+    ret.abbrev = m_abbrev;
+    ret.padding__ = 0;
+    return ret;
+  }
 
-  std::shared_ptr <dwfl_context> get_dwctx () const
+  std::shared_ptr <dwfl_context> const &get_dwctx () const
   { return m_dwctx; }
 
   void show (std::ostream &o) const override;
@@ -214,14 +233,14 @@ public:
   { return std::make_unique <value_die> (*this); }
 
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
+  bool identical (value const &that) const override;
+  bool has_identity () const override
+  { return true; }
 
   std::unique_ptr <value_die> get_parent () const;
 
-  value_dwarf &
-  get_dwarf ()
-  {
-    return m_dwcache.get_dwarf (m_dwctx, 0, get_doneness ());
-  }
+  value_dwarf &get_dwarf ();
 };
 
 // -------------------------------------------------------------------
@@ -258,10 +277,7 @@ public:
   value_die const &get_value_die () const
   { return m_die; }
 
-  Dwarf_Die &get_die ()
-  { return m_die.get_die (); }
-
-  Dwarf_Die const &get_die () const
+  Dwarf_Die get_die () const
   { return m_die.get_die (); }
 
   Dwarf_Attribute &get_attr ()
@@ -273,6 +289,10 @@ public:
   void show (std::ostream &o) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
+  bool identical (value const &that) const override;
+  bool has_identity () const override
+  { return true; }
 
   value_dwarf &
   get_dwarf ()
@@ -339,7 +359,8 @@ public:
   std::shared_ptr <dwfl_context> get_dwctx () const
   { return m_dwctx; }
 
-  Dwarf_Abbrev &get_abbrev ()
+  // The abbreviation itself is owned by libdw.
+  Dwarf_Abbrev &get_abbrev () const
   { return m_abbrev; }
 
   void show (std::ostream &o) const override;
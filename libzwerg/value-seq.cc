@@ -141,6 +141,32 @@ value_seq::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_seq::hash () const
+{
+  size_t ret = m_seq->size ();
+  for (auto const &v: *m_seq)
+    ret = hash_combine (ret, v->hash ());
+  return ret;
+}
+
+bool
+value_seq::identical (value const &that) const
+{
+  auto v = value::as <value_seq> (&that);
+  if (v == nullptr || m_seq->size () != v->m_seq->size ())
+    return false;
+
+  for (size_t i = 0; i < m_seq->size (); ++i)
+    {
+      value const &a = *(*m_seq)[i];
+      value const &b = *(*v->m_seq)[i];
+      if (a.get_pos () != b.get_pos () || ! a.identical (b))
+	return false;
+    }
+  return true;
+}
+
 value_seq
 op_add_seq::operate (std::unique_ptr <value_seq> a,
 		     std::unique_ptr <value_seq> b)
@@ -313,7 +339,7 @@ op_relem_seq::docstring ()
 }
 
 pred_result
-pred_empty_seq::result (value_seq &a)
+pred_empty_seq::result (value_seq const &a)
 {
   return pred_result (a.get_seq ()->empty ());
 }
@@ -381,7 +407,7 @@ directly, if possible::
 )docstring";
 
 pred_result
-pred_find_seq::result (value_seq &haystack, value_seq &needle)
+pred_find_seq::result (value_seq const &haystack, value_seq const &needle)
 {
   auto const &hay = *haystack.get_seq ();
   auto const &need = *needle.get_seq ();
@@ -426,7 +452,7 @@ For example::
 )docstring";
 
 pred_result
-pred_starts_seq::result (value_seq &haystack, value_seq &needle)
+pred_starts_seq::result (value_seq const &haystack, value_seq const &needle)
 {
   auto const &hay = *haystack.get_seq ();
   auto const &need = *needle.get_seq ();
@@ -472,7 +498,7 @@ For example::
 )docstring";
 
 pred_result
-pred_ends_seq::result (value_seq &haystack, value_seq &needle)
+pred_ends_seq::result (value_seq const &haystack, value_seq const &needle)
 {
   auto const &hay = *haystack.get_seq ();
   auto const &need = *needle.get_seq ();
@@ -67,6 +67,10 @@ public:
   void show (std::ostream &o) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
+  bool identical (value const &that) const override;
+  bool has_identity () const override
+  { return true; }
 };
 
 struct op_add_seq
@@ -116,7 +120,7 @@ struct pred_empty_seq
   : public pred_overload <value_seq>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_seq &a) override;
+  pred_result result (value_seq const &a) override;
 
   static std::string docstring ();
 };
@@ -125,7 +129,7 @@ struct pred_find_seq
   : public pred_overload <value_seq, value_seq>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_seq &haystack, value_seq &needle) override;
+  pred_result result (value_seq const &haystack, value_seq const &needle) override;
 
   static std::string docstring ();
 };
@@ -134,7 +138,7 @@ struct pred_starts_seq
   : public pred_overload <value_seq, value_seq>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_seq &haystack, value_seq &needle) override;
+  pred_result result (value_seq const &haystack, value_seq const &needle) override;
 
   static std::string docstring ();
 };
@@ -143,7 +147,7 @@ struct pred_ends_seq
   : public pred_overload <value_seq, value_seq>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_seq &haystack, value_seq &needle) override;
+  pred_result result (value_seq const &haystack, value_seq const &needle) override;
 
   static std::string docstring ();
 };
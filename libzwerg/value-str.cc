@@ -26,6 +26,7 @@
    the GNU Lesser General Public License along with this program.  If
    not, see <http://www.gnu.org/licenses/>.  */
 
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <regex.h>
@@ -68,6 +69,18 @@ value_str::cmp (value const &that) const
     return cmp_result::fail;
 }
 
+size_t
+value_str::hash () const
+{
+  return std::hash <std::string> {} (m_str);
+}
+
+bool
+value_str::identical (value const &that) const
+{
+  return cmp (that) == cmp_result::equal;
+}
+
 
 value_str
 op_add_str::operate (std::unique_ptr <value_str> a,
@@ -220,7 +233,7 @@ op_relem_str::docstring ()
 
 // ?empty
 pred_result
-pred_empty_str::result (value_str &a)
+pred_empty_str::result (value_str const &a)
 {
   return pred_result (a.get_string () == "");
 }
@@ -248,7 +261,7 @@ This predicate holds if the string on TOS is empty::
 extern char const g_find_docstring[];
 
 pred_result
-pred_find_str::result (value_str &haystack, value_str &needle)
+pred_find_str::result (value_str const &haystack, value_str const &needle)
 {
   return pred_result (haystack.get_string ().find (needle.get_string ())
 		      != std::string::npos);
@@ -266,7 +279,7 @@ pred_find_str::docstring ()
 extern char const g_starts_docstring[];
 
 pred_result
-pred_starts_str::result (value_str &haystack, value_str &needle)
+pred_starts_str::result (value_str const &haystack, value_str const &needle)
 {
   auto const &hay = haystack.get_string ();
   auto const &need = needle.get_string ();
@@ -287,7 +300,7 @@ pred_starts_str::docstring ()
 extern char const g_ends_docstring[];
 
 pred_result
-pred_ends_str::result (value_str &haystack, value_str &needle)
+pred_ends_str::result (value_str const &haystack, value_str const &needle)
 {
   auto const &hay = haystack.get_string ();
   auto const &need = needle.get_string ();
@@ -305,37 +318,146 @@ pred_ends_str::docstring ()
 
 // ?match
 
-pred_result
-pred_match_str::result (value_str &haystack, value_str &needle)
+// The needle of ?match is nearly always a literal, so the pattern
+// is compiled once and kept for as long as the needle stays the
+// same.  Patterns that contain no special characters other than a
+// leading ^ and a trailing $ don't need a regex engine at all, and
+// are matched by plain string comparison.
+class pred_match_str::pimpl
 {
-  regex_t re;
-  if (regcomp (&re, needle.get_string ().c_str(),
-	       REG_EXTENDED | REG_NOSUB) != 0)
+  enum class kind
     {
-      std::cerr << "Error: could not compile regular expression: '"
-		<< needle.get_string () << "'\n";
-      return pred_result::fail;
-    }
+      none,	// Nothing compiled yet.
+      invalid,	// The pattern doesn't compile.
+      regex,	// Go through regexec.
+      substr,	// Literal anywhere in the haystack.
+      prefix,	// ^literal
+      suffix,	// literal$
+      exact,	// ^literal$
+    };
+
+  std::string m_needle;
+  std::string m_lit;
+  kind m_kind;
+  regex_t m_re;
+
+  void
+  release ()
+  {
+    if (m_kind == kind::regex)
+      regfree (&m_re);
+    m_kind = kind::none;
+  }
 
-  const int reti = regexec (&re, haystack.get_string ().c_str (),
-			    /* nmatch: size of pmatch array */ 0,
-			    /* pmatch: array of matches */ NULL,
-			    /* no extra flags */ 0);
+  static bool
+  is_literal (std::string const &str)
+  {
+    return ! str.empty ()
+      && str.find_first_of (".[]()*+?{}|^$\\") == std::string::npos;
+  }
 
-  pred_result retval = pred_result::fail;
-  if (reti == 0)
-    retval = pred_result::yes;
-  else if (reti == REG_NOMATCH)
-    retval = pred_result::no;
-  else
-    {
-      char msgbuf[100];
-      regerror (reti, &re, msgbuf, sizeof (msgbuf));
-      std::cerr << "Error: match failed: " << msgbuf << "\n";
-    }
+  void
+  compile (std::string const &needle)
+  {
+    release ();
+    m_needle = needle;
+
+    // Like regcomp, only consider the part of the needle up to the
+    // first NUL.
+    std::string pat = needle.c_str ();
+    bool bol = pat.size () > 0 && pat.front () == '^';
+    bool eol = pat.size () > bol && pat.back () == '$';
+    std::string body = pat.substr (bol, pat.size () - bol - eol);
+    if (is_literal (body))
+      {
+	m_lit = body;
+	m_kind = bol ? (eol ? kind::exact : kind::prefix)
+	  : (eol ? kind::suffix : kind::substr);
+	return;
+      }
+
+    if (regcomp (&m_re, pat.c_str (), REG_EXTENDED | REG_NOSUB) != 0)
+      m_kind = kind::invalid;
+    else
+      m_kind = kind::regex;
+  }
+
+public:
+  pimpl ()
+    : m_kind {kind::none}
+  {}
+
+  ~pimpl ()
+  {
+    release ();
+  }
 
-  regfree (&re);
-  return retval;
+  pred_result
+  result (std::string const &haystack, std::string const &needle)
+  {
+    if (m_kind == kind::none || needle != m_needle)
+      compile (needle);
+
+    char const *h = haystack.c_str ();
+    size_t hlen = std::strlen (h);
+    size_t llen = m_lit.size ();
+    auto ret = [] (bool b) { return b ? pred_result::yes : pred_result::no; };
+
+    switch (m_kind)
+      {
+      case kind::substr:
+	return ret (std::strstr (h, m_lit.c_str ()) != nullptr);
+
+      case kind::prefix:
+	return ret (hlen >= llen
+		    && std::memcmp (h, m_lit.c_str (), llen) == 0);
+
+      case kind::suffix:
+	return ret (hlen >= llen
+		    && std::memcmp (h + hlen - llen, m_lit.c_str (), llen) == 0);
+
+      case kind::exact:
+	return ret (hlen == llen
+		    && std::memcmp (h, m_lit.c_str (), llen) == 0);
+
+      case kind::regex:
+	break;
+
+      case kind::none:
+      case kind::invalid:
+	std::cerr << "Error: could not compile regular expression: '"
+		  << needle << "'\n";
+	return pred_result::fail;
+      }
+
+    const int reti = regexec (&m_re, h,
+			      /* nmatch: size of pmatch array */ 0,
+			      /* pmatch: array of matches */ NULL,
+			      /* no extra flags */ 0);
+
+    if (reti == 0)
+      return pred_result::yes;
+    else if (reti == REG_NOMATCH)
+      return pred_result::no;
+
+    char msgbuf[100];
+    regerror (reti, &m_re, msgbuf, sizeof (msgbuf));
+    std::cerr << "Error: match failed: " << msgbuf << "\n";
+    return pred_result::fail;
+  }
+};
+
+pred_match_str::pred_match_str ()
+  : m_pimpl {std::make_unique <pimpl> ()}
+{}
+
+pred_match_str::~pred_match_str ()
+{}
+
+pred_result
+pred_match_str::result (value_str const &haystack, value_str const &needle)
+{
+  return m_pimpl->result (haystack.get_string (), needle.get_string ());
 }
 
 std::string
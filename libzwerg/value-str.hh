@@ -29,6 +29,7 @@
 #ifndef _VALUE_STR_H_
 #define _VALUE_STR_H_
 
+#include <memory>
 #include <string>
 
 #include "value.hh"
@@ -58,6 +59,10 @@ public:
   void show (std::ostream &o) const override;
   std::unique_ptr <value> clone () const override;
   cmp_result cmp (value const &that) const override;
+  size_t hash () const override;
+  bool identical (value const &that) const override;
+  bool has_identity () const override
+  { return true; }
 };
 
 struct op_add_str
@@ -107,7 +112,7 @@ struct pred_empty_str
   : public pred_overload <value_str>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_str &a) override;
+  pred_result result (value_str const &a) override;
 
   static std::string docstring ();
 };
@@ -116,7 +121,7 @@ struct pred_find_str
   : public pred_overload <value_str, value_str>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_str &haystack, value_str &needle) override;
+  pred_result result (value_str const &haystack, value_str const &needle) override;
 
   static std::string docstring ();
 };
@@ -125,7 +130,7 @@ struct pred_starts_str
   : public pred_overload <value_str, value_str>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_str &haystack, value_str &needle) override;
+  pred_result result (value_str const &haystack, value_str const &needle) override;
 
   static std::string docstring ();
 };
@@ -134,16 +139,22 @@ struct pred_ends_str
   : public pred_overload <value_str, value_str>
 {
   using pred_overload::pred_overload;
-  pred_result result (value_str &haystack, value_str &needle) override;
+  pred_result result (value_str const &haystack, value_str const &needle) override;
 
   static std::string docstring ();
 };
 
-struct pred_match_str
+class pred_match_str
   : public pred_overload <value_str, value_str>
 {
-  using pred_overload::pred_overload;
-  pred_result result (value_str &haystack, value_str &needle) override;
+  class pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+public:
+  pred_match_str ();
+  ~pred_match_str ();
+
+  pred_result result (value_str const &haystack, value_str const &needle) override;
 
   static std::string docstring ();
 };
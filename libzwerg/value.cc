@@ -153,6 +153,24 @@ value::get_type_const () const
   return {get_type ().code (), &slot_type_dom};
 }
 
+size_t
+value::hash () const
+{
+  return get_type ().code ();
+}
+
+bool
+value::identical (value const &that) const
+{
+  return false;
+}
+
+bool
+value::has_identity () const
+{
+  return false;
+}
+
 std::ostream &
 operator<< (std::ostream &o, value const &v)
 {
@@ -33,6 +33,7 @@
 #include <vector>
 
 #include "constant.hh"
+#include "pool.hh"
 
 enum class cmp_result
   {
@@ -53,6 +54,13 @@ compare (T const &a, T const &b)
   return cmp_result::equal;
 }
 
+// Mix hash H into SEED.
+inline size_t
+hash_combine (size_t seed, size_t h)
+{
+  return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
 // We use this to keep track of types of instances of subclasses of
 // class value.  value::as uses this to avoid having to dynamic_cast,
 // which is needlessly flexible and slow for our purposes.
@@ -115,6 +123,7 @@ std::ostream &operator<< (std::ostream &o, value_type const &v);
 extern constant_dom const &slot_type_dom;
 
 class zw_value
+  : public pooled
 {
   value_type const m_type;
   size_t m_pos;
@@ -138,6 +147,24 @@ public:
   virtual std::unique_ptr <zw_value> clone () const = 0;
   virtual cmp_result cmp (zw_value const &that) const = 0;
 
+  // Values that compare equal have to hash equal.  The default
+  // implementation only hashes the value type, which is correct, but
+  // puts all values of a given type into one bucket.
+  virtual size_t hash () const;
+
+  // Whether THAT is in every respect the same as this value, apart
+  // from position.  Values that compare equal may still differ in
+  // ways that show in what is computed from them, such as domain of
+  // a constant.  Identical values hash equal.  This is used for
+  // memoization (see op_memo), the default implementation considers
+  // no two values identical.
+  virtual bool identical (zw_value const &that) const;
+
+  // Whether identical may hold for this value at all.  It doesn't
+  // for types that keep the default implementation, and op_memo
+  // doesn't bother remembering those.
+  virtual bool has_identity () const;
+
   void
   set_pos (size_t pos)
   {
@@ -0,0 +1,761 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+
+#include "vm.hh"
+#include "scope.hh"
+#include "value-closure.hh"
+#include "value-cst.hh"
+#include "value-seq.hh"
+#include "value-str.hh"
+
+namespace
+{
+  enum class vm_opcode
+    {
+      // Push a copy of M_VALUE.
+      push,
+
+      // Build an op from M_TREE and resume it until it's drained.
+      call,
+
+      // Evaluate a predicate built from M_TREE, fail if it doesn't
+      // hold.
+      test,
+
+      // Continue at one of M_TARGETS, and on backtracking, at each
+      // of the others in turn, with a copy of the stack.  Like
+      // op_merge, start at the branch that the previous stack ended
+      // with: the Kth stack that comes here since the mark at M_A
+      // starts at branch -K mod N.  The count is kept in slot M_B of
+      // the mark.
+      alt,
+
+      // Continue at M_A.
+      jump,
+
+      // Push a new stack frame with M_A variables.
+      enter,
+
+      // Pop the top stack frame.
+      leave,
+
+      // Bind TOS to variable M_B in a frame M_A levels up.
+      bind,
+
+      // Run program at M_A and push a sequence of the values that it
+      // leaves on TOS.
+      capture,
+
+      // Run program at M_A, and for each stack that it produces, keep
+      // M_B values near its TOS.
+      subx,
+
+      // Start counting stacks for limit and alt instructions that
+      // refer to this one, with M_B slots for the latter.  Pushes a
+      // choice point that holds the counts and fails on backtracking.
+      mark,
+
+      // Pop N, and fail unless fewer than N stacks came here since
+      // the mark at M_A.  Once N did, drop the choice points pushed
+      // since the mark, so that no more are looked for.
+      limit,
+
+      // Produce the stack.
+      yield,
+    };
+
+  struct vm_insn
+  {
+    vm_opcode m_opcode;
+    size_t m_a;
+    size_t m_b;
+    std::shared_ptr <value const> m_value;
+    tree const *m_tree;
+    std::vector <size_t> m_targets;
+
+    explicit vm_insn (vm_opcode opcode, size_t a = 0, size_t b = 0)
+      : m_opcode {opcode}
+      , m_a {a}
+      , m_b {b}
+      , m_tree {nullptr}
+    {}
+  };
+}
+
+namespace
+{
+  // Whether T has an alternation that needs a mark to count in.
+  // Those in sub-programs are counted by marks of their own, but the
+  // overestimate does no harm.
+  bool
+  mentions_alt (tree const &t)
+  {
+    return t.tt () == tree_type::ALT
+      || std::any_of (t.m_children.begin (), t.m_children.end (),
+		      mentions_alt);
+  }
+}
+
+class vm_program
+{
+  // Instructions refer to nodes of this tree.
+  tree m_tree;
+
+  // Sub-programs that are yet to be compiled, and the instructions
+  // that refer to them.
+  std::deque <std::pair <size_t, tree const *>> m_pending;
+
+  size_t
+  emit (vm_insn insn)
+  {
+    m_code.push_back (std::move (insn));
+    return m_code.size () - 1;
+  }
+
+  void
+  emit_push (std::unique_ptr <value> val)
+  {
+    vm_insn insn {vm_opcode::push};
+    insn.m_value = std::move (val);
+    emit (std::move (insn));
+  }
+
+  void
+  emit_tree (vm_opcode opcode, tree const &t)
+  {
+    vm_insn insn {opcode};
+    insn.m_tree = &t;
+    emit (std::move (insn));
+  }
+
+  void
+  emit_sub (vm_opcode opcode, tree const &t, size_t b = 0)
+  {
+    m_pending.push_back (std::make_pair (emit (vm_insn {opcode, 0, b}), &t));
+  }
+
+  // Mark instruction that limit and alt instructions refer to, or
+  // no_mark if there is none.
+  static size_t const no_mark = (size_t) -1;
+  size_t m_mark;
+
+  void compile (tree const &t);
+
+  // Compile T, which starts counting for `limit' and alternations
+  // anew.  These are the places where the op graph resets the op's
+  // that T is built into.
+  void compile_region (tree const &t);
+
+public:
+  std::vector <vm_insn> m_code;
+
+  explicit vm_program (tree const &query);
+  vm_program (vm_program const &) = delete;
+};
+
+vm_program::vm_program (tree const &query)
+  : m_tree {query}
+  , m_mark {no_mark}
+{
+  compile_region (m_tree);
+  emit (vm_insn {vm_opcode::yield});
+
+  while (! m_pending.empty ())
+    {
+      auto p = m_pending.front ();
+      m_pending.pop_front ();
+      m_code[p.first].m_a = m_code.size ();
+      compile_region (*p.second);
+      emit (vm_insn {vm_opcode::yield});
+    }
+}
+
+void
+vm_program::compile_region (tree const &t)
+{
+  size_t saved = m_mark;
+  if (mentions_builtin (t, "limit") || mentions_alt (t))
+    m_mark = emit (vm_insn {vm_opcode::mark});
+  compile (t);
+  m_mark = saved;
+}
+
+void
+vm_program::compile (tree const &t)
+{
+  switch (t.tt ())
+    {
+    case tree_type::CAT:
+      for (auto const &child: t.m_children)
+	compile (child);
+      return;
+
+    case tree_type::NOP:
+      return;
+
+    case tree_type::ALT:
+      {
+	// Each branch but the last jumps past the rest when done.
+	// Like in the op graph, branches that mention `limit' start
+	// counting anew for each stack.
+	assert (m_mark != no_mark);
+	size_t alt = emit (vm_insn {vm_opcode::alt, m_mark,
+				    m_code[m_mark].m_b++});
+	std::vector <size_t> jumps;
+	for (size_t i = 0; i < t.m_children.size (); ++i)
+	  {
+	    m_code[alt].m_targets.push_back (m_code.size ());
+	    if (mentions_builtin (t.child (i), "limit"))
+	      compile_region (t.child (i));
+	    else
+	      compile (t.child (i));
+	    if (i + 1 < t.m_children.size ())
+	      jumps.push_back (emit (vm_insn {vm_opcode::jump}));
+	  }
+	for (auto i: jumps)
+	  m_code[i].m_a = m_code.size ();
+	return;
+      }
+
+    case tree_type::CONST:
+      emit_push (std::make_unique <value_cst> (t.cst (), 0));
+      return;
+
+    case tree_type::STR:
+      emit_push (std::make_unique <value_str> (std::string (t.str ()), 0));
+      return;
+
+    case tree_type::EMPTY_LIST:
+      emit_push (std::make_unique <value_seq> (value_seq::seq_t {}, 0));
+      return;
+
+    case tree_type::ASSERT:
+      emit_tree (vm_opcode::test, t.child (0));
+      return;
+
+    case tree_type::F_BUILTIN:
+      // Calls are made one stack at a time, but `limit' needs to see
+      // the whole stream to know when to stop.
+      if (is_builtin (t, "limit"))
+	{
+	  assert (m_mark != no_mark);
+	  emit (vm_insn {vm_opcode::limit, m_mark});
+	  return;
+	}
+      emit_tree (t.m_builtin->build_pred () != nullptr
+		 ? vm_opcode::test : vm_opcode::call, t);
+      return;
+
+    case tree_type::SCOPE:
+      emit (vm_insn {vm_opcode::enter, t.scp ()->num_names ()});
+      compile_region (t.child (0));
+      emit (vm_insn {vm_opcode::leave});
+      return;
+
+    case tree_type::BIND:
+      emit (vm_insn {vm_opcode::bind, t.cst ().value ().uval (),
+		     t.scp ()->index (t.str ())});
+      return;
+
+    case tree_type::CAPTURE:
+      emit_sub (vm_opcode::capture, t.child (0));
+      return;
+
+    case tree_type::SUBX_EVAL:
+      emit_sub (vm_opcode::subx, t.child (0), t.cst ().value ().uval ());
+      return;
+
+    case tree_type::OR:
+    case tree_type::COUNT:
+    case tree_type::IFELSE:
+    case tree_type::FORMAT:
+    case tree_type::CLOSE_STAR:
+    case tree_type::CLOSE_PLUS:
+    case tree_type::BLOCK:
+    case tree_type::READ:
+    case tree_type::F_DEBUG:
+      emit_tree (vm_opcode::call, t);
+      return;
+
+    case tree_type::PRED_AND:
+    case tree_type::PRED_OR:
+    case tree_type::PRED_NOT:
+    case tree_type::PRED_SUBX_ANY:
+    case tree_type::PRED_SUBX_CMP:
+      assert (! "Should never get here.");
+      abort ();
+    }
+
+  abort ();
+}
+
+std::shared_ptr <vm_program const>
+vm_compile (tree const &query)
+{
+  return std::make_shared <vm_program> (query);
+}
+
+namespace
+{
+  // An op built for a call instruction, together with the origin
+  // that feeds it.
+  struct vm_activation
+  {
+    std::shared_ptr <op_origin> m_origin;
+    std::shared_ptr <op> m_op;
+  };
+
+  // Run-time state of the instructions of a program.  Predicates and
+  // op's are built lazily and reused.  The context is shared by a
+  // machine and the machines that it starts for sub-programs.
+  class vm_context
+  {
+    vm_program const &m_prog;
+    std::vector <std::unique_ptr <pred>> m_preds;
+    std::vector <std::vector <vm_activation>> m_free;
+
+  public:
+    explicit vm_context (vm_program const &prog)
+      : m_prog (prog)
+      , m_preds (prog.m_code.size ())
+      , m_free (prog.m_code.size ())
+    {}
+
+    vm_insn const &
+    insn (size_t pc) const
+    {
+      return m_prog.m_code[pc];
+    }
+
+    pred &
+    get_pred (size_t pc)
+    {
+      auto &ret = m_preds[pc];
+      if (ret == nullptr)
+	ret = insn (pc).m_tree->build_pred ();
+      else
+	ret->reset ();
+      return *ret;
+    }
+
+    vm_activation
+    acquire (size_t pc, stack::uptr stk)
+    {
+      vm_activation ret;
+      auto &free = m_free[pc];
+      if (free.empty ())
+	{
+	  ret.m_origin = std::make_shared <op_origin> (nullptr);
+	  ret.m_op = insn (pc).m_tree->build_exec (ret.m_origin);
+	}
+      else
+	{
+	  ret = std::move (free.back ());
+	  free.pop_back ();
+	}
+
+      ret.m_op->reset ();
+      ret.m_origin->set_next (std::move (stk));
+      return ret;
+    }
+
+    void
+    release (size_t pc, vm_activation act)
+    {
+      m_free[pc].push_back (std::move (act));
+    }
+  };
+
+  class vm_machine
+  {
+    struct choice
+    {
+      // The instruction that pushed this choice point.
+      size_t m_pc;
+
+      // For alt, the stack to continue with.  For subx, the stack
+      // that the sub-program was started on.
+      stack::uptr m_stk;
+
+      // For call.
+      vm_activation m_act;
+
+      // For subx.
+      std::unique_ptr <vm_machine> m_sub;
+
+      // For mark, the number of stacks that came to limit.  For
+      // alt, the number of branches left to try.
+      uint64_t m_count;
+
+      // For alt, the branch to try next.
+      size_t m_branch;
+
+      // For mark, the number of stacks that came to each alt.
+      std::vector <uint64_t> m_alts;
+    };
+
+    vm_context &m_ctx;
+    std::vector <choice> m_choices;
+    size_t m_pc;
+    stack::uptr m_stk;
+
+    static stack::uptr
+    keep (stack const &base, stack &stk, size_t n)
+    {
+      auto ret = std::make_unique <stack> (base);
+      std::vector <std::unique_ptr <value>> kept;
+      for (size_t i = 0; i < n; ++i)
+	kept.push_back (stk.pop ());
+      for (size_t i = 0; i < n; ++i)
+	{
+	  ret->push (std::move (kept.back ()));
+	  kept.pop_back ();
+	}
+      return ret;
+    }
+
+    // Position of the choice point pushed by the mark at PC.  There
+    // is at most one such, as the code doesn't loop.
+    size_t
+    find_mark (size_t pc)
+    {
+      size_t pos = m_choices.size ();
+      while (m_choices[--pos].m_pc != pc)
+	assert (pos > 0);
+      return pos;
+    }
+
+    // Drop all choice points pushed after the one at position POS.
+    void
+    cut (size_t pos)
+    {
+      while (m_choices.size () > pos + 1)
+	{
+	  choice &c = m_choices.back ();
+	  if (m_ctx.insn (c.m_pc).m_opcode == vm_opcode::call)
+	    m_ctx.release (c.m_pc, std::move (c.m_act));
+	  m_choices.pop_back ();
+	}
+    }
+
+    // Resume the most recent choice point that has anything left.
+    // Return false if there is none.
+    bool
+    backtrack ()
+    {
+      while (! m_choices.empty ())
+	{
+	  choice &c = m_choices.back ();
+	  vm_insn const &insn = m_ctx.insn (c.m_pc);
+	  switch (insn.m_opcode)
+	    {
+	    case vm_opcode::alt:
+	      m_pc = insn.m_targets[c.m_branch];
+	      c.m_branch = (c.m_branch + 1) % insn.m_targets.size ();
+	      if (--c.m_count != 0)
+		m_stk = std::make_unique <stack> (*c.m_stk);
+	      else
+		{
+		  m_stk = std::move (c.m_stk);
+		  m_choices.pop_back ();
+		}
+	      return true;
+
+	    case vm_opcode::call:
+	      if (auto stk = c.m_act.m_op->next ())
+		{
+		  m_pc = c.m_pc + 1;
+		  m_stk = std::move (stk);
+		  return true;
+		}
+	      m_ctx.release (c.m_pc, std::move (c.m_act));
+	      break;
+
+	    case vm_opcode::subx:
+	      if (auto stk = c.m_sub->next ())
+		{
+		  m_pc = c.m_pc + 1;
+		  m_stk = keep (*c.m_stk, *stk, insn.m_b);
+		  return true;
+		}
+	      break;
+
+	    case vm_opcode::mark:
+	      break;
+
+	    default:
+	      assert (! "Instruction doesn't push choice points.");
+	      abort ();
+	    }
+
+	  m_choices.pop_back ();
+	}
+
+      return false;
+    }
+
+  public:
+    vm_machine (vm_context &ctx, size_t entry, stack::uptr stk)
+      : m_ctx (ctx)
+      , m_pc {entry}
+      , m_stk {std::move (stk)}
+    {}
+
+    stack::uptr
+    next ()
+    {
+      // The stack is consumed when it's yielded.  When asked again,
+      // find another way through the program.
+      if (m_stk == nullptr && ! backtrack ())
+	return nullptr;
+
+      while (true)
+	{
+	  vm_insn const &insn = m_ctx.insn (m_pc);
+	  switch (insn.m_opcode)
+	    {
+	    case vm_opcode::push:
+	      m_stk->push (insn.m_value->clone ());
+	      ++m_pc;
+	      continue;
+
+	    case vm_opcode::call:
+	      {
+		auto act = m_ctx.acquire (m_pc, std::move (m_stk));
+		if (auto stk = act.m_op->next ())
+		  {
+		    m_choices.push_back (choice {m_pc, nullptr,
+						 std::move (act), nullptr, 0});
+		    m_stk = std::move (stk);
+		    ++m_pc;
+		    continue;
+		  }
+		m_ctx.release (m_pc, std::move (act));
+		break;
+	      }
+
+	    case vm_opcode::test:
+	      if (m_ctx.get_pred (m_pc).result (*m_stk) == pred_result::yes)
+		{
+		  ++m_pc;
+		  continue;
+		}
+	      m_stk = nullptr;
+	      break;
+
+	    case vm_opcode::alt:
+	      {
+		size_t n = insn.m_targets.size ();
+		uint64_t k = m_choices[find_mark (insn.m_a)].m_alts[insn.m_b]++;
+		size_t start = (n - k % n) % n;
+		if (n > 1)
+		  m_choices.push_back (choice {m_pc,
+					       std::make_unique <stack> (*m_stk),
+					       vm_activation {}, nullptr, n - 1,
+					       (start + 1) % n});
+		m_pc = insn.m_targets[start];
+		continue;
+	      }
+
+	    case vm_opcode::jump:
+	      m_pc = insn.m_a;
+	      continue;
+
+	    case vm_opcode::enter:
+	      m_stk->set_frame (std::make_shared <frame> (m_stk->nth_frame (0),
+							  insn.m_a));
+	      ++m_pc;
+	      continue;
+
+	    case vm_opcode::leave:
+	      {
+		std::shared_ptr <frame> of = m_stk->nth_frame (0);
+		m_stk->set_frame (m_stk->nth_frame (1));
+		value_closure::maybe_unlink_frame (of);
+		++m_pc;
+		continue;
+	      }
+
+	    case vm_opcode::bind:
+	      {
+		auto frame = m_stk->nth_frame (insn.m_a);
+		frame->bind_value (var_id (insn.m_b), m_stk->pop ());
+		++m_pc;
+		continue;
+	      }
+
+	    case vm_opcode::capture:
+	      {
+		vm_machine sub {m_ctx, insn.m_a, std::make_unique <stack> (*m_stk)};
+		value_seq::seq_t vv;
+		while (auto stk = sub.next ())
+		  vv.push_back (stk->pop ());
+		m_stk->push (std::make_unique <value_seq> (std::move (vv), 0));
+		++m_pc;
+		continue;
+	      }
+
+	    case vm_opcode::subx:
+	      {
+		auto sub = std::make_unique <vm_machine>
+		  (m_ctx, insn.m_a, std::make_unique <stack> (*m_stk));
+		if (auto stk = sub->next ())
+		  {
+		    auto ret = keep (*m_stk, *stk, insn.m_b);
+		    m_choices.push_back (choice {m_pc, std::move (m_stk),
+						 vm_activation {},
+						 std::move (sub), 0});
+		    m_stk = std::move (ret);
+		    ++m_pc;
+		    continue;
+		  }
+		m_stk = nullptr;
+		break;
+	      }
+
+	    case vm_opcode::mark:
+	      m_choices.push_back (choice {m_pc, nullptr, vm_activation {},
+					   nullptr, 0, 0,
+					   std::vector <uint64_t> (insn.m_b)});
+	      ++m_pc;
+	      continue;
+
+	    case vm_opcode::limit:
+	      {
+		auto vp = m_stk->pop ();
+		auto v = value::as <value_cst> (&*vp);
+		if (v == nullptr)
+		  throw std::runtime_error ("`limit' expects a T_CST on TOS");
+		auto const &val = v->get_constant ().value ();
+		uint64_t lim = val < 0 ? 0 : val.uval ();
+
+		size_t pos = find_mark (insn.m_a);
+		choice &mark = m_choices[pos];
+		if (mark.m_count >= lim)
+		  {
+		    cut (pos);
+		    m_stk = nullptr;
+		    break;
+		  }
+
+		if (++mark.m_count == lim)
+		  cut (pos);
+		++m_pc;
+		continue;
+	      }
+
+	    case vm_opcode::yield:
+	      return std::move (m_stk);
+	    }
+
+	  // The instruction failed.
+	  if (! backtrack ())
+	    return nullptr;
+	}
+    }
+  };
+}
+
+class op_vm::pimpl
+{
+  std::shared_ptr <vm_program const> m_prog;
+  vm_context m_ctx;
+  std::unique_ptr <vm_machine> m_machine;
+
+public:
+  explicit pimpl (std::shared_ptr <vm_program const> prog)
+    : m_prog {prog}
+    , m_ctx {*prog}
+  {}
+
+  stack::uptr
+  next (op &upstream)
+  {
+    while (true)
+      {
+	if (m_machine == nullptr)
+	  {
+	    if (auto stk = upstream.next ())
+	      m_machine = std::make_unique <vm_machine>
+		(m_ctx, 0, std::move (stk));
+	    else
+	      return nullptr;
+	  }
+
+	if (auto stk = m_machine->next ())
+	  return stk;
+
+	m_machine = nullptr;
+      }
+  }
+
+  void
+  reset ()
+  {
+    m_machine = nullptr;
+  }
+
+  size_t
+  size () const
+  {
+    return m_prog->m_code.size ();
+  }
+};
+
+op_vm::op_vm (std::shared_ptr <op> upstream,
+	      std::shared_ptr <vm_program const> program)
+  : inner_op {upstream}
+  , m_pimpl {std::make_unique <pimpl> (program)}
+{}
+
+op_vm::~op_vm ()
+{}
+
+stack::uptr
+op_vm::next ()
+{
+  return m_pimpl->next (*m_upstream);
+}
+
+void
+op_vm::reset ()
+{
+  m_pimpl->reset ();
+  inner_op::reset ();
+}
+
+std::string
+op_vm::name () const
+{
+  return std::string ("vm<") + std::to_string (m_pimpl->size ()) + ">";
+}
@@ -0,0 +1,82 @@
+/*
+   Copyright (C) 2015 Red Hat, Inc.
+   This file is part of dwgrep.
+
+   This file is free software; you can redistribute it and/or modify
+   it under the terms of either
+
+     * the GNU Lesser General Public License as published by the Free
+       Software Foundation; either version 3 of the License, or (at
+       your option) any later version
+
+   or
+
+     * the GNU General Public License as published by the Free
+       Software Foundation; either version 2 of the License, or (at
+       your option) any later version
+
+   or both in parallel, as here.
+
+   dwgrep is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received copies of the GNU General Public License and
+   the GNU Lesser General Public License along with this program.  If
+   not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include <memory>
+#include <vector>
+
+#include "op.hh"
+#include "tree.hh"
+
+// An alternative to evaluating queries as a graph of op's.  The query
+// tree is compiled into flat code for a backtracking virtual machine,
+// in the style of Icon or Prolog.  Instead of pulling stacks through
+// a chain of op's, the machine runs instructions one after another,
+// and keeps an explicit stack of choice points that it backtracks to
+// when an instruction fails.  Instructions that can produce more than
+// one stack push a choice point that yields the next one on
+// backtracking.
+//
+// Sequencing, alternation, constants, assertions, scopes, variable
+// binding, sub-expressions ([...] and evaluated sub-expressions) and
+// `limit' are handled by the machine itself.  Everything else is
+// still built into op's that the machine calls: words, including
+// generators such as `entry' or `elem', as well as ||, counting of
+// [X] length, if-then-else, format strings, closures, iteration and
+// variable reads.  A call instruction resumes its op on backtracking.
+//
+// Results come in the same order as from the op graph.  In
+// particular, an alternation doesn't try its branches in their
+// natural order: like op_merge, it starts each stack at the branch
+// that the previous one ended with.
+class vm_program;
+
+// Compile QUERY for the virtual machine.
+std::shared_ptr <vm_program const> vm_compile (tree const &query);
+
+// An op that runs PROGRAM on every stack that comes from upstream.
+class op_vm
+  : public inner_op
+{
+  class pimpl;
+  std::unique_ptr <pimpl> m_pimpl;
+
+public:
+  op_vm (std::shared_ptr <op> upstream,
+	 std::shared_ptr <vm_program const> program);
+  ~op_vm ();
+
+  stack::uptr next () override;
+  void reset () override;
+  std::string name () const override;
+};
+
+#endif /* _VM_H_ */
@@ -32,6 +32,21 @@ expect_count ()
 	echo "expected: $COUNT" >&2
 	echo "     got: $GOT" >&2
     fi
+    expect_same_backends "$@"
+}
+
+# Check that the bytecode backend gives the same results, in the same
+# order, as the default one.
+expect_same_backends ()
+{
+    export total=$((total + 1))
+    WANT=$(timeout $ZW_TEST_TIMEOUT $DWGREP "$@" 2>&1)
+    GOT=$(timeout $ZW_TEST_TIMEOUT $DWGREP --vm "$@" 2>&1)
+    if [ "$GOT" != "$WANT" ]; then
+	fail "$DWGREP --vm" "$@"
+	echo "expected: $WANT" >&2
+	echo "     got: $GOT" >&2
+    fi
 }
 
 expect_error ()
@@ -219,6 +234,12 @@ expect_count 1 ./nontrivial-types.o -e '
 	entry ?(@AT_language "%s" "DW_LANG_C89" ?match)'
 expect_count 1 ./nontrivial-types.o -e '
 	entry ?(@AT_encoding "%s" "^DW_ATE_signed$" ?match)'
+expect_count 7 ./duplicate-const -e '
+	entry ?(@AT_decl_file "petr" ?match)'
+expect_count 1 ./nontrivial-types.o -e '
+	entry ?(@AT_language "%s" "^DW_LANG_" ?match)'
+expect_count 1 ./nontrivial-types.o -e '
+	entry ?(@AT_language "%s" "C89$" ?match)'
 expect_count 7 ./duplicate-const -e '
 	entry (@AT_decl_file =~ "")'
 expect_count 7 ./duplicate-const -e '
@@ -378,6 +399,51 @@ expect_count 1 -e '
 	?(7 fact 5040 ?eq)
 	?(8 fact 40320 ?eq)'
 
+# Check the bytecode backend.  Besides these, every expect_count
+# query is also run on it and compared with the default backend.
+expect_count 6 ./typedef.o --vm -e '
+	entry (@AT_decl_line || drop 42)'
+expect_count 3 --vm -e '
+	let E := [0, 1, 2] elem; E (== pos)'
+expect_count 1 --vm -e '
+	{|N| (?(N 2 ?lt) 1 || N 1 sub fact N mul)} -> fact;
+	?(5 fact 120 ?eq)'
+expect_count 1 ./duplicate-const --vm -e '
+	let ?cvr_type := {?TAG_const_type,?TAG_volatile_type,?TAG_restrict_type};
+	let P := entry ;
+	let A := P child ?cvr_type ;
+	let B := P child ?cvr_type ?(?lt: A) ;
+	?((A label) ?eq: (B label))
+	?((A @AT_type) ?eq: (B @AT_type))'
+
+# Check that [X] length counts without collecting.
+expect_count 1 -e '[(1, 2, 3) (4, 5)] length (== 6)'
+expect_count 1 ./typedef.o -e '[entry] length (== 6) drop [entry] (length == 6)'
+expect_count 2 -e '[(1, 2, 3) (4, 5)] length (== 6) (1, 2) pos'
+expect_error 'COUNT' --profile -e '[(1, 2, 3) (4, 5)] length (1, 2) pos'
+
+# Check that limit and -m stop early.
+expect_count 2 -e '(1, 2, 3, 4) 2 limit'
+expect_count 1 -e '[(1, 2, 3, 4) 2 limit] length (== 2)'
+expect_count 3 ./typedef.o -e 'entry 3 limit'
+expect_count 3 -m 3 ./typedef.o -e 'entry'
+expect_count 6 -m 10 ./typedef.o -e 'entry'
+expect_count 0 -m 0 ./typedef.o -e 'entry'
+expect_count 2 --vm -e '(1, 2, 3, 4) 2 limit'
+expect_count 4 -e '(1, 2) ((3, 4, 5) 1 limit, 6)'
+expect_count 4 --vm -e '(1, 2) ((3, 4, 5) 1 limit, 6)'
+expect_error 'expects a T_CST' -e '1 "x" limit'
+
+# Check that stacks past the limit are not even looked at.
+expect_out '1' -e '(1, "a") ?(1 add == 2) 1 limit'
+expect_out '1' -m 1 -e '(1, "a") ?(1 add == 2)'
+expect_out '1' -m 1 -e '[1, "a"] elem ?(1 add == 2)'
+expect_error 'add' -e '(1, "a") ?(1 add == 2)'
+
+# Check profiling.
+expect_error 'produced=3 rejected=2' --profile -e '
+	[1, 2, 3, 4, 5] elem 3 ?ge'
+
 # Examples.
 expect_count 1 ./duplicate-const -e '
 	let ?cvr_type := {?TAG_const_type,?TAG_volatile_type,?TAG_restrict_type};
@@ -636,6 +702,17 @@ expect_count 1 ./aranges.o -e '
 	     0x1000e, 0x1000f, 0x10010, 0x10011, 0x10012, 0x10013, 0x10014]
 	    relem]'
 
+expect_count 1 ./aranges.o -e '
+	[0x10005 scopes offset] == [0x5b, 0x2d, 0xb]'
+expect_count 1 ./aranges.o -e '
+	[0x10009 scopes offset] == [0x2d, 0xb]'
+expect_count 0 ./aranges.o -e '
+	0x1001a scopes'
+expect_count 1 ./twocus -e '
+	[0x4004bd scopes offset] == [0x80, 0x5e]'
+expect_count 1 ./aranges.o -e '
+	[entry ?(address 0x10005 ?contains) offset] == [0xb, 0x2d, 0x5b]'
+
 expect_count 1 ./pointer_const_value.o -e '
 	entry @AT_const_value == 0'
 
@@ -837,6 +914,10 @@ expect_out '0..0xffffffffffffffff:0 call_frame_cfa' \
 expect_out '0x10004..0x10009, 0x1000e..0x10015' \
 	aranges.o -e 'entry @AT_ranges'
 
+# DIE's keep the Dwarf that dwopen opened alive after the capture.
+expect_count 1 -e '
+	["twocus" dwopen entry] elem (name == "main") parent ?root'
+
 # T_ELFSYM
 expect_out "1:	0000000000000000      0 FILE	LOCAL	DEFAULT	enum.cc
 12:	0000000000000000      4 OBJECT	GLOBAL	DEFAULT	ae
@@ -874,6 +955,20 @@ expect_out '0 breg5 <0>
 	 bitcount.o -e 'entry (offset == 0x91) @AT_location (pos == 1) elem'
 
 
+# Parallel processing of several files keeps the command-line order.
+expect_out "a1.out:1
+twocus:1
+empty:1" \
+	-c -j 2 a1.out twocus empty -e ''
+
+expect_out 'a1.out:
+<Dwarf "a1.out">
+twocus:
+<Dwarf "twocus">
+empty:
+<Dwarf "empty">' \
+	-j 3 a1.out twocus empty -e ''
+
 # =============================================================================
 
 echo "$total tests total, $failures failures."